@@ -0,0 +1,61 @@
+/*
+ * file: eeprom.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This file has the functions for reading and writing the data EEPROM, which
+ * is used to keep settings when the power is off.
+ */
+
+#include "parameters.h"
+
+/*
+ * This reads one byte from the EEPROM. If a write is still going it waits for
+ * it to finish first.
+ */
+unsigned char EEPROMRead(unsigned char address) {
+    while (EECON1bits.WR);
+    EEADR = address;
+    //Point at the data EEPROM instead of the flash or the config bits
+    EECON1bits.EEPGD = 0;
+    EECON1bits.CFGS = 0;
+    EECON1bits.RD = 1;
+    return EEDATA;
+}
+
+/*
+ * This starts writing one byte to the EEPROM. A write takes about 4ms, this
+ * only waits if the last write hasn't finished so it returns straight away
+ * when a single byte is written. The interrupts are left the way they were, so
+ * it can be used before they are turned on.
+ */
+void EEPROMWrite(unsigned char address, unsigned char value) {
+    unsigned char interrupts = INTCONbits.GIE;
+    while (EECON1bits.WR);
+    EEADR = address;
+    EEDATA = value;
+    EECON1bits.EEPGD = 0;
+    EECON1bits.CFGS = 0;
+    EECON1bits.WREN = 1;
+    //The unlock sequence can't be interrupted
+    di();
+    EECON2 = 0x55;
+    EECON2 = 0xAA;
+    EECON1bits.WR = 1;
+    if (interrupts) {
+        ei();
+    }
+    EECON1bits.WREN = 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * file: encoder.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This file has the quadrature encoder inputs. The encoder pins use the
+ * interrupt on change, every time one of them changes the interrupt works out
+ * which way the encoder moved and changes the position.
+ *
+ * Only RA0, RA1, RA3-RA5 and RB4-RB7 have interrupt on change. RA4, RA5, RB4
+ * and RB6 are used by the motors and the i2c, so there are only inputs for two
+ * quadrature encoders and one pulse counter:
+ *  motor 0 uses RA0 and RA1, these can only be inputs while USB is off
+ *  motor 1 uses RB5 and RB7. These are the cdir pins of motors 3 and 2 so while
+ *  it is on those motors have to use drivers that only need one direction pin.
+ *  motor 2 counts pulses on RA3 (MCLR is turned off). There is only one
+ *  channel so the count goes up or down with the motor's direction.
+ * Motor 3 doesn't have an input.
+ */
+
+#include "parameters.h"
+
+/*
+ * The port and the pins for the A and B channels of each motor's encoder, the
+ * masks are 0 for motors without an encoder. Pulse counters only have an A
+ * channel.
+ */
+struct EncoderInput {
+    unsigned char port;
+    unsigned char a;
+    unsigned char b;
+};
+
+const struct EncoderInput EncoderInputs[4] = {
+    {PORT_A, 0x01, 0x02},
+    {PORT_B, 0x20, 0x80},
+    {PORT_A, 0x08, 0},
+    {PORT_A, 0, 0}
+};
+
+/*
+ * The change in position for each pair of states, the index is the old state
+ * times 4 plus the new state where the state is B * 2 + A. If both channels
+ * change at once a step was missed and nothing is counted.
+ */
+const signed char QuadratureSteps[16] = {
+    0, 1, -1, 0,
+    -1, 0, 0, 1,
+    1, 0, 0, -1,
+    0, -1, 1, 0
+};
+
+//The last state of each encoder
+unsigned char EncoderStates[4];
+//The encoders that are set up, EncoderEnable is what the host asked for
+volatile unsigned char EncodersOn = 0;
+
+/*
+ * This gives the state of an encoder from the values of the ports.
+ */
+unsigned char EncoderState(unsigned char index, const unsigned char *ports) {
+    unsigned char state = 0;
+    if (ports[EncoderInputs[index].port] & EncoderInputs[index].a) {
+        state |= 1;
+    }
+    if (ports[EncoderInputs[index].port] & EncoderInputs[index].b) {
+        state |= 2;
+    }
+    return state;
+}
+
+/*
+ * This sets up the pins and the interrupt on change for the encoders in
+ * EncoderEnable. It is called after the i2c registers are committed.
+ */
+void ConfigureEncoders(void) {
+    unsigned char inputs[3] = {0, 0, 0};
+    unsigned char ports[2];
+    unsigned char n;
+    //Motors without encoder inputs can't be turned on, and steppers count
+    //their steps in MotorPositions instead
+    for (n = 0; n < 4; n++) {
+        if (EncoderInputs[n].a == 0 || Motors[n].motorType == MOTOR_TYPE_STEPPER) {
+            EncoderEnable &= (unsigned char)~(1 << n);
+        } else if (EncoderEnable & (1 << n)) {
+            inputs[EncoderInputs[n].port] |= EncoderInputs[n].a | EncoderInputs[n].b;
+        }
+    }
+    if (EncoderEnable == EncodersOn) {
+        return;
+    }
+    //Take the inputs out of the motor pins before they stop being outputs
+    SetCdirInputs(inputs);
+    SetDirectionPins(0b1111);
+    di();
+    //RA0 and RA1 are always inputs, the port B pins have to be changed
+    TRISB = (TRISB & (unsigned char)~0b10100000) | (inputs[PORT_B] & 0b10100000);
+    //RB5 is also an analog input, it has to be digital to be read
+    ANSELHbits.ANS11 = (inputs[PORT_B] & 0b00100000) ? 0 : 1;
+    IOCA = inputs[PORT_A];
+    IOCB = inputs[PORT_B];
+    //Reading the ports sets the values that the changes are compared to
+    ports[PORT_A] = PORTA;
+    ports[PORT_B] = PORTB;
+    for (n = 0; n < 4; n++) {
+        if (EncoderEnable & (1 << n)) {
+            EncoderStates[n] = EncoderState(n, ports);
+        }
+    }
+    EncodersOn = EncoderEnable;
+    INTCONbits.RABIF = 0;
+    INTCONbits.RABIE = EncodersOn ? 1 : 0;
+    ei();
+}
+
+/*
+ * This is called from the interrupt when an encoder pin changes.
+ */
+void EncoderInterrupt(void) {
+    unsigned char ports[2];
+    unsigned char n, state;
+    //Reading the ports ends the change so the flag can be cleared
+    ports[PORT_A] = PORTA;
+    ports[PORT_B] = PORTB;
+    INTCONbits.RABIF = 0;
+    for (n = 0; n < 4; n++) {
+        if (EncodersOn & (1 << n)) {
+            state = EncoderState(n, ports);
+            if (EncoderInputs[n].b) {
+                MotorPositions[n] += QuadratureSteps[(EncoderStates[n] << 2) | state];
+            } else if (state > EncoderStates[n]) {
+                //A pulse counter counts rising edges
+                MotorPositions[n] += Motors[n].direction ? 1 : -1;
+            }
+            EncoderStates[n] = state;
+        }
+    }
+}
+
+/*
+ * This gives the position of an encoder to the main loop, the interrupt can't
+ * change it half way through reading it.
+ */
+long ReadEncoder(unsigned int index) {
+    long position;
+    di();
+    position = MotorPositions[index];
+    ei();
+    return position;
+}
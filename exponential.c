@@ -0,0 +1,104 @@
+/*
+ * file: exponential.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This file is generated by tools/exponential.py, don't edit it by hand.
+ *
+ * ExponentialSteps[curve][distance] is the change in duty for one step of the
+ * exponential acceleration profile when the duty is distance away from the
+ * target. The time constants of the curves are 4, 8, 16, 32 steps.
+ */
+
+#include "parameters.h"
+
+const unsigned char ExponentialSteps[EXPONENTIAL_CURVES][256] = {
+    //tau = 4
+    {
+          0,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   3,   3,   3,   3,
+          4,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,   6,   6,   7,   7,
+          7,   7,   8,   8,   8,   8,   8,   9,   9,   9,   9,  10,  10,  10,  10,  10,
+         11,  11,  11,  11,  12,  12,  12,  12,  12,  13,  13,  13,  13,  13,  14,  14,
+         14,  14,  15,  15,  15,  15,  15,  16,  16,  16,  16,  17,  17,  17,  17,  17,
+         18,  18,  18,  18,  19,  19,  19,  19,  19,  20,  20,  20,  20,  21,  21,  21,
+         21,  21,  22,  22,  22,  22,  23,  23,  23,  23,  23,  24,  24,  24,  24,  25,
+         25,  25,  25,  25,  26,  26,  26,  26,  27,  27,  27,  27,  27,  28,  28,  28,
+         28,  29,  29,  29,  29,  29,  30,  30,  30,  30,  31,  31,  31,  31,  31,  32,
+         32,  32,  32,  33,  33,  33,  33,  33,  34,  34,  34,  34,  35,  35,  35,  35,
+         35,  36,  36,  36,  36,  36,  37,  37,  37,  37,  38,  38,  38,  38,  38,  39,
+         39,  39,  39,  40,  40,  40,  40,  40,  41,  41,  41,  41,  42,  42,  42,  42,
+         42,  43,  43,  43,  43,  44,  44,  44,  44,  44,  45,  45,  45,  45,  46,  46,
+         46,  46,  46,  47,  47,  47,  47,  48,  48,  48,  48,  48,  49,  49,  49,  49,
+         50,  50,  50,  50,  50,  51,  51,  51,  51,  52,  52,  52,  52,  52,  53,  53,
+         53,  53,  54,  54,  54,  54,  54,  55,  55,  55,  55,  56,  56,  56,  56,  56
+    },
+    //tau = 8
+    {
+          0,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,
+          2,   2,   2,   2,   2,   2,   3,   3,   3,   3,   3,   3,   3,   3,   4,   4,
+          4,   4,   4,   4,   4,   4,   4,   5,   5,   5,   5,   5,   5,   5,   5,   6,
+          6,   6,   6,   6,   6,   6,   6,   6,   7,   7,   7,   7,   7,   7,   7,   7,
+          8,   8,   8,   8,   8,   8,   8,   8,   8,   9,   9,   9,   9,   9,   9,   9,
+          9,  10,  10,  10,  10,  10,  10,  10,  10,  10,  11,  11,  11,  11,  11,  11,
+         11,  11,  12,  12,  12,  12,  12,  12,  12,  12,  12,  13,  13,  13,  13,  13,
+         13,  13,  13,  14,  14,  14,  14,  14,  14,  14,  14,  14,  15,  15,  15,  15,
+         15,  15,  15,  15,  16,  16,  16,  16,  16,  16,  16,  16,  16,  17,  17,  17,
+         17,  17,  17,  17,  17,  18,  18,  18,  18,  18,  18,  18,  18,  18,  19,  19,
+         19,  19,  19,  19,  19,  19,  20,  20,  20,  20,  20,  20,  20,  20,  20,  21,
+         21,  21,  21,  21,  21,  21,  21,  22,  22,  22,  22,  22,  22,  22,  22,  22,
+         23,  23,  23,  23,  23,  23,  23,  23,  24,  24,  24,  24,  24,  24,  24,  24,
+         24,  25,  25,  25,  25,  25,  25,  25,  25,  25,  26,  26,  26,  26,  26,  26,
+         26,  26,  27,  27,  27,  27,  27,  27,  27,  27,  27,  28,  28,  28,  28,  28,
+         28,  28,  28,  29,  29,  29,  29,  29,  29,  29,  29,  29,  30,  30,  30,  30
+    },
+    //tau = 16
+    {
+          0,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+          1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+          2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   3,   3,   3,   3,   3,   3,
+          3,   3,   3,   3,   3,   3,   3,   3,   3,   3,   4,   4,   4,   4,   4,   4,
+          4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   5,   5,   5,   5,   5,
+          5,   5,   5,   5,   5,   5,   5,   5,   5,   5,   5,   6,   6,   6,   6,   6,
+          6,   6,   6,   6,   6,   6,   6,   6,   6,   6,   6,   6,   7,   7,   7,   7,
+          7,   7,   7,   7,   7,   7,   7,   7,   7,   7,   7,   7,   8,   8,   8,   8,
+          8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   9,   9,   9,
+          9,   9,   9,   9,   9,   9,   9,   9,   9,   9,   9,   9,   9,  10,  10,  10,
+         10,  10,  10,  10,  10,  10,  10,  10,  10,  10,  10,  10,  10,  10,  11,  11,
+         11,  11,  11,  11,  11,  11,  11,  11,  11,  11,  11,  11,  11,  11,  12,  12,
+         12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  13,
+         13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  14,
+         14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,
+         15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15
+    },
+    //tau = 32
+    {
+          0,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+          1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+          1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+          1,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+          2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+          2,   2,   3,   3,   3,   3,   3,   3,   3,   3,   3,   3,   3,   3,   3,   3,
+          3,   3,   3,   3,   3,   3,   3,   3,   3,   3,   3,   3,   3,   3,   3,   3,
+          3,   3,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,
+          4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,
+          4,   4,   4,   5,   5,   5,   5,   5,   5,   5,   5,   5,   5,   5,   5,   5,
+          5,   5,   5,   5,   5,   5,   5,   5,   5,   5,   5,   5,   5,   5,   5,   5,
+          5,   5,   5,   6,   6,   6,   6,   6,   6,   6,   6,   6,   6,   6,   6,   6,
+          6,   6,   6,   6,   6,   6,   6,   6,   6,   6,   6,   6,   6,   6,   6,   6,
+          6,   6,   6,   6,   7,   7,   7,   7,   7,   7,   7,   7,   7,   7,   7,   7,
+          7,   7,   7,   7,   7,   7,   7,   7,   7,   7,   7,   7,   7,   7,   7,   7,
+          7,   7,   7,   7,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8,   8
+    }
+};
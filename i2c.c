@@ -31,32 +31,24 @@ void InitI2C(void) {
     //Slew rate control disabled, I don't know if this is needed. Test it.
     SSPSTATbits.SMP = 1;
 
-    //Set the mode to i2c slave without interrupts enabled for start and stop bits
-    SSPCON1bits.SSPM = 0b0110;
+    //Set the mode to i2c slave with interrupts enabled for start and stop bits,
+    //the stop bit is used to commit the values that were written.
+    SSPCON1bits.SSPM = 0b1110;
     //Enable clock stretching
     SSPCON2bits.SEN = 1;
     //Disable clock stretching
     //SSPCON2bits.SEN = 0;
 
-    //Set the bitmask for the address so that the controller responds to
-    //multiple addresses.
-    //SSPMSKbits.MSK = 0b01000110;
-
-    //This is the i2c address of the controller. It should be between 0x00 and 0x7F
-    //The 7 bit address is 0x23, but it needs to be shifted to the left by one
-    //because SSPADD is an 8 bit register and the address is stored in bits<7:1>
-    SSPADD = I2C_ADDRESS<<1;
+    //Set the address, the address mask and the general call
+    ConfigureI2C();
 
     //Clear the interrupt flag to ensure that it is cleared to start.
     PIR1bits.SSPIF = 0;
-    //Enable i2c interrupts
+    //Enable i2c interrupts, they are low priority (see main.c) and turned on
+    //with the rest once everything is set up
+    IPR1bits.SSPIP = 0;
     PIE1bits.SSPIE = 1;
 
-    //Globally enable interrupts
-    INTCONbits.GIE = 1;
-    //Enable prepherial interrupts
-    INTCONbits.PEIE = 1;
-
     //Enable the module
     SSPCON1bits.SSPEN = 1;
 }
@@ -79,203 +71,791 @@ void InitI2C(void) {
  * Set SSPEN in register SSPCON1
  *
  * Set up the bitmask to allow multiple addresses on the same chip in register
- * SSPMSK.
- * Ignore this for now, when we start using multiple things through the same
- * chip than we will use it. Only the upper 7 bits have any effect
+ * SSPMSK. This comes from I2C_MASK_ADDRESS. Only the upper 7 bits have any
+ * effect
  *
  * Set the address of this controller using SSPADD
- * The I2C address is 0x23. The highest 7 bits of SSPADD are the ones used.
+ * The I2C address is 0x23 unless it has been changed with I2C_ADDRESS_ADDRESS.
+ * The highest 7 bits of SSPADD are the ones used.
+ *
+ *
+ */
+
+//The address mask that is in SSPMSK, it is only written when it changes
+unsigned char I2CMaskSet = 0xFF;
+
+/*
+ * This sets the i2c address, the address mask and the general call from
+ * I2CAddress, I2CMask and I2CGeneralCall. It is called when the module is set
+ * up and after every commit, a new address is used from the next transaction.
+ */
+void ConfigureI2C(void) {
+    unsigned char enabled;
+    //Addresses reserved by the i2c spec aren't used, the address stays the
+    //same
+    if (I2CAddress < 0x08 || I2CAddress > 0x77) {
+        I2CAddress = SSPADD >> 1;
+    }
+    //This is the i2c address of the controller. It needs to be shifted to the
+    //left by one because SSPADD is an 8 bit register and the address is
+    //stored in bits<7:1>
+    SSPADD = (unsigned char)(I2CAddress << 1);
+    //Set the bitmask for the address so that the controller responds to
+    //multiple addresses. SSPMSK is at the same address as SSPADD and is used
+    //in place of it while SSPM is 1001, so the module is turned off while it
+    //is changed. A transaction that is going on is lost, but this only
+    //happens when the mask is changed.
+    if (I2CMask != I2CMaskSet) {
+        enabled = SSPCON1bits.SSPEN;
+        SSPCON1bits.SSPEN = 0;
+        SSPCON1bits.SSPM = 0b1001;
+        SSPADD = (unsigned char)(I2CMask << 1);
+        SSPCON1bits.SSPM = 0b1110;
+        SSPCON1bits.SSPEN = enabled;
+        I2CMaskSet = I2CMask;
+    }
+    //Answer the general call address (0x00)
+    SSPCON2bits.GCEN = I2CGeneralCall & 1;
+}
+
+/*
+ * Register writes aren't done in the interrupt. The interrupt puts the address
+ * and value into CommandRing and the main loop takes them out and writes the
+ * registers in ApplyI2CCommands. Only the interrupt changes CommandHead and
+ * CommandPublished and only the main loop changes CommandTail so neither side
+ * needs to turn off interrupts. If the ring is full the write is dropped and
+ * counted in CommandOverflows.
+ *
+ * The main loop only takes the writes up to CommandPublished. Without the PEC
+ * every write is published as soon as it is in the ring. With the PEC the
+ * writes of a transaction are only published at the stop condition once the
+ * PEC has been checked, a transaction with a bad PEC is taken back out of the
+ * ring so none of it is written.
+ */
+struct Command {
+    unsigned char address;
+    unsigned char value;
+};
+
+struct Command CommandRing[COMMAND_RING_SIZE];
+volatile unsigned char CommandHead = 0;
+volatile unsigned char CommandTail = 0;
+volatile unsigned char CommandPublished = 0;
+//This is set when a write didn't fit in the ring since the last stop
+//condition
+unsigned char CommandDropped = 0;
+
+//The PEC registers, see PEC_ADDRESS
+unsigned char PECEnable = 0;
+unsigned char PECReadLength = 1;
+unsigned char PECErrors = 0;
+
+/*
+ * Writes to the registers that set what the motors are doing (the speeds,
+ * directions, pauses, enables and target fractions), the pwm period and the
+ * PEC don't change the live values straight away, they go into a shadow copy.
+ * The shadow is copied to the live values all at once by CommitShadow at the
+ * end of each i2c write (the interrupt sends a write to COMMIT_ADDRESS when it
+ * sees the stop condition) or when the host writes to COMMIT_ADDRESS. That way
+ * a write that changes several motors takes effect on the same control tick.
  *
+ * The other registers are configuration that is only used at the next control
+ * tick or the next commit, so they are written straight to the live values
+ * (REG_DIRECT) and don't take up RAM for a copy. The requests (the sync, the
+ * moves, the encoders and the i2c address) still only act on the commit.
  *
+ * ShadowWritten has a bit for each byte of the shadow that has been written
+ * since the last commit, only those bytes are copied. Anything that changes
+ * the live values without going through the registers doesn't get overwritten
+ * by an old shadow value.
+ */
+struct MotorShadow {
+    unsigned char enabled;
+    unsigned char paused;
+    unsigned char targetDirection;
+    unsigned char target;
+    unsigned char targetFraction;
+};
+
+struct Shadow {
+    struct MotorShadow motors[4];
+    unsigned char PWMEnable;
+    unsigned char PWMPause;
+    struct PWMConfig PWMConfig;
+    unsigned char PECEnable;
+    unsigned char PECReadLength;
+};
+
+struct Shadow Shadow;
+unsigned char ShadowWritten[(sizeof(struct Shadow) + 7) / 8];
+
+/*
+ * This gives the position of a shadow value in ShadowWritten.
+ */
+unsigned char ShadowOffset(const unsigned char *value) {
+    return (unsigned char)(value - (const unsigned char *)&Shadow);
+}
+
+/*
+ * The read only blocks (the status, the encoder positions, the step counts and
+ * the performance counters) are copied into ReadLatch when a read gets to
+ * them and the host reads the copy, so all of the values in one read go
+ * together. The blocks share the latch because a read can only be in one of
+ * them at a time.
  */
+unsigned char ReadLatch[PERF_LENGTH];
+
+/*
+ * The status block is built by UpdateStatus at the end of every control tick.
+ * The i2c interrupt is held off while it is written so a read never gets half
+ * of one control tick and half of the next.
+ */
+unsigned char StatusBlock[STATUS_LENGTH];
+
+/*
+ * This is called from the main loop at the end of each control tick.
+ */
+void UpdateStatus(void) {
+    unsigned char n, flags, paused;
+    flags = 0;
+    paused = 0;
+    for (n = 0; n < 4; n++) {
+        flags |= (unsigned char)((Motors[n].direction & 1) << n);
+        flags |= (unsigned char)((Motors[n].enabled & 1) << (n + 4));
+        paused |= (unsigned char)((Motors[n].paused & 1) << n);
+    }
+    if (PWMEnable) {
+        paused |= 0b00010000;
+    }
+    if (PWMPause) {
+        paused |= 0b00100000;
+    }
+    //Only the low priority interrupt reads it, the pwm edges carry on
+    INTCONbits.GIEL = 0;
+    StatusBlock[0] = (unsigned char)ControlTickCount;
+    StatusBlock[1] = (unsigned char)(ControlTickCount >> 8);
+    for (n = 0; n < 4; n++) {
+        StatusBlock[2 + n] = Motors[n].duty;
+        StatusBlock[6 + n] = Motors[n].target;
+    }
+    StatusBlock[10] = flags;
+    StatusBlock[11] = paused;
+    INTCONbits.GIEL = 1;
+}
+
+/*
+ * This is called from the interrupt when a read gets to the status block.
+ */
+void LatchStatus(void) {
+    unsigned char n;
+    for (n = 0; n < STATUS_LENGTH; n++) {
+        ReadLatch[n] = StatusBlock[n];
+    }
+}
+
+/*
+ * This is called from the interrupt when a read gets to the encoder or the
+ * step block. The positions are changed by the high priority interrupt so it
+ * is held off while each one is copied.
+ */
+void LatchPositions(void) {
+    unsigned char n;
+    long position;
+    for (n = 0; n < 4; n++) {
+        di();
+        position = MotorPositions[n];
+        ei();
+        ReadLatch[4 * n] = (unsigned char)position;
+        ReadLatch[4 * n + 1] = (unsigned char)(position >> 8);
+        ReadLatch[4 * n + 2] = (unsigned char)(position >> 16);
+        ReadLatch[4 * n + 3] = (unsigned char)(position >> 24);
+    }
+}
+
+/*
+ * This gives 1 if a read at address gets a new copy of the block that starts
+ * at start. A read that starts anywhere in the block gets one, a read that
+ * carries on into it only gets one at its first byte.
+ */
+unsigned char LatchDue(unsigned char address, unsigned char starting, unsigned char start, unsigned char length) {
+    if (starting) {
+        return address >= start && address < start + length;
+    }
+    return address == start;
+}
+
+/*
+ * This copies the block that a read has got to into ReadLatch, starting is 1
+ * for the first byte of a read.
+ */
+void LatchRead(unsigned char address, unsigned char starting) {
+    if (LatchDue(address, starting, STATUS_ADDRESS, STATUS_LENGTH)) {
+        LatchStatus();
+    } else if (LatchDue(address, starting, ENCODER_ADDRESS, ENCODER_LENGTH) ||
+            LatchDue(address, starting, STEP_ADDRESS, STEP_LENGTH)) {
+        LatchPositions();
+    } else if (LatchDue(address, starting, PERF_ADDRESS, PERF_LENGTH)) {
+        LatchPerformance();
+    }
+}
+
+/*
+ * The registers are described by a table indexed by the register address, so
+ * reading or writing any register takes the same short lookup instead of
+ * going through a switch with a case for every address. Counting the
+ * instructions by hand, ReadRegister is about 80 instruction cycles for any
+ * address that isn't packed, most of it reading the entry from the program
+ * memory. A switch made into a chain of compares takes about 4 cycles for
+ * each case before the one that matches.
+ *
+ * read is the live value that the host reads, write is the shadow value that
+ * the host writes and commit is the live value that the shadow value is copied
+ * to. REG_DIRECT registers don't have a shadow, write is the live value and
+ * commit is 0. They point at the value for motor 0 (or at the global value),
+ * the value for motor n is n structs after it.
+ */
+
+//The register can be read
+#define REG_READ 0x01
+//The register can be written
+#define REG_WRITE 0x02
+//A write goes to all four motors, a read gives the value for motor 0
+#define REG_ALL 0x04
+//The register holds two bits for each of the four motors, motor 0 is in the
+//lowest two bits
+#define REG_PACKED 0x08
+//The value is a single bit flag
+#define REG_BIT 0x10
+//The value is a speed, speeds below the motor's minimum duty are set to 0
+#define REG_SPEED 0x20
+//The value is written straight to the live value in write, there is no shadow
+#define REG_DIRECT 0x40
+//Writing any value commits the shadow values
+#define REG_COMMIT 0x80
+//The bytes written go into the motor's setpoint queue or the bytes read come
+//from the trace, the address doesn't go up after each byte
+#define REG_FIFO 0x100
+//The register can be written with the general call address
+#define REG_GENERAL 0x200
+
+struct Register {
+    unsigned char *read;
+    unsigned char *write;
+    unsigned char *commit;
+    unsigned char motor;
+    unsigned int flags;
+};
+
+#define REGISTER_COUNT (TRACE_DIVISOR_ADDRESS + 1)
+
+const struct Register Registers[REGISTER_COUNT] = {
+    {0, 0, 0, 0, 0}, //0 is not a register
+    {&Motors[0].duty, &Shadow.motors[0].target, &Motors[0].target, 0, REG_READ | REG_WRITE | REG_ALL | REG_SPEED | REG_GENERAL}, //SPEED_ADDRESS
+    {&Motors[0].duty, &Shadow.motors[0].target, &Motors[0].target, 0, REG_READ | REG_WRITE | REG_SPEED | REG_GENERAL}, //MOTOR_0_SPEED_ADDRESS
+    {&Motors[0].duty, &Shadow.motors[0].target, &Motors[0].target, 1, REG_READ | REG_WRITE | REG_SPEED | REG_GENERAL}, //MOTOR_1_SPEED_ADDRESS
+    {&Motors[0].duty, &Shadow.motors[0].target, &Motors[0].target, 2, REG_READ | REG_WRITE | REG_SPEED | REG_GENERAL}, //MOTOR_2_SPEED_ADDRESS
+    {&Motors[0].duty, &Shadow.motors[0].target, &Motors[0].target, 3, REG_READ | REG_WRITE | REG_SPEED | REG_GENERAL}, //MOTOR_3_SPEED_ADDRESS
+    {&Motors[0].motorType, &Motors[0].motorType, 0, 0, REG_READ | REG_WRITE | REG_PACKED | REG_DIRECT}, //MOTOR_TYPE_ADDRESS
+    {&Motors[0].motorType, &Motors[0].motorType, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_TYPE_ADDRESS
+    {&Motors[0].motorType, &Motors[0].motorType, 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_TYPE_ADDRESS
+    {&Motors[0].motorType, &Motors[0].motorType, 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_TYPE_ADDRESS
+    {&Motors[0].motorType, &Motors[0].motorType, 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_TYPE_ADDRESS
+    {&Motors[0].direction, &Shadow.motors[0].targetDirection, &Motors[0].targetDirection, 0, REG_READ | REG_WRITE | REG_PACKED | REG_BIT | REG_GENERAL}, //DIRECTION_ADDRESS
+    {&Motors[0].direction, &Shadow.motors[0].targetDirection, &Motors[0].targetDirection, 0, REG_READ | REG_WRITE | REG_BIT | REG_GENERAL}, //MOTOR0_DIRECTION_ADDRESS
+    {&Motors[0].direction, &Shadow.motors[0].targetDirection, &Motors[0].targetDirection, 1, REG_READ | REG_WRITE | REG_BIT | REG_GENERAL}, //MOTOR1_DIRECTION_ADDRESS
+    {&Motors[0].direction, &Shadow.motors[0].targetDirection, &Motors[0].targetDirection, 2, REG_READ | REG_WRITE | REG_BIT | REG_GENERAL}, //MOTOR2_DIRECTION_ADDRESS
+    {&Motors[0].direction, &Shadow.motors[0].targetDirection, &Motors[0].targetDirection, 3, REG_READ | REG_WRITE | REG_BIT | REG_GENERAL}, //MOTOR3_DIRECTION_ADDRESS
+    {&PWMPause, &Shadow.PWMPause, &PWMPause, 0, REG_READ | REG_WRITE | REG_GENERAL}, //PAUSE_ADDRESS
+    {&Motors[0].paused, &Shadow.motors[0].paused, &Motors[0].paused, 0, REG_READ | REG_WRITE | REG_BIT | REG_GENERAL}, //MOTOR0_PAUSE_ADDRESS
+    {&Motors[0].paused, &Shadow.motors[0].paused, &Motors[0].paused, 1, REG_READ | REG_WRITE | REG_BIT | REG_GENERAL}, //MOTOR1_PAUSE_ADDRESS
+    {&Motors[0].paused, &Shadow.motors[0].paused, &Motors[0].paused, 2, REG_READ | REG_WRITE | REG_BIT | REG_GENERAL}, //MOTOR2_PAUSE_ADDRESS
+    {&Motors[0].paused, &Shadow.motors[0].paused, &Motors[0].paused, 3, REG_READ | REG_WRITE | REG_BIT | REG_GENERAL}, //MOTOR3_PAUSE_ADDRESS
+    {&PWMEnable, &Shadow.PWMEnable, &PWMEnable, 0, REG_READ | REG_WRITE | REG_GENERAL}, //ENABLE_ADDRESS
+    {&Motors[0].enabled, &Shadow.motors[0].enabled, &Motors[0].enabled, 0, REG_READ | REG_WRITE | REG_BIT | REG_GENERAL}, //MOTOR0_ENABLE_ADDRESS
+    {&Motors[0].enabled, &Shadow.motors[0].enabled, &Motors[0].enabled, 1, REG_READ | REG_WRITE | REG_BIT | REG_GENERAL}, //MOTOR1_ENABLE_ADDRESS
+    {&Motors[0].enabled, &Shadow.motors[0].enabled, &Motors[0].enabled, 2, REG_READ | REG_WRITE | REG_BIT | REG_GENERAL}, //MOTOR2_ENABLE_ADDRESS
+    {&Motors[0].enabled, &Shadow.motors[0].enabled, &Motors[0].enabled, 3, REG_READ | REG_WRITE | REG_BIT | REG_GENERAL}, //MOTOR3_ENABLE_ADDRESS
+    {&Motors[0].accelType, &Motors[0].accelType, 0, 0, REG_READ | REG_WRITE | REG_ALL | REG_DIRECT}, //ACCEL_ADDRESS
+    {&Motors[0].accelType, &Motors[0].accelType, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_ACCEL_TYPE_ADDRESS
+    {&Motors[0].accelType, &Motors[0].accelType, 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_ACCEL_TYPE_ADDRESS
+    {&Motors[0].accelType, &Motors[0].accelType, 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_ACCEL_TYPE_ADDRESS
+    {&Motors[0].accelType, &Motors[0].accelType, 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_ACCEL_TYPE_ADDRESS
+    {&Motors[0].accelRate, &Motors[0].accelRate, 0, 0, REG_READ | REG_WRITE | REG_ALL | REG_DIRECT}, //ACCEL_RATE_ADDRESS
+    {&Motors[0].accelRate, &Motors[0].accelRate, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_ACCEL_RATE_ADDRESS
+    {&Motors[0].accelRate, &Motors[0].accelRate, 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_ACCEL_RATE_ADDRESS
+    {&Motors[0].accelRate, &Motors[0].accelRate, 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_ACCEL_RATE_ADDRESS
+    {&Motors[0].accelRate, &Motors[0].accelRate, 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_ACCEL_RATE_ADDRESS
+    {&Motors[0].minimumDuty, &Motors[0].minimumDuty, 0, 0, REG_READ | REG_WRITE | REG_ALL | REG_DIRECT}, //MINIMUM_DUTY_ADDRESS
+    {&Motors[0].minimumDuty, &Motors[0].minimumDuty, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_MINIMUM_DUTY_ADDRESS
+    {&Motors[0].minimumDuty, &Motors[0].minimumDuty, 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_MINIMUM_DUTY_ADDRESS
+    {&Motors[0].minimumDuty, &Motors[0].minimumDuty, 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_MINIMUM_DUTY_ADDRESS
+    {&Motors[0].minimumDuty, &Motors[0].minimumDuty, 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_MINIMUM_DUTY_ADDRESS
+    {&Motors[0].target, 0, 0, 0, REG_READ}, //MOTOR0_TARGET_ADDRESS
+    {&Motors[0].target, 0, 0, 1, REG_READ}, //MOTOR1_TARGET_ADDRESS
+    {&Motors[0].target, 0, 0, 2, REG_READ}, //MOTOR2_TARGET_ADDRESS
+    {&Motors[0].target, 0, 0, 3, REG_READ}, //MOTOR3_TARGET_ADDRESS
+    {&Motors[0].targetDirection, &Shadow.motors[0].targetDirection, &Motors[0].targetDirection, 0, REG_READ | REG_WRITE | REG_BIT}, //MOTOR0_TARGET_DIRECTION_ADDRESS
+    {&Motors[0].targetDirection, &Shadow.motors[0].targetDirection, &Motors[0].targetDirection, 1, REG_READ | REG_WRITE | REG_BIT}, //MOTOR1_TARGET_DIRECTION_ADDRESS
+    {&Motors[0].targetDirection, &Shadow.motors[0].targetDirection, &Motors[0].targetDirection, 2, REG_READ | REG_WRITE | REG_BIT}, //MOTOR2_TARGET_DIRECTION_ADDRESS
+    {&Motors[0].targetDirection, &Shadow.motors[0].targetDirection, &Motors[0].targetDirection, 3, REG_READ | REG_WRITE | REG_BIT}, //MOTOR3_TARGET_DIRECTION_ADDRESS
+    {&CommandOverflows, &CommandOverflows, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //COMMAND_OVERFLOW_ADDRESS
+    {0, 0, 0, 0, REG_WRITE | REG_COMMIT | REG_GENERAL}, //COMMIT_ADDRESS
+    {&ReadLatch[0], 0, 0, 0, REG_READ}, //STATUS_ADDRESS + 0
+    {&ReadLatch[1], 0, 0, 0, REG_READ}, //STATUS_ADDRESS + 1
+    {&ReadLatch[2], 0, 0, 0, REG_READ}, //STATUS_ADDRESS + 2
+    {&ReadLatch[3], 0, 0, 0, REG_READ}, //STATUS_ADDRESS + 3
+    {&ReadLatch[4], 0, 0, 0, REG_READ}, //STATUS_ADDRESS + 4
+    {&ReadLatch[5], 0, 0, 0, REG_READ}, //STATUS_ADDRESS + 5
+    {&ReadLatch[6], 0, 0, 0, REG_READ}, //STATUS_ADDRESS + 6
+    {&ReadLatch[7], 0, 0, 0, REG_READ}, //STATUS_ADDRESS + 7
+    {&ReadLatch[8], 0, 0, 0, REG_READ}, //STATUS_ADDRESS + 8
+    {&ReadLatch[9], 0, 0, 0, REG_READ}, //STATUS_ADDRESS + 9
+    {&ReadLatch[10], 0, 0, 0, REG_READ}, //STATUS_ADDRESS + 10
+    {&ReadLatch[11], 0, 0, 0, REG_READ}, //STATUS_ADDRESS + 11
+    {&Motors[0].accelCurve, &Motors[0].accelCurve, 0, 0, REG_READ | REG_WRITE | REG_ALL | REG_DIRECT}, //ACCEL_CURVE_ADDRESS
+    {&Motors[0].accelCurve, &Motors[0].accelCurve, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_ACCEL_CURVE_ADDRESS
+    {&Motors[0].accelCurve, &Motors[0].accelCurve, 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_ACCEL_CURVE_ADDRESS
+    {&Motors[0].accelCurve, &Motors[0].accelCurve, 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_ACCEL_CURVE_ADDRESS
+    {&Motors[0].accelCurve, &Motors[0].accelCurve, 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_ACCEL_CURVE_ADDRESS
+    {&Motors[0].maxAccel, &Motors[0].maxAccel, 0, 0, REG_READ | REG_WRITE | REG_ALL | REG_DIRECT}, //SCURVE_ACCEL_ADDRESS
+    {&Motors[0].maxAccel, &Motors[0].maxAccel, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_SCURVE_ACCEL_ADDRESS
+    {&Motors[0].maxAccel, &Motors[0].maxAccel, 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_SCURVE_ACCEL_ADDRESS
+    {&Motors[0].maxAccel, &Motors[0].maxAccel, 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_SCURVE_ACCEL_ADDRESS
+    {&Motors[0].maxAccel, &Motors[0].maxAccel, 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_SCURVE_ACCEL_ADDRESS
+    {&Motors[0].jerk, &Motors[0].jerk, 0, 0, REG_READ | REG_WRITE | REG_ALL | REG_DIRECT}, //SCURVE_JERK_ADDRESS
+    {&Motors[0].jerk, &Motors[0].jerk, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_SCURVE_JERK_ADDRESS
+    {&Motors[0].jerk, &Motors[0].jerk, 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_SCURVE_JERK_ADDRESS
+    {&Motors[0].jerk, &Motors[0].jerk, 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_SCURVE_JERK_ADDRESS
+    {&Motors[0].jerk, &Motors[0].jerk, 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_SCURVE_JERK_ADDRESS
+    {&Motors[0].accelStep, &Motors[0].accelStep, 0, 0, REG_READ | REG_WRITE | REG_ALL | REG_DIRECT}, //ACCEL_STEP_ADDRESS
+    {&Motors[0].accelStep, &Motors[0].accelStep, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_ACCEL_STEP_ADDRESS
+    {&Motors[0].accelStep, &Motors[0].accelStep, 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_ACCEL_STEP_ADDRESS
+    {&Motors[0].accelStep, &Motors[0].accelStep, 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_ACCEL_STEP_ADDRESS
+    {&Motors[0].accelStep, &Motors[0].accelStep, 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_ACCEL_STEP_ADDRESS
+    {&Motors[0].accelStepFraction, &Motors[0].accelStepFraction, 0, 0, REG_READ | REG_WRITE | REG_ALL | REG_DIRECT}, //ACCEL_STEP_FRACTION_ADDRESS
+    {&Motors[0].accelStepFraction, &Motors[0].accelStepFraction, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_ACCEL_STEP_FRACTION_ADDRESS
+    {&Motors[0].accelStepFraction, &Motors[0].accelStepFraction, 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_ACCEL_STEP_FRACTION_ADDRESS
+    {&Motors[0].accelStepFraction, &Motors[0].accelStepFraction, 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_ACCEL_STEP_FRACTION_ADDRESS
+    {&Motors[0].accelStepFraction, &Motors[0].accelStepFraction, 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_ACCEL_STEP_FRACTION_ADDRESS
+    {&PWMConfig.periodLow, &Shadow.PWMConfig.periodLow, &PWMConfig.periodLow, 0, REG_READ | REG_WRITE}, //PWM_PERIOD_ADDRESS
+    {&PWMConfig.periodHigh, &Shadow.PWMConfig.periodHigh, &PWMConfig.periodHigh, 0, REG_READ | REG_WRITE}, //PWM_PERIOD_HIGH_ADDRESS
+    {&PWMConfig.prescale, &Shadow.PWMConfig.prescale, &PWMConfig.prescale, 0, REG_READ | REG_WRITE}, //PWM_PRESCALE_ADDRESS
+    {&Motors[0].targetFraction, &Shadow.motors[0].targetFraction, &Motors[0].targetFraction, 0, REG_READ | REG_WRITE | REG_ALL}, //TARGET_FRACTION_ADDRESS
+    {&Motors[0].targetFraction, &Shadow.motors[0].targetFraction, &Motors[0].targetFraction, 0, REG_READ | REG_WRITE}, //MOTOR0_TARGET_FRACTION_ADDRESS
+    {&Motors[0].targetFraction, &Shadow.motors[0].targetFraction, &Motors[0].targetFraction, 1, REG_READ | REG_WRITE}, //MOTOR1_TARGET_FRACTION_ADDRESS
+    {&Motors[0].targetFraction, &Shadow.motors[0].targetFraction, &Motors[0].targetFraction, 2, REG_READ | REG_WRITE}, //MOTOR2_TARGET_FRACTION_ADDRESS
+    {&Motors[0].targetFraction, &Shadow.motors[0].targetFraction, &Motors[0].targetFraction, 3, REG_READ | REG_WRITE}, //MOTOR3_TARGET_FRACTION_ADDRESS
+    {&SyncMask, &SyncRequest, 0, 0, REG_READ | REG_WRITE | REG_GENERAL | REG_DIRECT}, //SYNC_ADDRESS
+    {&SyncTicksLow, &SyncTicksLow, 0, 0, REG_READ | REG_WRITE | REG_GENERAL | REG_DIRECT}, //SYNC_TICKS_ADDRESS
+    {&SyncTicksHigh, &SyncTicksHigh, 0, 0, REG_READ | REG_WRITE | REG_GENERAL | REG_DIRECT}, //SYNC_TICKS_HIGH_ADDRESS
+    {0, 0, 0, 0, REG_WRITE | REG_FIFO}, //MOTOR0_QUEUE_ADDRESS
+    {0, 0, 0, 1, REG_WRITE | REG_FIFO}, //MOTOR1_QUEUE_ADDRESS
+    {0, 0, 0, 2, REG_WRITE | REG_FIFO}, //MOTOR2_QUEUE_ADDRESS
+    {0, 0, 0, 3, REG_WRITE | REG_FIFO}, //MOTOR3_QUEUE_ADDRESS
+    {&Motors[0].queueDepth, 0, 0, 0, REG_READ}, //MOTOR0_QUEUE_DEPTH_ADDRESS
+    {&Motors[0].queueDepth, 0, 0, 1, REG_READ}, //MOTOR1_QUEUE_DEPTH_ADDRESS
+    {&Motors[0].queueDepth, 0, 0, 2, REG_READ}, //MOTOR2_QUEUE_DEPTH_ADDRESS
+    {&Motors[0].queueDepth, 0, 0, 3, REG_READ}, //MOTOR3_QUEUE_DEPTH_ADDRESS
+    {&Motors[0].queueUnderruns, &Motors[0].queueUnderruns, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_QUEUE_UNDERRUN_ADDRESS
+    {&Motors[0].queueUnderruns, &Motors[0].queueUnderruns, 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_QUEUE_UNDERRUN_ADDRESS
+    {&Motors[0].queueUnderruns, &Motors[0].queueUnderruns, 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_QUEUE_UNDERRUN_ADDRESS
+    {&Motors[0].queueUnderruns, &Motors[0].queueUnderruns, 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_QUEUE_UNDERRUN_ADDRESS
+    {&EncoderEnable, &EncoderEnable, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //ENCODER_ENABLE_ADDRESS
+    {&ReadLatch[0], 0, 0, 0, REG_READ}, //ENCODER_ADDRESS + 0
+    {&ReadLatch[1], 0, 0, 0, REG_READ}, //ENCODER_ADDRESS + 1
+    {&ReadLatch[2], 0, 0, 0, REG_READ}, //ENCODER_ADDRESS + 2
+    {&ReadLatch[3], 0, 0, 0, REG_READ}, //ENCODER_ADDRESS + 3
+    {&ReadLatch[4], 0, 0, 0, REG_READ}, //ENCODER_ADDRESS + 4
+    {&ReadLatch[5], 0, 0, 0, REG_READ}, //ENCODER_ADDRESS + 5
+    {&ReadLatch[6], 0, 0, 0, REG_READ}, //ENCODER_ADDRESS + 6
+    {&ReadLatch[7], 0, 0, 0, REG_READ}, //ENCODER_ADDRESS + 7
+    {&ReadLatch[8], 0, 0, 0, REG_READ}, //ENCODER_ADDRESS + 8
+    {&ReadLatch[9], 0, 0, 0, REG_READ}, //ENCODER_ADDRESS + 9
+    {&ReadLatch[10], 0, 0, 0, REG_READ}, //ENCODER_ADDRESS + 10
+    {&ReadLatch[11], 0, 0, 0, REG_READ}, //ENCODER_ADDRESS + 11
+    {&ReadLatch[12], 0, 0, 0, REG_READ}, //ENCODER_ADDRESS + 12
+    {&ReadLatch[13], 0, 0, 0, REG_READ}, //ENCODER_ADDRESS + 13
+    {&ReadLatch[14], 0, 0, 0, REG_READ}, //ENCODER_ADDRESS + 14
+    {&ReadLatch[15], 0, 0, 0, REG_READ}, //ENCODER_ADDRESS + 15
+    {&Motors[0].pidKp, &Motors[0].pidKp, 0, 0, REG_READ | REG_WRITE | REG_ALL | REG_DIRECT}, //PID_KP_ADDRESS
+    {&Motors[0].pidKp, &Motors[0].pidKp, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_PID_KP_ADDRESS
+    {&Motors[0].pidKp, &Motors[0].pidKp, 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_PID_KP_ADDRESS
+    {&Motors[0].pidKp, &Motors[0].pidKp, 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_PID_KP_ADDRESS
+    {&Motors[0].pidKp, &Motors[0].pidKp, 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_PID_KP_ADDRESS
+    {&Motors[0].pidKi, &Motors[0].pidKi, 0, 0, REG_READ | REG_WRITE | REG_ALL | REG_DIRECT}, //PID_KI_ADDRESS
+    {&Motors[0].pidKi, &Motors[0].pidKi, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_PID_KI_ADDRESS
+    {&Motors[0].pidKi, &Motors[0].pidKi, 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_PID_KI_ADDRESS
+    {&Motors[0].pidKi, &Motors[0].pidKi, 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_PID_KI_ADDRESS
+    {&Motors[0].pidKi, &Motors[0].pidKi, 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_PID_KI_ADDRESS
+    {&Motors[0].pidKd, &Motors[0].pidKd, 0, 0, REG_READ | REG_WRITE | REG_ALL | REG_DIRECT}, //PID_KD_ADDRESS
+    {&Motors[0].pidKd, &Motors[0].pidKd, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_PID_KD_ADDRESS
+    {&Motors[0].pidKd, &Motors[0].pidKd, 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_PID_KD_ADDRESS
+    {&Motors[0].pidKd, &Motors[0].pidKd, 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_PID_KD_ADDRESS
+    {&Motors[0].pidKd, &Motors[0].pidKd, 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_PID_KD_ADDRESS
+    {&MoveMask, &MoveRequest, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOVE_ADDRESS
+    {&Motors[0].moveDistance[0], &Motors[0].moveDistance[0], 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_MOVE_ADDRESS + 0
+    {&Motors[0].moveDistance[1], &Motors[0].moveDistance[1], 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_MOVE_ADDRESS + 1
+    {&Motors[0].moveDistance[2], &Motors[0].moveDistance[2], 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_MOVE_ADDRESS + 2
+    {&Motors[0].moveDistance[3], &Motors[0].moveDistance[3], 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_MOVE_ADDRESS + 3
+    {&Motors[0].moveDistance[0], &Motors[0].moveDistance[0], 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_MOVE_ADDRESS + 0
+    {&Motors[0].moveDistance[1], &Motors[0].moveDistance[1], 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_MOVE_ADDRESS + 1
+    {&Motors[0].moveDistance[2], &Motors[0].moveDistance[2], 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_MOVE_ADDRESS + 2
+    {&Motors[0].moveDistance[3], &Motors[0].moveDistance[3], 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_MOVE_ADDRESS + 3
+    {&Motors[0].moveDistance[0], &Motors[0].moveDistance[0], 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_MOVE_ADDRESS + 0
+    {&Motors[0].moveDistance[1], &Motors[0].moveDistance[1], 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_MOVE_ADDRESS + 1
+    {&Motors[0].moveDistance[2], &Motors[0].moveDistance[2], 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_MOVE_ADDRESS + 2
+    {&Motors[0].moveDistance[3], &Motors[0].moveDistance[3], 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_MOVE_ADDRESS + 3
+    {&Motors[0].moveDistance[0], &Motors[0].moveDistance[0], 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_MOVE_ADDRESS + 0
+    {&Motors[0].moveDistance[1], &Motors[0].moveDistance[1], 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_MOVE_ADDRESS + 1
+    {&Motors[0].moveDistance[2], &Motors[0].moveDistance[2], 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_MOVE_ADDRESS + 2
+    {&Motors[0].moveDistance[3], &Motors[0].moveDistance[3], 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_MOVE_ADDRESS + 3
+    {&Motors[0].brakeMode, &Motors[0].brakeMode, 0, 0, REG_READ | REG_WRITE | REG_ALL | REG_DIRECT}, //BRAKE_MODE_ADDRESS
+    {&Motors[0].brakeMode, &Motors[0].brakeMode, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_BRAKE_MODE_ADDRESS
+    {&Motors[0].brakeMode, &Motors[0].brakeMode, 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_BRAKE_MODE_ADDRESS
+    {&Motors[0].brakeMode, &Motors[0].brakeMode, 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_BRAKE_MODE_ADDRESS
+    {&Motors[0].brakeMode, &Motors[0].brakeMode, 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_BRAKE_MODE_ADDRESS
+    {&Motors[0].brakeTime, &Motors[0].brakeTime, 0, 0, REG_READ | REG_WRITE | REG_ALL | REG_DIRECT}, //BRAKE_TIME_ADDRESS
+    {&Motors[0].brakeTime, &Motors[0].brakeTime, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_BRAKE_TIME_ADDRESS
+    {&Motors[0].brakeTime, &Motors[0].brakeTime, 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_BRAKE_TIME_ADDRESS
+    {&Motors[0].brakeTime, &Motors[0].brakeTime, 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_BRAKE_TIME_ADDRESS
+    {&Motors[0].brakeTime, &Motors[0].brakeTime, 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_BRAKE_TIME_ADDRESS
+    {&Motors[0].deadTime, &Motors[0].deadTime, 0, 0, REG_READ | REG_WRITE | REG_ALL | REG_DIRECT}, //DEAD_TIME_ADDRESS
+    {&Motors[0].deadTime, &Motors[0].deadTime, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR0_DEAD_TIME_ADDRESS
+    {&Motors[0].deadTime, &Motors[0].deadTime, 0, 1, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR1_DEAD_TIME_ADDRESS
+    {&Motors[0].deadTime, &Motors[0].deadTime, 0, 2, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR2_DEAD_TIME_ADDRESS
+    {&Motors[0].deadTime, &Motors[0].deadTime, 0, 3, REG_READ | REG_WRITE | REG_DIRECT}, //MOTOR3_DEAD_TIME_ADDRESS
+    {&ReadLatch[0], 0, 0, 0, REG_READ}, //STEP_ADDRESS + 0
+    {&ReadLatch[1], 0, 0, 0, REG_READ}, //STEP_ADDRESS + 1
+    {&ReadLatch[2], 0, 0, 0, REG_READ}, //STEP_ADDRESS + 2
+    {&ReadLatch[3], 0, 0, 0, REG_READ}, //STEP_ADDRESS + 3
+    {&ReadLatch[4], 0, 0, 0, REG_READ}, //STEP_ADDRESS + 4
+    {&ReadLatch[5], 0, 0, 0, REG_READ}, //STEP_ADDRESS + 5
+    {&ReadLatch[6], 0, 0, 0, REG_READ}, //STEP_ADDRESS + 6
+    {&ReadLatch[7], 0, 0, 0, REG_READ}, //STEP_ADDRESS + 7
+    {&ReadLatch[8], 0, 0, 0, REG_READ}, //STEP_ADDRESS + 8
+    {&ReadLatch[9], 0, 0, 0, REG_READ}, //STEP_ADDRESS + 9
+    {&ReadLatch[10], 0, 0, 0, REG_READ}, //STEP_ADDRESS + 10
+    {&ReadLatch[11], 0, 0, 0, REG_READ}, //STEP_ADDRESS + 11
+    {&ReadLatch[12], 0, 0, 0, REG_READ}, //STEP_ADDRESS + 12
+    {&ReadLatch[13], 0, 0, 0, REG_READ}, //STEP_ADDRESS + 13
+    {&ReadLatch[14], 0, 0, 0, REG_READ}, //STEP_ADDRESS + 14
+    {&ReadLatch[15], 0, 0, 0, REG_READ}, //STEP_ADDRESS + 15
+    {&ReadLatch[0], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 0
+    {&ReadLatch[1], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 1
+    {&ReadLatch[2], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 2
+    {&ReadLatch[3], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 3
+    {&ReadLatch[4], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 4
+    {&ReadLatch[5], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 5
+    {&ReadLatch[6], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 6
+    {&ReadLatch[7], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 7
+    {&ReadLatch[8], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 8
+    {&ReadLatch[9], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 9
+    {&ReadLatch[10], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 10
+    {&ReadLatch[11], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 11
+    {&ReadLatch[12], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 12
+    {&ReadLatch[13], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 13
+    {&ReadLatch[14], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 14
+    {&ReadLatch[15], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 15
+    {&ReadLatch[16], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 16
+    {&ReadLatch[17], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 17
+    {&ReadLatch[18], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 18
+    {&ReadLatch[19], 0, 0, 0, REG_READ}, //PERF_ADDRESS + 19
+    {&TraceState, &TraceCommand, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //TRACE_ADDRESS
+    {&TraceMotors, &TraceMotors, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //TRACE_MOTORS_ADDRESS
+    {&TraceCount, 0, 0, 0, REG_READ}, //TRACE_COUNT_ADDRESS
+    {0, 0, 0, 0, REG_READ | REG_FIFO}, //TRACE_DATA_ADDRESS
+    {&ProfileStatus, &ProfileCommand, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //PROFILE_ADDRESS
+    {&ProfileSlot, &ProfileSlot, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //PROFILE_SLOT_ADDRESS
+    {&I2CAddress, &I2CAddress, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //I2C_ADDRESS_ADDRESS
+    {&I2CMask, &I2CMask, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //I2C_MASK_ADDRESS
+    {&I2CGeneralCall, &I2CGeneralCall, 0, 0, REG_READ | REG_WRITE | REG_BIT | REG_DIRECT}, //I2C_GENERAL_CALL_ADDRESS
+    {&PECEnable, &Shadow.PECEnable, &PECEnable, 0, REG_READ | REG_WRITE | REG_BIT}, //PEC_ADDRESS
+    {&PECReadLength, &Shadow.PECReadLength, &PECReadLength, 0, REG_READ | REG_WRITE}, //PEC_READ_LENGTH_ADDRESS
+    {&PECErrors, &PECErrors, 0, 0, REG_READ | REG_WRITE | REG_DIRECT}, //PEC_ERRORS_ADDRESS
+    {&TraceDivisor, &TraceDivisor, 0, 0, REG_READ | REG_WRITE | REG_DIRECT} //TRACE_DIVISOR_ADDRESS
+};
+
+/*
+ * This gives the first and last motor that a register covers.
+ */
+void RegisterMotors(const struct Register *reg, unsigned char *first, unsigned char *last) {
+    if (reg->flags & (REG_ALL | REG_PACKED)) {
+        *first = 0;
+        *last = 3;
+    } else {
+        *first = reg->motor;
+        *last = reg->motor;
+    }
+}
+
+/*
+ * This copies the shadow values that have been written since the last commit
+ * to the live values.
+ */
+void CommitShadow(void) {
+    const struct Register *reg;
+    unsigned char address, n, first, last, offset;
+    for (address = 0; address < REGISTER_COUNT; address++) {
+        reg = &Registers[address];
+        if (reg->commit) {
+            RegisterMotors(reg, &first, &last);
+            for (n = first; n <= last; n++) {
+                offset = ShadowOffset(&reg->write[n * sizeof(struct MotorShadow)]);
+                if (ShadowWritten[offset >> 3] & (1 << (offset & 7))) {
+                    reg->commit[n * sizeof(struct Motor)] = reg->write[n * sizeof(struct MotorShadow)];
+                }
+            }
+        }
+    }
+    for (n = 0; n < sizeof(ShadowWritten); n++) {
+        ShadowWritten[n] = 0;
+    }
+    //The period may have been changed to something that can't be used
+    CheckPWMConfig();
+    //Start a synchronised move to the targets that were just committed
+    if (SyncRequest) {
+        StartSync();
+    }
+    CommitQueues();
+    ConfigureEncoders();
+    //Start moves with the distances and speeds that were just committed
+    if (MoveRequest) {
+        StartMoves();
+    }
+    ConfigureI2C();
+}
+
+/*
+ * This sets the shadow values to the live values, it is used at start up.
+ */
+void LoadShadow(void) {
+    const struct Register *reg;
+    unsigned char address, n, first, last;
+    for (address = 0; address < REGISTER_COUNT; address++) {
+        reg = &Registers[address];
+        if (reg->commit) {
+            RegisterMotors(reg, &first, &last);
+            for (n = first; n <= last; n++) {
+                reg->write[n * sizeof(struct MotorShadow)] = reg->commit[n * sizeof(struct Motor)];
+            }
+        }
+    }
+    for (n = 0; n < sizeof(ShadowWritten); n++) {
+        ShadowWritten[n] = 0;
+    }
+}
+
+/*
+ * This gives the value of a register, 0xFF is returned for addresses that
+ * can't be read.
+ */
+unsigned char ReadRegister(unsigned char address) {
+    const struct Register *reg;
+    unsigned char value, n;
+    if (address >= REGISTER_COUNT) {
+        return 0xFF;
+    }
+    reg = &Registers[address];
+    if (!(reg->flags & REG_READ)) {
+        return 0xFF;
+    }
+    if (reg->flags & REG_FIFO) {
+        return ReadTrace();
+    }
+    if (reg->flags & REG_PACKED) {
+        value = 0;
+        for (n = 0; n < 4; n++) {
+            value |= (unsigned char)((reg->read[n * sizeof(struct Motor)] & 0b00000011) << (2 * n));
+        }
+        return value;
+    }
+    return reg->read[reg->motor * sizeof(struct Motor)];
+}
+
+/*
+ * This writes value to the shadow of a register, or to the live value if it
+ * doesn't have one. Writes to addresses that can't be written are ignored.
+ */
+void WriteRegister(unsigned char address, unsigned char value) {
+    const struct Register *reg;
+    unsigned char first, last, n, motorValue, offset;
+    unsigned char size;
+    if (address >= REGISTER_COUNT) {
+        return;
+    }
+    reg = &Registers[address];
+    if (!(reg->flags & REG_WRITE)) {
+        return;
+    }
+    if (reg->flags & REG_COMMIT) {
+        CommitShadow();
+        return;
+    }
+    if (reg->flags & REG_FIFO) {
+        QueueSegmentByte(reg->motor, value);
+        return;
+    }
+    //The live values are in the Motor structs, the shadow values in the
+    //MotorShadow structs
+    size = (reg->flags & REG_DIRECT) ? sizeof(struct Motor) : sizeof(struct MotorShadow);
+    RegisterMotors(reg, &first, &last);
+    for (n = first; n <= last; n++) {
+        motorValue = value;
+        if (reg->flags & REG_PACKED) {
+            motorValue = (value >> (2 * n)) & 0b00000011;
+            if (reg->flags & REG_BIT) {
+                motorValue = motorValue ? 1 : 0;
+            }
+        } else if (reg->flags & REG_BIT) {
+            motorValue &= 1;
+        }
+        if ((reg->flags & REG_SPEED) && motorValue < Motors[n].minimumDuty) {
+            motorValue = 0;
+        }
+        reg->write[n * size] = motorValue;
+        if (!(reg->flags & REG_DIRECT)) {
+            offset = ShadowOffset(&reg->write[n * size]);
+            ShadowWritten[offset >> 3] |= (unsigned char)(1 << (offset & 7));
+        }
+    }
+}
+
+/*
+ * This is called from the interrupt to add a register write to the ring.
+ */
+void PushCommand(unsigned char address, unsigned char value) {
+    unsigned char next = (CommandHead + 1) & (COMMAND_RING_SIZE - 1);
+    if (next == CommandTail) {
+        //The ring is full, the count stops at 255 instead of wrapping
+        if (CommandOverflows != 0xFF) {
+            CommandOverflows++;
+        }
+        CommandDropped = 1;
+        return;
+    }
+    CommandRing[CommandHead].address = address;
+    CommandRing[CommandHead].value = value;
+    CommandHead = next;
+    if (!PECEnable) {
+        CommandPublished = next;
+    }
+}
+
+/*
+ * This is called from the main loop to do the register writes that the
+ * interrupt has received.
+ */
+void ApplyI2CCommands(void) {
+    unsigned char tail = CommandTail;
+    while (tail != CommandPublished) {
+        WriteRegister(CommandRing[tail].address, CommandRing[tail].value);
+        tail = (tail + 1) & (COMMAND_RING_SIZE - 1);
+        CommandTail = tail;
+    }
+}
 
 //This holds the most recent information in the i2c buffer
 unsigned char currentByte = 0;
 unsigned char state = 0;
 
-unsigned char readOrWrite = 0;
+//This is set when a register has been written since the last stop condition
+unsigned char writtenSinceStop = 0;
+
+//This is set when the transaction is a general call
+unsigned char generalCall = 0;
 
-unsigned int i;
+//The CRC of the bytes since the last stop condition, the number of bytes read
+//in this read and the data byte that is held back in case it is the PEC.
+//Counting the instructions by hand, a CRC8Table lookup is about 12
+//instruction cycles. The address bytes and the bytes read always get one, and
+//with the PEC on each byte written gets one and about 10 more cycles to hold
+//it back. A byte at 400kHz is 90 instruction cycles.
+unsigned char pecCRC = 0;
+unsigned char pecReadCount = 0;
+unsigned char pecHeld = 0;
+unsigned char pecHeldState = 0;
+unsigned char pecHeldValue = 0;
+//This is set when there was a bus error in the transaction
+unsigned char pecBusError = 0;
 
 void ReadI2CByte(void) {
-    if (state) {
-        switch (state) {
-            case SPEED_ADDRESS:
-                SSPBUF = Motors[0].duty;
-                break;
-            case MOTOR_0_SPEED_ADDRESS:
-                SSPBUF = Motors[0].duty;
-                break;
-            case MOTOR_1_SPEED_ADDRESS:
-                SSPBUF = Motors[1].duty;
-                break;
-            case MOTOR_2_SPEED_ADDRESS:
-                SSPBUF = Motors[2].duty;
-                break;
-            case MOTOR_3_SPEED_ADDRESS:
-                SSPBUF = Motors[3].duty;
-                break;
-            case MOTOR_TYPE_ADDRESS:
-                //Each motor has two bits to determine the motor type
-                SSPBUF = (unsigned)((Motors[0].motorType & 0b00000011) | (Motors[1].motorType & 0b00000011)<<2 | (Motors[2].motorType & 0b00000011)<<4 | (Motors[3].motorType & 0b00000011)<<6);
-                break;
-            case MOTOR0_TYPE_ADDRESS:
-                SSPBUF = Motors[0].motorType;
-                break;
-            case MOTOR1_TYPE_ADDRESS:
-                SSPBUF = Motors[1].motorType;
-                break;
-            case MOTOR2_TYPE_ADDRESS:
-                SSPBUF = Motors[2].motorType;
-                break;
-            case MOTOR3_TYPE_ADDRESS:
-                SSPBUF = Motors[3].motorType;
-                break;
-            case DIRECTION_ADDRESS:
-                SSPBUF = (unsigned)((Motors[0].direction & 0b00000011) | (Motors[1].direction & 0b00000011)<<2 | (Motors[2].direction & 0b00000011)<<4 | (Motors[3].direction & 0b00000011)<<6);
-                break;
-            case MOTOR0_DIRECTION_ADDRESS:
-                SSPBUF = Motors[0].direction;
-                break;
-            case MOTOR1_DIRECTION_ADDRESS:
-                SSPBUF = Motors[1].direction;
-                break;
-            case MOTOR2_DIRECTION_ADDRESS:
-                SSPBUF = Motors[2].direction;
-                break;
-            case MOTOR3_DIRECTION_ADDRESS:
-                SSPBUF = Motors[3].direction;
-                break;
-            case ENABLE_ADDRESS:
-                SSPBUF = PWMEnable;
-                break;
-            case MOTOR0_ENABLE_ADDRESS:
-                SSPBUF = Motors[0].enabled;
-                break;
-            case MOTOR1_ENABLE_ADDRESS:
-                SSPBUF = Motors[1].enabled;
-                break;
-            case MOTOR2_ENABLE_ADDRESS:
-                SSPBUF = Motors[2].enabled;
-                break;
-            case MOTOR3_ENABLE_ADDRESS:
-                SSPBUF = Motors[3].enabled;
-                break;
-            case PAUSE_ADDRESS:
-                SSPBUF = PWMPause;
-                break;
-            case MOTOR0_PAUSE_ADDRESS:
-                SSPBUF = Motors[0].paused;
-                break;
-            case MOTOR1_PAUSE_ADDRESS:
-                SSPBUF = Motors[1].paused;
-                break;
-            case MOTOR2_PAUSE_ADDRESS:
-                SSPBUF = Motors[2].paused;
-                break;
-            case MOTOR3_PAUSE_ADDRESS:
-                SSPBUF = Motors[3].paused;
-                break;
-            case ACCEL_ADDRESS:
-                SSPBUF = Motors[0].accelType;
-                break;
-            case MOTOR0_ACCEL_TYPE_ADDRESS:
-                SSPBUF = Motors[0].accelType;
-                break;
-            case MOTOR1_ACCEL_TYPE_ADDRESS:
-                SSPBUF = Motors[1].accelType;
-                break;
-            case MOTOR2_ACCEL_TYPE_ADDRESS:
-                SSPBUF = Motors[2].accelType;
-                break;
-            case MOTOR3_ACCEL_TYPE_ADDRESS:
-                SSPBUF = Motors[3].accelType;
-                break;
-            case ACCEL_RATE_ADDRESS:
-                SSPBUF = Motors[0].accelRate;
-                break;
-            case MOTOR0_ACCEL_RATE_ADDRESS:
-                SSPBUF = Motors[0].accelRate;
-                break;
-            case MOTOR1_ACCEL_RATE_ADDRESS:
-                SSPBUF = Motors[1].accelRate;
-                break;
-            case MOTOR2_ACCEL_RATE_ADDRESS:
-                SSPBUF = Motors[2].accelRate;
-                break;
-            case MOTOR3_ACCEL_RATE_ADDRESS:
-                SSPBUF = Motors[3].accelRate;
-                break;
-            case MINIMUM_DUTY_ADDRESS:
-                SSPBUF = Motors[0].minimumDuty;
-                break;
-            case MOTOR0_MINIMUM_DUTY_ADDRESS:
-                SSPBUF = Motors[0].minimumDuty;
-                break;
-            case MOTOR1_MINIMUM_DUTY_ADDRESS:
-                SSPBUF = Motors[1].minimumDuty;
-                break;
-            case MOTOR2_MINIMUM_DUTY_ADDRESS:
-                SSPBUF = Motors[2].minimumDuty;
-                break;
-            case MOTOR3_MINIMUM_DUTY_ADDRESS:
-                SSPBUF = Motors[3].minimumDuty;
-                break;
-            case MOTOR0_TARGET_ADDRESS:
-                SSPBUF = Motors[0].target;
-                break;
-            case MOTOR1_TARGET_ADDRESS:
-                SSPBUF = Motors[1].target;
-                break;
-            case MOTOR2_TARGET_ADDRESS:
-                SSPBUF = Motors[2].target;
-                break;
-            case MOTOR3_TARGET_ADDRESS:
-                SSPBUF = Motors[3].target;
-                break;
-            case MOTOR0_TARGET_DIRECTION_ADDRESS:
-                SSPBUF = Motors[0].targetDirection;
-                break;
-            case MOTOR1_TARGET_DIRECTION_ADDRESS:
-                SSPBUF = Motors[1].targetDirection;
-                break;
-            case MOTOR2_TARGET_DIRECTION_ADDRESS:
-                SSPBUF = Motors[2].targetDirection;
-                break;
-            case MOTOR3_TARGET_DIRECTION_ADDRESS:
-                SSPBUF = Motors[3].targetDirection;
-                break;
-            default:
-                //Send 255 whenever an invalid read is requested
-                SSPBUF = 0xFF;
-                break;
-        }
+    unsigned char value;
+    if (PECEnable && pecReadCount >= PECReadLength) {
+        //The PEC comes after the data, then 255
+        value = (pecReadCount == PECReadLength) ? pecCRC : 0xFF;
     } else {
         //Send 255 whenever an invalid read is requested
-        SSPBUF = 0xFF;
+        value = ReadRegister(state);
+        pecCRC = CRC8Table[pecCRC ^ value];
     }
+    if (pecReadCount != 0xFF) {
+        pecReadCount++;
+    }
+    SSPBUF = value;
 }
 
 /*
- * This is the ISR (Interrupt Service Routine) that is called whenever an
- * interrupt is triggered. With the pic18 we are using there are multiple
- * interrupt sources, but at most a high and low priority interrupt service
- * routine. So when it is called you need to check the source of the interrupt
- * to see what to do. Priority of the interrupts is handled by if else
- * statements.
- *
- * For now we only have one interrupt enabled, but checking is still good
- * practice unless you have some great need to shave off ever cycle.
+ * This passes a byte written by the host on to the main loop. A general call
+ * can only write some registers.
+ */
+void WriteI2CByte(unsigned char address, unsigned char value) {
+    if (!generalCall || (address < REGISTER_COUNT && (Registers[address].flags & REG_GENERAL))) {
+        PushCommand(address, value);
+        writtenSinceStop = 1;
+    }
+}
+
+/*
+ * This is called at the stop condition when the PEC is on. The writes are
+ * published if the held back byte is the right PEC, otherwise they are taken
+ * back out of the ring and counted in PECErrors.
  */
-void interrupt I2C_Slave_Read(void)
+void CheckPEC(void) {
+    if (pecHeld && !pecBusError && !CommandDropped && pecCRC == pecHeldValue) {
+        if (writtenSinceStop) {
+            PushCommand(COMMIT_ADDRESS, 0);
+        }
+        CommandPublished = CommandHead;
+    } else {
+        CommandHead = CommandPublished;
+        //A write of only the register address doesn't have a PEC
+        if ((pecHeld || pecBusError) && PECErrors != 0xFF) {
+            PECErrors++;
+        }
+    }
+}
+
+/*
+ * This is called from the low priority ISR in main.c when the i2c module sets SSPIF.
+ */
+void I2C_Slave_Read(void)
 {
-    if(PIR1bits.SSPIF == 1) {
+    if (PIR1bits.SSPIF == 1 && SSPSTATbits.P) {
+        //This is a stop condition, commit anything that was written
+        if (PECEnable) {
+            CheckPEC();
+        } else if (writtenSinceStop) {
+            PushCommand(COMMIT_ADDRESS, 0);
+        }
+        writtenSinceStop = 0;
+        CommandDropped = 0;
+        //The PEC starts again for the next transaction
+        pecCRC = 0;
+        pecHeld = 0;
+        pecBusError = 0;
+    } else if (PIR1bits.SSPIF == 1 && (SSPSTATbits.BF || SSPSTATbits.R_nW)) {
+        //Start conditions don't set BF or R_nW, so only address and data
+        //bytes get here.
         //hold the clock
         SSPCON1bits.CKP = 0;
         //We always want to read the buffer to clear it and use the data
         currentByte = SSPBUF;
         //Handle errors by throwing everything away
         if ((SSPCON1bits.SSPOV) || (SSPCON1bits.WCOL)) {
+            if (PerfBusErrors != 0xFFFF) {
+                PerfBusErrors++;
+            }
+            pecBusError = 1;
             // Clear the overflow flag
             SSPCON1bits.SSPOV = 0;
             // Clear the collision bit
@@ -284,206 +864,75 @@ void interrupt I2C_Slave_Read(void)
             //When we have received an address byte that is set to 'write'
             //Set the state to 0 so we know to get the next byte as the state
             state = 0;
+            //The general call address is 0
+            generalCall = (currentByte == 0);
+            pecCRC = CRC8Table[pecCRC ^ currentByte];
+            if (PerfTransactions != 0xFFFF) {
+                PerfTransactions++;
+            }
         } else if (SSPSTATbits.D_nA && !SSPSTATbits.R_nW) {
             //When we receive a data byte that is set to 'write'
             if (state == 0) {
                 //If we don't know what we have yet than the byte is the address
                 //to write to. We are calling this the state.
                 state = currentByte;
+                pecCRC = CRC8Table[pecCRC ^ currentByte];
+            } else if (PECEnable) {
+                //The last byte is the PEC, so each byte is held back until
+                //the next one shows that it isn't the last
+                if (pecHeld) {
+                    pecCRC = CRC8Table[pecCRC ^ pecHeldValue];
+                    WriteI2CByte(pecHeldState, pecHeldValue);
+                }
+                pecHeld = 1;
+                pecHeldState = state;
+                pecHeldValue = currentByte;
+                if (state >= REGISTER_COUNT || !(Registers[state].flags & REG_FIFO)) {
+                    state += 1;
+                }
             } else {
-                //If we have a non-zero state than we set the correct values
-                //Check what address the state matches and set the values
-                //accordingly.
-                switch (state) {
-                    case SPEED_ADDRESS:
-                        for (i = 0; i < 4; i++) {
-                            if (currentByte < Motors[i].minimumDuty) {
-                                Motors[i].target = 0;
-                            } else {
-                                Motors[i].target = currentByte;
-                            }
-                        }
-                        break;
-                    case MOTOR_0_SPEED_ADDRESS:
-                        if (currentByte < Motors[0].minimumDuty) {
-                            Motors[0].target = 0;
-                        } else {
-                            Motors[0].target = currentByte;
-                        }
-                        break;
-                    case MOTOR_1_SPEED_ADDRESS:
-                        if (currentByte < Motors[1].minimumDuty) {
-                            Motors[1].target = 0;
-                        } else {
-                            Motors[1].target = currentByte;
-                        }
-                        break;
-                    case MOTOR_2_SPEED_ADDRESS:
-                        if (currentByte < Motors[2].minimumDuty) {
-                            Motors[2].target = 0;
-                        } else {
-                            Motors[2].target = currentByte;
-                        }
-                        break;
-                    case MOTOR_3_SPEED_ADDRESS:
-                        if (currentByte < Motors[3].minimumDuty) {
-                            Motors[3].target = 0;
-                        } else {
-                            Motors[3].target = currentByte;
-                        }
-                        break;
-                    case MOTOR_TYPE_ADDRESS:
-                        //Each motor has two bits to determine the motor type
-                        for (i = 0; i < 4; i++) {
-                            Motors[i].motorType = (unsigned) (currentByte>>(2*i)) & 0b00000011;
-                        }
-                        break;
-                    case MOTOR0_TYPE_ADDRESS:
-                        Motors[0].motorType = currentByte;
-                        break;
-                    case MOTOR1_TYPE_ADDRESS:
-                        Motors[1].motorType = currentByte;
-                        break;
-                    case MOTOR2_TYPE_ADDRESS:
-                        Motors[2].motorType = currentByte;
-                        break;
-                    case MOTOR3_TYPE_ADDRESS:
-                        Motors[3].motorType = currentByte;
-                        break;
-                    case DIRECTION_ADDRESS:
-                        for (i = 0; i < 4; i++) {
-                            if ((currentByte>>(2*i)) & 0b00000011) {
-                                Motors[i].targetDirection = 1;
-                            } else {
-                                Motors[i].targetDirection = 0;
-                            }
-                        }
-                        break;
-                    case MOTOR0_DIRECTION_ADDRESS:
-                        Motors[0].targetDirection = currentByte;
-                        break;
-                    case MOTOR1_DIRECTION_ADDRESS:
-                        Motors[1].targetDirection = currentByte;
-                        break;
-                    case MOTOR2_DIRECTION_ADDRESS:
-                        Motors[2].targetDirection = currentByte;
-                        break;
-                    case MOTOR3_DIRECTION_ADDRESS:
-                        Motors[3].targetDirection = currentByte;
-                        break;
-                    case ENABLE_ADDRESS:
-                        PWMEnable = currentByte;
-                        break;
-                    case MOTOR0_ENABLE_ADDRESS:
-                        Motors[0].enabled = currentByte;
-                        break;
-                    case MOTOR1_ENABLE_ADDRESS:
-                        Motors[1].enabled = currentByte;
-                        break;
-                    case MOTOR2_ENABLE_ADDRESS:
-                        Motors[2].enabled = currentByte;
-                        break;
-                    case MOTOR3_ENABLE_ADDRESS:
-                        Motors[3].enabled = currentByte;
-                        break;
-                    case PAUSE_ADDRESS:
-                        PWMPause = currentByte;
-                        break;
-                    case MOTOR0_PAUSE_ADDRESS:
-                        Motors[0].paused = currentByte;
-                        break;
-                    case MOTOR1_PAUSE_ADDRESS:
-                        Motors[1].paused = currentByte;
-                        break;
-                    case MOTOR2_PAUSE_ADDRESS:
-                        Motors[2].paused = currentByte;
-                        break;
-                    case MOTOR3_PAUSE_ADDRESS:
-                        Motors[3].paused = currentByte;
-                        break;
-                    case ACCEL_ADDRESS:
-                        for (i = 0; i < 4; i++) {
-                            Motors[i].accelType = currentByte;
-                        }
-                        break;
-                    case MOTOR0_ACCEL_TYPE_ADDRESS:
-                        Motors[0].accelType = currentByte;
-                        break;
-                    case MOTOR1_ACCEL_TYPE_ADDRESS:
-                        Motors[1].accelType = currentByte;
-                        break;
-                    case MOTOR2_ACCEL_TYPE_ADDRESS:
-                        Motors[2].accelType = currentByte;
-                        break;
-                    case MOTOR3_ACCEL_TYPE_ADDRESS:
-                        Motors[3].accelType = currentByte;
-                        break;
-                    case ACCEL_RATE_ADDRESS:
-                        for (i = 0; i < 4; i++) {
-                            Motors[i].accelRate = currentByte;
-                        }
-                        break;
-                    case MOTOR0_ACCEL_RATE_ADDRESS:
-                        Motors[0].accelRate = currentByte;
-                        break;
-                    case MOTOR1_ACCEL_RATE_ADDRESS:
-                        Motors[1].accelRate = currentByte;
-                        break;
-                    case MOTOR2_ACCEL_RATE_ADDRESS:
-                        Motors[2].accelRate = currentByte;
-                        break;
-                    case MOTOR3_ACCEL_RATE_ADDRESS:
-                        Motors[3].accelRate = currentByte;
-                        break;
-                    case MINIMUM_DUTY_ADDRESS:
-                      for (i = 0; i < 4; i++) {
-                          Motors[i].minimumDuty = currentByte;
-                      }
-                      break;
-                    case MOTOR0_MINIMUM_DUTY_ADDRESS:
-                        Motors[0].minimumDuty = currentByte;
-                        break;
-                    case MOTOR1_MINIMUM_DUTY_ADDRESS:
-                        Motors[1].minimumDuty = currentByte;
-                        break;
-                    case MOTOR2_MINIMUM_DUTY_ADDRESS:
-                        Motors[2].minimumDuty = currentByte;
-                        break;
-                    case MOTOR3_MINIMUM_DUTY_ADDRESS:
-                        Motors[3].minimumDuty = currentByte;
-                        break;
-                    case MOTOR0_TARGET_DIRECTION_ADDRESS:
-                        Motors[0].targetDirection = currentByte;
-                        break;
-                    case MOTOR1_TARGET_DIRECTION_ADDRESS:
-                        Motors[1].targetDirection = currentByte;
-                        break;
-                    case MOTOR2_TARGET_DIRECTION_ADDRESS:
-                        Motors[2].targetDirection = currentByte;
-                        break;
-                    case MOTOR3_TARGET_DIRECTION_ADDRESS:
-                        Motors[3].targetDirection = currentByte;
-                        break;
+                //If we have a non-zero state than we pass the write on to the
+                //main loop
+                WriteI2CByte(state, currentByte);
+                //increment the state to allow for writing multiple bytes,
+                //all the bytes for a queue go to the same address
+                if (state >= REGISTER_COUNT || !(Registers[state].flags & REG_FIFO)) {
+                    state += 1;
                 }
-                //increment the state to allow for writing multiple bytes
-                state += 1;
             }
         } else if(!SSPSTATbits.D_nA && SSPSTATbits.R_nW) {
-            //readOrWrite = 1;
+            if (PerfTransactions != 0xFFFF) {
+                PerfTransactions++;
+            }
+            //A write of data before a repeated start doesn't have a PEC so
+            //it is thrown away
+            if (pecHeld) {
+                CommandHead = CommandPublished;
+                pecHeld = 0;
+                if (PECErrors != 0xFF) {
+                    PECErrors++;
+                }
+            }
+            pecCRC = CRC8Table[pecCRC ^ currentByte];
+            pecReadCount = 0;
+            //A read that starts in a read only block gets a new copy of it
+            LatchRead(state, 1);
             //We are going to read from the controller, so send the byte
             //determined by state, which was set by the previous write
             ReadI2CByte();
         } else if (SSPSTATbits.D_nA && SSPSTATbits.R_nW) {
             //this is for reading multiple bytes in sequence
-            //increment the state
-            state += 1;
+            //increment the state, unless it is the trace
+            if (state >= REGISTER_COUNT || !(Registers[state].flags & REG_FIFO)) {
+                state += 1;
+                LatchRead(state, 0);
+            }
             //send the next byte
             ReadI2CByte();
         }
-        //release the clock
+        //release the clock, there is no need to wait for the byte to go
+        //out, the next interrupt comes when the master has it
         SSPCON1bits.CKP = 1;
-        //wait until the buffer is cleared
-        while(SSPSTATbits.BF);
     }
     //Clear interrupt flag
     PIR1bits.SSPIF = 0;
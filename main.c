@@ -28,8 +28,9 @@
  * a pwm pin, a dir pin and a cdir pin. Only the pwm and dir pins are used for
  * 2 wire controllers. 
  * 
- * NOTE: SERVO MOTORS ARE NOT YET SUPPORTED
- * Only the pwm pin is used when controlling a servo motor.
+ * Only the pwm pin is used when controlling a servo motor, the servo pulses are
+ * timed by CCP1 with the pwm (see servo.c). A stepper driver uses the pwm pin as STEP and
+ * the dir pin as DIR, the steps are timed by CCP1 too (see stepper.c).
  * 
  * The 4 sets of pins available are:
  * 
@@ -119,6 +120,26 @@
 #include <xc.h>
 #include "parameters.h"
 
+//These are the global values declared in parameters.h, see there for what
+//they do.
+unsigned char PWMEnable = 1;
+unsigned char PWMPause = 0;
+struct PWMConfig PWMConfig = {(unsigned char)PWM_PERIOD_TICKS, (unsigned char)(PWM_PERIOD_TICKS >> 8), PWM_PRESCALE};
+unsigned char SyncRequest = 0;
+unsigned char SyncTicksLow = 0;
+unsigned char SyncTicksHigh = 0;
+unsigned char SyncMask = 0;
+unsigned char CommandOverflows = 0;
+unsigned char MoveRequest = 0;
+unsigned char MoveMask = 0;
+unsigned char EncoderEnable = 0;
+volatile long MotorPositions[4];
+struct Motor Motors[4];
+unsigned int ControlTickCount = 0;
+unsigned char I2CAddress = I2C_ADDRESS;
+unsigned char I2CMask = I2C_MASK;
+unsigned char I2CGeneralCall = 0;
+
 /*
  * This sets up the ports used by the motors and by the i2c
  */
@@ -131,19 +152,87 @@ void InitPorts(void) {
     TRISC = 0x00;
 }
 
+/*
+ * This sets the priority of each interrupt and turns them on, it is called
+ * once everything has been set up.
+ *
+ * The pic18 has a high and a low priority interrupt and the high priority one
+ * can interrupt the low priority one. Everything that has to happen at an
+ * exact time (the PWM, servo and stepper edges, the control tick and the
+ * encoders) is high priority. The i2c is low priority so however long the bus
+ * takes it never makes an edge late. InitI2C sets its own priority.
+ */
+void InitInterrupts(void) {
+    RCONbits.IPEN = 1;
+    IPR1bits.CCP1IP = 1;
+    IPR1bits.TMR2IP = 1;
+    INTCON2bits.RABIP = 1;
+    //Turn on the high and then the low priority interrupts
+    INTCONbits.GIEH = 1;
+    INTCONbits.GIEL = 1;
+}
+
+/*
+ * This is the high priority ISR (Interrupt Service Routine). There are several
+ * interrupt sources for each priority so when it is called you need to check
+ * the source of the interrupt to see what to do.
+ *
+ * The CCP1 compare, which does the PWM, servo and stepper edges, is checked
+ * first so that they are late as little as possible.
+ */
+void interrupt high_priority HighISR(void) {
+    unsigned int start = TMR1;
+    if (PIR1bits.CCP1IF == 1) {
+        PWMEdgeInterrupt();
+    }
+    if (PIR1bits.TMR2IF == 1) {
+        ControlTickInterrupt();
+    }
+    if (INTCONbits.RABIE && INTCONbits.RABIF) {
+        EncoderInterrupt();
+    }
+    CountISR(TMR1 - start);
+}
+
+/*
+ * This is the low priority ISR, it only does the i2c.
+ */
+void interrupt low_priority LowISR(void) {
+    unsigned int start = TMR1;
+    if (PIR1bits.SSPIF == 1) {
+        I2C_Slave_Read();
+    }
+    CountI2C(TMR1 - start);
+}
+
 void main(void) {
     //This sets the internal oscillator to 16MHz
     OSCCONbits.IRCF = 0b111;
     
     //These set up the components
     InitPorts();
-    InitI2C();
     InitPWM();
+    InitControlTick();
+    InitServo();
+    InitStepper();
+    //This replaces the defaults from InitPWM and can change the i2c address
+    LoadBootProfile();
+    InitI2C();
+    InitInterrupts();
+    //Start the i2c shadow registers with the values set up by InitPWM
+    LoadShadow();
     
-    //Every loop it checks the PWMs and updates as needed
-    //I2C is interrupt driven so we don't need anything for it here.
+    //The PWM and servo pins are switched by the CCP1 interrupt, every loop it
+    //builds the edges for the next period and frame and runs any control ticks
+    //that are due.
+    //I2C is interrupt driven, the interrupt leaves the register writes for
+    //the main loop.
     while(1) {
+        CountLoop();
+        ApplyI2CCommands();
         CheckPWMOutput();
+        RunProfile();
+        RunPWMConfigSave();
     }
     return;
 }
@@ -30,9 +30,11 @@
 /*
  * By default the clock is running at, we set it to 16MHz in main.c
  *
- * PWM_PERIOD is the period for the PWM in us, it should be about 2000us
- * since we are using a 1MHz clock we can use this as our target value for the
- * timer.
+ * The PWM uses Timer1 running from the 4MHz instruction clock. By default it
+ * has a 1:8 prescaler, so it counts every 2us, and a period of
+ * PWM_PERIOD_TICKS counts, which is about 16ms. Both can be changed using the
+ * PWM_PERIOD and PWM_PRESCALE registers. The duty (with its fraction) is scaled
+ * to the period, so the resolution of the duty is one Timer1 count.
  *
  */
 
@@ -40,14 +42,102 @@
 //handy in the future.
 #define __XTAL_FREQUENCY 16000000 //hz
 
-//This is the i2c address that the controller uses. It can be any value from
-//0x00 to 0xFF
+//This is the default i2c address that the controller uses, a profile can have
+//a different one. It can be any value from 0x08 to 0x77
 #define I2C_ADDRESS 0x23
+//The default address mask, all of the bits of the address are used
+#define I2C_MASK 0x7F
+
+//The default pwm period in Timer1 counts and the default Timer1 prescaler (0-3
+//for 1:1, 1:2, 1:4 and 1:8)
+#define PWM_PERIOD_TICKS 8192
+#define PWM_PRESCALE 3
+//The limits for the pwm period. The shortest period is in instruction cycles
+//so that the time spent in the pwm interrupt stays the same whatever the
+//prescaler is, there are up to 5 interrupts each period. The longest period
+//has to be less than half of the Timer1 range so the interrupt can tell if an
+//edge is late.
+#define PWM_MINIMUM_PERIOD_CYCLES 2000
+#define PWM_MAXIMUM_PERIOD_TICKS 32767
+
+//Servo pulses are timed by CCP1 and Timer1 along with the pwm edges. Each frame
+//is SERVO_FRAME_US long and the pulse for a duty of 0 is
+//SERVO_MINIMUM_PULSE_US long, a duty of 256.0 would be SERVO_MINIMUM_PULSE_US
+//+ SERVO_PULSE_RANGE_US. The width goes in steps of one Timer1 tick, which is
+//2us with the default prescaler, a prescaler of 1:4 or less is needed for
+//1us steps.
+#define SERVO_FRAME_US 20000
+#define SERVO_MINIMUM_PULSE_US 1000
+#define SERVO_PULSE_RANGE_US 1000
+//The longest time between two servo edges, longer gaps are split up with
+//edges that don't change any pins. Each edge has to be less than half of the
+//Timer1 range away, this is 16000 ticks with the 1:1 prescaler.
+#define SERVO_WAIT_US 4000
+
+//Stepper steps are timed by CCP1 and Timer1 along with the pwm edges. The step
+//rate is STEPPER_STEPS_PER_DUTY steps a second for each whole step of duty,
+//so a duty of 255 is 2040 steps a second (490us between steps) and the
+//fraction takes it up to just under 2048. The time between steps is
+//STEPPER_INTERVAL_SCALE instruction cycles divided by the duty with its
+//fraction.
+//The rate is kept this low because every step is a CCP1 interrupt. A step
+//of one stepper takes about 25us (100 instruction cycles) and a step of all
+//four about 55us, and the pwm edges wait while it runs, see stepper.c. At
+//2040 steps a second four steppers keep the interrupt busy about a fifth of
+//the time. Four steppers at 10000 steps a second would need all of the CPU,
+//so the tens of kHz a stepper driver can take aren't possible on this chip.
+#define STEPPER_STEPS_PER_DUTY 8
+#define STEPPER_INTERVAL_SCALE (1024000000UL / STEPPER_STEPS_PER_DUTY)
+//Rates with more Timer1 ticks between steps than this (about 15 steps a
+//second with the default prescaler) don't step, the interrupt compares times
+//using signed differences
+#define STEPPER_MAXIMUM_INTERVAL 32767
+
+//Where things are kept in the EEPROM
+//The pwm period and prescaler, a marker byte then the period low byte, high
+//byte and the prescaler.
+#define EEPROM_PWM_CONFIG 0
+#define EEPROM_PWM_CONFIG_MARKER 0xA5
+//The profile slot that is loaded at start up, 0xFF for none
+#define EEPROM_BOOT_PROFILE 4
+//The profile slots, see profile.c. Each one is a marker byte, the profile and a
+//checksum.
+#define EEPROM_PROFILES 16
+#define EEPROM_PROFILE_MARKER 0x5A
+#define PROFILE_SLOT_BYTES 40
+//The number of profile slots, this has to be a power of 2
+#define PROFILE_SLOTS 4
+
+//The rate of the control tick that runs the acceleration, in Hz. Timer2 can
+//give rates from about 977Hz up with the 1:16 prescaler.
+#define CONTROL_TICK_HZ 1000
+
+//The number of register writes that can be waiting for the main loop, this
+//has to be a power of 2
+#define COMMAND_RING_SIZE 16
+
+//The number of setpoint queue segments, they are shared by the queues of all
+//four motors. Each one is 4 bytes of RAM and there can't be more than 127.
+//This is as many as fit in the RAM, so it is also the longest path that can
+//be sent at once, see MOTOR0_QUEUE_ADDRESS.
+#define SEGMENT_POOL_SIZE 8
+
+//The number of entries in the ramp trace, this has to be a power of 2. Each
+//entry is 4 bytes of RAM. There isn't the RAM for a whole ramp at every
+//control tick, 16 entries is only 16ms at 1kHz. A ramp only fits with
+//TRACE_DIVISOR set so that it records a change of a few duty steps instead
+//of every tick, the full resolution can only be seen for 16 ticks.
+#define TRACE_SIZE 16
 
 //These are just to simplifiy reading the code
 #define HIGH 1
 #define LOW 0
 
+//Index of each port in the per port pin masks
+#define PORT_A 0
+#define PORT_B 1
+#define PORT_C 2
+
 //Addresses for the different parameters that we can set
 #define SPEED_ADDRESS 1
 #define MOTOR_0_SPEED_ADDRESS 2
@@ -79,6 +169,8 @@
 #define MOTOR1_ACCEL_TYPE_ADDRESS 28
 #define MOTOR2_ACCEL_TYPE_ADDRESS 29
 #define MOTOR3_ACCEL_TYPE_ADDRESS 30
+//The acceleration rate is the number of control ticks (ms) between each step
+//of the acceleration, 0 and 1 both step on every tick.
 #define ACCEL_RATE_ADDRESS 31
 #define MOTOR0_ACCEL_RATE_ADDRESS 32
 #define MOTOR1_ACCEL_RATE_ADDRESS 33
@@ -97,61 +189,550 @@
 #define MOTOR1_TARGET_DIRECTION_ADDRESS 46
 #define MOTOR2_TARGET_DIRECTION_ADDRESS 47
 #define MOTOR3_TARGET_DIRECTION_ADDRESS 48
+//The number of register writes that were dropped because the command ring was
+//full, write 0 to reset it
+#define COMMAND_OVERFLOW_ADDRESS 49
+//Writes go into shadow registers and are committed at the end of each i2c
+//write, writing any value here commits them straight away.
+#define COMMIT_ADDRESS 50
+//A read only block with a snapshot of all four motors so that they can be read
+//in one transaction. The snapshot is taken when a read starts in the block or
+//carries on into its first byte.
+//  0-1   the control tick count when the snapshot was made, low byte first
+//  2-5   duty of motors 0-3
+//  6-9   target of motors 0-3
+//  10    bits 0-3 direction of motors 0-3, bits 4-7 enabled of motors 0-3
+//  11    bits 0-3 paused of motors 0-3, bit 4 PWMEnable, bit 5 PWMPause
+#define STATUS_ADDRESS 51
+#define STATUS_LENGTH 12
+//The curve used by the exponential acceleration, 0-3 give time constants of 4,
+//8, 16 and 32 acceleration steps
+#define ACCEL_CURVE_ADDRESS 63
+#define MOTOR0_ACCEL_CURVE_ADDRESS 64
+#define MOTOR1_ACCEL_CURVE_ADDRESS 65
+#define MOTOR2_ACCEL_CURVE_ADDRESS 66
+#define MOTOR3_ACCEL_CURVE_ADDRESS 67
+//The maximum acceleration and the jerk for the S-curve acceleration, both are
+//in 1/256 duty per acceleration step per step
+#define SCURVE_ACCEL_ADDRESS 68
+#define MOTOR0_SCURVE_ACCEL_ADDRESS 69
+#define MOTOR1_SCURVE_ACCEL_ADDRESS 70
+#define MOTOR2_SCURVE_ACCEL_ADDRESS 71
+#define MOTOR3_SCURVE_ACCEL_ADDRESS 72
+#define SCURVE_JERK_ADDRESS 73
+#define MOTOR0_SCURVE_JERK_ADDRESS 74
+#define MOTOR1_SCURVE_JERK_ADDRESS 75
+#define MOTOR2_SCURVE_JERK_ADDRESS 76
+#define MOTOR3_SCURVE_JERK_ADDRESS 77
+//How much the duty changes on each step of the linear acceleration, the whole
+//part and the fraction in 1/256 of a duty step. This defaults to 1.0.
+#define ACCEL_STEP_ADDRESS 78
+#define MOTOR0_ACCEL_STEP_ADDRESS 79
+#define MOTOR1_ACCEL_STEP_ADDRESS 80
+#define MOTOR2_ACCEL_STEP_ADDRESS 81
+#define MOTOR3_ACCEL_STEP_ADDRESS 82
+#define ACCEL_STEP_FRACTION_ADDRESS 83
+#define MOTOR0_ACCEL_STEP_FRACTION_ADDRESS 84
+#define MOTOR1_ACCEL_STEP_FRACTION_ADDRESS 85
+#define MOTOR2_ACCEL_STEP_FRACTION_ADDRESS 86
+#define MOTOR3_ACCEL_STEP_FRACTION_ADDRESS 87
+//The pwm period in Timer1 counts, low byte and high byte, and the Timer1
+//prescaler. These are saved in the EEPROM when they are committed.
+#define PWM_PERIOD_ADDRESS 88
+#define PWM_PERIOD_HIGH_ADDRESS 89
+#define PWM_PRESCALE_ADDRESS 90
+//The fraction of the target in 1/256 of a duty step, so that speeds between
+//the whole steps can be set. A target of 0 always stops the motor.
+#define TARGET_FRACTION_ADDRESS 91
+#define MOTOR0_TARGET_FRACTION_ADDRESS 92
+#define MOTOR1_TARGET_FRACTION_ADDRESS 93
+#define MOTOR2_TARGET_FRACTION_ADDRESS 94
+#define MOTOR3_TARGET_FRACTION_ADDRESS 95
+//Synchronised moves. Writing a mask of motors (bit n is motor n) to
+//SYNC_ADDRESS makes those motors go from where they are to the targets and
+//directions that are committed with it in a straight line, all finishing on
+//the same control tick. Reading it gives the motors that are still moving.
+//SYNC_TICKS is how many control ticks the move takes, low byte and high byte.
+//If it is 0 the move takes as long as the slowest motor would take with the
+//linear acceleration. A motor that is paused during the move leaves it. The
+//minimum duty isn't used during the move.
+#define SYNC_ADDRESS 96
+#define SYNC_TICKS_ADDRESS 97
+#define SYNC_TICKS_HIGH_ADDRESS 98
+//The setpoint queues. Each motor has a queue of segments, a segment is 4 bytes,
+//the delay in control ticks (low byte then high byte), the target and the
+//direction. All the bytes of a write go into the queue, the address doesn't
+//go up, and the segments are added when the write is committed. When a
+//segment is started its target and direction are set and the next segment
+//is started after the delay. A delay of 0 ends the path, the motor stays at
+//that target until more segments are sent without counting an underrun. The
+//four queues share SEGMENT_POOL_SIZE segments, a segment that doesn't fit is
+//dropped and counted in COMMAND_OVERFLOW. A segment that isn't finished when
+//the write ends or bytes for another queue come in is thrown away.
+//A path can only be sent in one write if it fits in the free segments, at
+//most SEGMENT_POOL_SIZE (8) for all four motors. Without the PEC the main
+//loop takes the bytes out of the command ring while the write goes on, so
+//that is the only limit as long as the main loop keeps up with the bus. With
+//the PEC the bytes are held in the ring until the PEC is checked, so a write
+//can only have 3 segments (COMMAND_RING_SIZE - 2 bytes) and a longer path has
+//to be sent in more than one write.
+#define MOTOR0_QUEUE_ADDRESS 99
+#define MOTOR1_QUEUE_ADDRESS 100
+#define MOTOR2_QUEUE_ADDRESS 101
+#define MOTOR3_QUEUE_ADDRESS 102
+//The number of segments waiting in each queue
+#define MOTOR0_QUEUE_DEPTH_ADDRESS 103
+#define MOTOR1_QUEUE_DEPTH_ADDRESS 104
+#define MOTOR2_QUEUE_DEPTH_ADDRESS 105
+#define MOTOR3_QUEUE_DEPTH_ADDRESS 106
+//The number of times a segment's delay ran out with nothing left in the
+//queue, write 0 to reset it
+#define MOTOR0_QUEUE_UNDERRUN_ADDRESS 107
+#define MOTOR1_QUEUE_UNDERRUN_ADDRESS 108
+#define MOTOR2_QUEUE_UNDERRUN_ADDRESS 109
+#define MOTOR3_QUEUE_UNDERRUN_ADDRESS 110
+//The quadrature encoders, bit n turns on the encoder for motor n. Motors 0 and
+//1 have quadrature inputs, motor 2 has a pulse counter and motor 3 has
+//nothing, see encoder.c. Steppers count their steps instead, their encoders
+//can't be turned on.
+#define ENCODER_ENABLE_ADDRESS 111
+//A read only block with the encoder position of each motor, 4 bytes for each
+//motor starting with motor 0, low byte first. The positions are copied when a
+//read starts in the block or carries on into its first byte, so the bytes of
+//a position always go together.
+#define ENCODER_ADDRESS 112
+#define ENCODER_LENGTH 16
+//The gains for the ACCEL_PID speed control, in 1/16 of a duty step for each
+//encoder count per acceleration step.
+#define PID_KP_ADDRESS 128
+#define MOTOR0_PID_KP_ADDRESS 129
+#define MOTOR1_PID_KP_ADDRESS 130
+#define MOTOR2_PID_KP_ADDRESS 131
+#define MOTOR3_PID_KP_ADDRESS 132
+#define PID_KI_ADDRESS 133
+#define MOTOR0_PID_KI_ADDRESS 134
+#define MOTOR1_PID_KI_ADDRESS 135
+#define MOTOR2_PID_KI_ADDRESS 136
+#define MOTOR3_PID_KI_ADDRESS 137
+#define PID_KD_ADDRESS 138
+#define MOTOR0_PID_KD_ADDRESS 139
+#define MOTOR1_PID_KD_ADDRESS 140
+#define MOTOR2_PID_KD_ADDRESS 141
+#define MOTOR3_PID_KD_ADDRESS 142
+//Moves of a set number of encoder counts. MOTORn_MOVE is the distance, a
+//signed 4 byte value with the low byte first, the sign is the direction.
+//Writing a mask of motors to MOVE_ADDRESS starts a move for each of them when
+//the registers are committed, the motor runs at its target and slows down so
+//that it stops at the end of the move. Reading it gives the motors that are
+//still moving. A motor that is paused leaves its move. Only motors with
+//their encoder turned on can move, the slowing down is planned with the
+//linear acceleration step and the last part is done at the minimum duty so
+//that should be enough to keep the motor turning.
+#define MOVE_ADDRESS 143
+#define MOTOR0_MOVE_ADDRESS 144
+#define MOTOR1_MOVE_ADDRESS 148
+#define MOTOR2_MOVE_ADDRESS 152
+#define MOTOR3_MOVE_ADDRESS 156
+//How each motor stops when it has to change direction, see the brake modes
+//below. BRAKE_TIME is how long the brake is applied in control ticks (ms) and
+//DEAD_TIME is the least number of control ticks that the driver is off
+//before the direction pins change.
+#define BRAKE_MODE_ADDRESS 160
+#define MOTOR0_BRAKE_MODE_ADDRESS 161
+#define MOTOR1_BRAKE_MODE_ADDRESS 162
+#define MOTOR2_BRAKE_MODE_ADDRESS 163
+#define MOTOR3_BRAKE_MODE_ADDRESS 164
+#define BRAKE_TIME_ADDRESS 165
+#define MOTOR0_BRAKE_TIME_ADDRESS 166
+#define MOTOR1_BRAKE_TIME_ADDRESS 167
+#define MOTOR2_BRAKE_TIME_ADDRESS 168
+#define MOTOR3_BRAKE_TIME_ADDRESS 169
+#define DEAD_TIME_ADDRESS 170
+#define MOTOR0_DEAD_TIME_ADDRESS 171
+#define MOTOR1_DEAD_TIME_ADDRESS 172
+#define MOTOR2_DEAD_TIME_ADDRESS 173
+#define MOTOR3_DEAD_TIME_ADDRESS 174
+//A read only block with the step count of each stepper, the same layout as
+//the encoder block. The counts are copied the same way. Steppers can't have
+//an encoder, the step counts are kept in the same place as the encoder
+//positions so this gives the same values as ENCODER_ADDRESS.
+#define STEP_ADDRESS 175
+#define STEP_LENGTH 16
+//A read only block of performance counters, see perf.c. The values are
+//copied and the counters set back to 0 when a read starts in the block or
+//carries on into its first byte. The values are two bytes each, low byte
+//first:
+// 0 main loops in the last second
+// 2 longest main loop, in Timer1 ticks
+// 4 longest high priority interrupt, in Timer1 ticks
+// 6 longest i2c interrupt, in Timer1 ticks
+// 8 i2c transactions (address bytes for this controller)
+// 10 i2c bus errors (overflows and write collisions)
+// 12 pwm edges under 4 Timer1 ticks late
+// 14 pwm edges 4 to 15 ticks late
+// 16 pwm edges 16 to 63 ticks late
+// 18 pwm edges 64 or more ticks late
+//The counts stop at 0xFFFF.
+#define PERF_ADDRESS 191
+#define PERF_LENGTH 20
+//The ramp trace, see trace.c. Write TRACE_ARMED to TRACE_ADDRESS to empty the
+//trace and start recording, TRACE_TRIGGERED to record until half of it is
+//after the trigger and then freeze it, or TRACE_FROZEN to freeze it now.
+//Reading it gives the state. TRACE_MOTORS is the mask of motors that are
+//traced and TRACE_COUNT is the number of entries. Once the trace is frozen
+//every byte read from TRACE_DATA gives the next byte of the entries, oldest
+//first, the address doesn't go up. Each entry is 5 bytes, the control tick
+//count (low byte then high byte, it wraps at 8192), the motor number with the
+//direction in the top bit, the duty and the target. Writing TRACE_FROZEN
+//again starts reading from the first entry. TRACE_DIVISOR is the smallest
+//change of duty that gets an entry, so a long ramp fits in the trace: with 16
+//a whole ramp from 0 to 255 is 16 entries. A change of direction and the duty
+//getting to the target always get an entry, 0 and 1 give an entry for every
+//change.
+#define TRACE_ADDRESS 211
+#define TRACE_MOTORS_ADDRESS 212
+#define TRACE_COUNT_ADDRESS 213
+#define TRACE_DATA_ADDRESS 214
+//The configuration profiles, see profile.c. A profile has the motor type,
+//acceleration type, rate and curve, minimum duty, brake mode, brake time and
+//dead time of each motor and the i2c address, mask and general call. Write
+//PROFILE_SAVE to PROFILE_ADDRESS to save the configuration to the slot in
+//PROFILE_SLOT, PROFILE_LOAD to load it, or PROFILE_RESET to go back to the
+//defaults. The last profile that was saved or loaded is loaded at start up,
+//after PROFILE_RESET the defaults are used. Reading PROFILE_ADDRESS gives
+//PROFILE_BUSY while a save is being written, a new command waits until it is
+//done, and PROFILE_BAD if the last load found an empty slot.
+#define PROFILE_ADDRESS 215
+#define PROFILE_SLOT_ADDRESS 216
+//The i2c address of the controller, the address mask and the general call.
+//These are used from the first transaction after they are committed and are
+//kept in the profiles. Addresses from 0x08 to 0x77 can be used, other values
+//are ignored. The controller answers every address that matches its own in
+//the bits that are set in the mask, so a group of controllers with
+//addresses that only differ in the bits that are clear can all be written
+//at once (reading from more than one at once doesn't work). The default mask
+//is 0x7F, only the controller's own address. While the general call is on
+//(1) the controller also answers address 0x00, but only the speed,
+//direction, pause, enable, commit and sync registers can be written with it.
+//Other devices on the bus give the general call writes to 0x04 and 0x06
+//their own meaning (0x06 is a reset) so avoid those if there are any.
+#define I2C_ADDRESS_ADDRESS 217
+#define I2C_MASK_ADDRESS 218
+#define I2C_GENERAL_CALL_ADDRESS 219
+//The SMBus packet error code. While PEC is 1 every write has to end with the
+//CRC-8 (polynomial 0x07, starting from 0) of all of the bytes since the start
+//condition, including the address bytes. The writes are only done if the PEC
+//matches, if it doesn't none of them are done and PEC_ERRORS goes up (it
+//stops at 255, write 0 to reset it). A write with the PEC can't be longer
+//than COMMAND_RING_SIZE - 2 bytes after the register address. Every read gets
+//the PEC after PEC_READ_LENGTH data bytes, the CRC includes the write of the
+//register address if it was in the same transaction (a repeated start).
+//These are committed like the other registers, so the write that turns the
+//PEC on doesn't need one but the write that turns it off does.
+#define PEC_ADDRESS 220
+#define PEC_READ_LENGTH_ADDRESS 221
+#define PEC_ERRORS_ADDRESS 222
+//See TRACE_ADDRESS
+#define TRACE_DIVISOR_ADDRESS 223
 
 //Different acceleration types
 #define ACCEL_INSTANT 0
 #define ACCEL_LINEAR 1
 #define ACCEL_EXPONENT 2
+#define ACCEL_SCURVE 3
+//With ACCEL_PID the target is a speed in encoder counts for each acceleration
+//step and the duty is set by the PID speed control to hold it
+#define ACCEL_PID 4
+
+//The profile commands and states
+#define PROFILE_SAVE 1
+#define PROFILE_LOAD 2
+#define PROFILE_RESET 3
+#define PROFILE_READY 0
+#define PROFILE_BUSY 1
+#define PROFILE_BAD 2
+
+//The states of the ramp trace
+#define TRACE_IDLE 0
+#define TRACE_ARMED 1
+#define TRACE_TRIGGERED 2
+#define TRACE_FROZEN 3
 
-//Motor type definitions, there are two unused options for later when we add
-//linear actuators and stepper motors
+//Different ways of stopping to change direction
+//Slow down with the acceleration profile, the same as a speed of 0
+#define BRAKE_RAMP 0
+//Turn the driver off for the brake time and let the motor spin down
+#define BRAKE_COAST 1
+//Set both direction pins high with the pwm pin on for the brake time, so the
+//driver shorts the motor. The cdir pin is needed for this, if it is an encoder
+//input the motor coasts instead.
+#define BRAKE_SHORT 2
+//Change direction straight away (after the dead time) and keep the duty, the
+//motor is driven backwards for the brake time and then the acceleration
+//carries on from there
+#define BRAKE_PLUG 3
+
+//The PID gains are divided by 2^PID_GAIN_SHIFT. The error and the integral are
+//limited so that the sums fit in a long.
+#define PID_GAIN_SHIFT 4
+#define PID_ERROR_LIMIT 0x10000L
+#define PID_INTEGRAL_LIMIT 0x100000L
+
+//The number of exponential acceleration curves, this has to be a power of 2
+#define EXPONENTIAL_CURVES 4
+
+//Motor type definitions, there is one unused option for later when we add
+//linear actuators
 #define MOTOR_TYPE_DC 0
+//A servo only uses the pwm pin, the duty is the position and the direction
+//isn't used. See servo.c.
 #define MOTOR_TYPE_SERVO 1
+//A stepper driver with STEP on the pwm pin and DIR on the dir pin, the duty
+//is the step rate. It always slows down with the acceleration profile to
+//change direction. See stepper.c.
+#define MOTOR_TYPE_STEPPER 2
+
+//One edge of the pwm or the servo pulses
+struct PWMEdge {
+    //When the edge happens, in timer ticks from the start of the period
+    unsigned int time;
+    //The motors whose pins go low at this edge, bit n is motor n
+    unsigned char motors;
+};
+
+//The pin numbers of each motor, see PinPort in pwm.c
+struct MotorPinNumbers {
+    unsigned char pwm;
+    unsigned char dir;
+    unsigned char cdir;
+};
+
+//The global values are defined in main.c, they are declared here so that every
+//file uses the same ones.
 
 //Enable boolean for PWM outputs, if this is set to 0 than all motors will stop
 //immediately, ignoring acceleration.
-unsigned char PWMEnable = 1;
+extern unsigned char PWMEnable;
 
 //This is the pause state, when this is 1 the motors will slow to stopped and
 //will not speed up regardless of what the speed is set to.
-unsigned char PWMPause = 0;
+extern unsigned char PWMPause;
+
+//The pwm period and Timer1 prescaler, the bytes are kept separately so that
+//the i2c registers can point at them.
+struct PWMConfig {
+    unsigned char periodLow;
+    unsigned char periodHigh;
+    unsigned char prescale;
+};
+extern struct PWMConfig PWMConfig;
 
-//This is used to set the different types of acceleration.
-unsigned char AccelType = ACCEL_EXPONENT;
-//This value controls the rate of acceleration.
-unsigned int AccelRate = 150;
-//This is used as a counter for the acceleration.
-unsigned int AccelCount = 0;
-//This keeps track of the minimum duty cycle needed to make a motor move.
-unsigned char MinimumDuty = 0;
+//The motors that are to start a synchronised move when the registers are
+//committed, and how many control ticks it should take
+extern unsigned char SyncRequest;
+extern unsigned char SyncTicksLow;
+extern unsigned char SyncTicksHigh;
+//The motors that are in the synchronised move that is running
+extern unsigned char SyncMask;
+
+//The motors that are to start a move when the registers are committed and the
+//motors that are moving
+extern unsigned char MoveRequest;
+extern unsigned char MoveMask;
+
+//The encoders that are turned on
+extern unsigned char EncoderEnable;
+
+//The encoder position of each motor with an encoder and the step count of
+//each stepper, steppers can't have an encoder so they are kept in the same
+//place. These are changed by the interrupt.
+extern volatile long MotorPositions[4];
+
+//When the next servo edge and the next step are due in Timer1 ticks, see
+//servo.c and stepper.c
+extern volatile unsigned int ServoNextTime;
+extern volatile unsigned int StepNextTime;
+extern volatile unsigned char SteppersRunning;
+
+//The number of register writes and queue segments that were dropped because
+//there wasn't room for them
+extern unsigned char CommandOverflows;
+
+//The i2c performance counters, these are in perf.c
+extern volatile unsigned int PerfTransactions;
+extern volatile unsigned int PerfBusErrors;
+
+//The copy of the read only block that the host is reading, this is in i2c.c.
+//The perf block is the longest one.
+extern unsigned char ReadLatch[PERF_LENGTH];
+
+//The ramp trace registers, these are in trace.c
+extern unsigned char TraceState;
+extern unsigned char TraceCommand;
+extern unsigned char TraceMotors;
+extern unsigned char TraceCount;
+extern unsigned char TraceDivisor;
+
+//The profile registers, these are in profile.c
+extern unsigned char ProfileCommand;
+extern unsigned char ProfileStatus;
+extern unsigned char ProfileSlot;
+
+//The table for the i2c packet error code, this is in crc8.c which is made by
+//tools/crc8.py
+extern const unsigned char CRC8Table[256];
+
+//The i2c address the controller uses, the address mask and the general call
+extern unsigned char I2CAddress;
+extern unsigned char I2CMask;
+extern unsigned char I2CGeneralCall;
 
 //Function prototypes
 void InitI2C(void);
 void InitPWM(void);
 void CheckPWMOutput(void);
+void InitControlTick(void);
+void PWMEdgeInterrupt(void);
+void ControlTickInterrupt(void);
+void I2C_Slave_Read(void);
+void ApplyI2CCommands(void);
+void LoadShadow(void);
+void UpdateStatus(void);
+void CheckPWMConfig(void);
+void RunPWMConfigSave(void);
+void StartSync(void);
+void EndSync(unsigned char motors);
+void InitQueues(void);
+void QueueSegmentByte(unsigned char index, unsigned char value);
+void CommitQueues(void);
+void RunQueue(unsigned int index);
+void SetCdirInputs(const unsigned char *inputs);
+void SetDirectionPins(unsigned char motors);
+void ConfigureEncoders(void);
+void EncoderInterrupt(void);
+long ReadEncoder(unsigned int index);
+void StartMoves(void);
+unsigned char AddEdge(struct PWMEdge *edges, unsigned char count, unsigned int time, unsigned char motors);
+void InitServo(void);
+void ServoInterrupt(void);
+void ServoPrescaleChanged(void);
+void CheckServoOutput(void);
+unsigned int DutyPosition(unsigned int index);
+unsigned int OutputPosition(unsigned int index);
+void ReverseMotor(unsigned int index, unsigned char direction);
+void InitStepper(void);
+void StepperInterrupt(void);
+void UpdateSteppers(void);
+void CountLoop(void);
+void CountISR(unsigned int ticks);
+void CountI2C(unsigned int ticks);
+void CountEdgeLateness(unsigned int ticks);
+void LatchPerformance(void);
+void RunTrace(void);
+void TraceMotor(unsigned int index, unsigned char duty, unsigned char direction);
+unsigned char ReadTrace(void);
+void DefaultMotorConfig(unsigned int index);
+void LoadBootProfile(void);
+void RunProfile(void);
+void ConfigureI2C(void);
+unsigned char EEPROMRead(unsigned char address);
+void EEPROMWrite(unsigned char address, unsigned char value);
+
+//The state of a motor in a synchronised move. The position (the duty, with
+//the sign from the direction) changes by step each control tick and by one
+//more when error goes over the length of the move, up is set if the position
+//is going up.
+struct SyncState {
+    long step;
+    unsigned int remainder;
+    unsigned int error;
+    unsigned char up;
+};
+
+//The state of a motor that isn't in a synchronised move
+struct DriveState {
+    //These are used by the S-curve acceleration
+    int velocity;
+    int acceleration;
+    //These are used by the PID speed control
+    unsigned int encoderLast;
+    int lastSpeed;
+    long pidIntegral;
+    //These are used by the moves, the goal is the encoder position to stop at
+    long moveGoal;
+    unsigned int moveLast;
+    unsigned char moveBraking;
+};
+
+//A motor is either in a synchronised move or it is run by its acceleration
+//profile, its PID and its move, so they share the same bytes. See EndSync in
+//pwm.c.
+union MotorState {
+    struct SyncState sync;
+    struct DriveState drive;
+};
 
 //This defines the struct that is used to hold information about each one of the
-//motors
+//motors. The flags are whole bytes instead of bit fields so that the i2c
+//register table can point at them.
 struct Motor {
-    unsigned char state:1;
-    unsigned char enabled:1;
-    unsigned char paused:1;
-    unsigned char direction:1;
-    unsigned char targetDirection:1;
+    unsigned char enabled;
+    unsigned char paused;
+    unsigned char direction;
+    unsigned char targetDirection;
     unsigned char motorType;
-    unsigned char PWMPin;
-    unsigned char dirPin;
-    unsigned char cdirPin;
     unsigned char duty;
     unsigned char target;
-    unsigned char servoCount;
+    unsigned char targetFraction;
     unsigned char accelType;
     unsigned char accelRate;
+    unsigned char accelCurve;
     unsigned char minimumDuty;
     unsigned char accelCount;
+    //The change in duty for each step of the linear acceleration, with 8
+    //fractional bits
+    unsigned char accelStep;
+    unsigned char accelStepFraction;
+    //The fraction of the duty below duty, only duty is used for the PWM
+    unsigned char dutyFraction;
+    //These are used by the S-curve acceleration
+    unsigned char maxAccel;
+    unsigned char jerk;
+    union MotorState state;
+    //The setpoint queue, see queue.c
+    unsigned char queueFirst;
+    unsigned char queueDepth;
+    unsigned char queueUnderruns;
+    unsigned int queueTicks;
+    //The PID gains
+    unsigned char pidKp;
+    unsigned char pidKi;
+    unsigned char pidKd;
+    //The distance of the next move, kept as bytes for the registers
+    unsigned char moveDistance[4];
+    //These are used to change direction with a brake, see StartBrake in pwm.c
+    unsigned char brakeMode;
+    unsigned char brakeTime;
+    unsigned char deadTime;
+    unsigned char brakeState;
+    unsigned char brakeTicks;
+    //The direction the motor changes to at the end of the dead time
+    unsigned char brakeDirection;
 };
 
 //This is the actual array of Motor structs
-struct Motor Motors[4];
+extern struct Motor Motors[4];
+
+//The number of control ticks that have been run, it wraps around
+extern unsigned int ControlTickCount;
+
+//The pin numbers of each motor and the pwm pins of each set of motors as port
+//masks, these are in pwm.c
+extern const struct MotorPinNumbers MotorPinNumbers[4];
+extern const unsigned char PWMPins[16][3];
+
+//The step sizes for the exponential acceleration, this is in exponential.c
+//which is made by tools/exponential.py
+extern const unsigned char ExponentialSteps[EXPONENTIAL_CURVES][256];
 
 #endif	/* MOTOR_CONTROLLER_H */
@@ -0,0 +1,146 @@
+/*
+ * file: perf.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This file has the performance counters. They show how busy the main loop
+ * and the interrupts are so that overload can be seen on a running robot.
+ *
+ * Times are measured with Timer1 because it is never reset, so they are in
+ * Timer1 ticks (2us with the default prescaler). Each counter only takes a
+ * few instructions where it is counted. A read that starts in the PERF block
+ * copies the counters and sets them back to 0, so each read gives the worst
+ * case and the counts since the last read. The loop rate isn't cleared, it is
+ * the number of main loops in the last second.
+ */
+
+#include "parameters.h"
+
+//The counts, the i2c ones are changed by the low priority interrupt and the
+//others by the high priority interrupt or the main loop
+volatile unsigned int PerfLoopRate = 0;
+volatile unsigned int PerfMaxLoop = 0;
+volatile unsigned int PerfMaxISR = 0;
+volatile unsigned int PerfMaxI2C = 0;
+volatile unsigned int PerfTransactions = 0;
+volatile unsigned int PerfBusErrors = 0;
+//How late the pwm edges were, see CountEdgeLateness
+volatile unsigned int PerfEdgeLateness[4];
+
+//The main loop count for this second, and when the second and the last loop
+//started
+unsigned int PerfLoopCount = 0;
+unsigned int PerfSecondStart = 0;
+unsigned int PerfLoopStart = 0;
+
+/*
+ * This is called at the start of every main loop.
+ */
+void CountLoop(void) {
+    unsigned int now = TMR1;
+    unsigned int period = now - PerfLoopStart;
+    PerfLoopStart = now;
+    if (period > PerfMaxLoop) {
+        //This can be cleared by the i2c interrupt
+        di();
+        PerfMaxLoop = period;
+        ei();
+    }
+    if (PerfLoopCount != 0xFFFF) {
+        PerfLoopCount++;
+    }
+    if (ControlTickCount - PerfSecondStart >= CONTROL_TICK_HZ) {
+        PerfSecondStart += CONTROL_TICK_HZ;
+        di();
+        PerfLoopRate = PerfLoopCount;
+        ei();
+        PerfLoopCount = 0;
+    }
+}
+
+/*
+ * This is called from the high priority interrupt with the number of Timer1
+ * ticks it took.
+ */
+void CountISR(unsigned int ticks) {
+    if (ticks > PerfMaxISR) {
+        PerfMaxISR = ticks;
+    }
+}
+
+/*
+ * This is called from the low priority interrupt with the number of Timer1
+ * ticks it took. The clock is held low for most of it.
+ */
+void CountI2C(unsigned int ticks) {
+    if (ticks > PerfMaxI2C) {
+        PerfMaxI2C = ticks;
+    }
+}
+
+/*
+ * This is called for every pwm edge with the number of Timer1 ticks between
+ * when it was due and when it was done. The edges are counted as under 4
+ * ticks late, under 16, under 64 and 64 or more. Most edges should be in the
+ * first, the time it takes to get into the interrupt is about 2 ticks.
+ */
+void CountEdgeLateness(unsigned int ticks) {
+    unsigned char bin;
+    if (ticks < 4) {
+        bin = 0;
+    } else if (ticks < 16) {
+        bin = 1;
+    } else if (ticks < 64) {
+        bin = 2;
+    } else {
+        bin = 3;
+    }
+    if (PerfEdgeLateness[bin] != 0xFFFF) {
+        PerfEdgeLateness[bin]++;
+    }
+}
+
+/*
+ * This copies a counter into the latch and sets it back to 0. The counter can
+ * be changed by the high priority interrupt so it is held off while this is
+ * done.
+ */
+void LatchCounter(unsigned char index, volatile unsigned int *counter, unsigned char clear) {
+    unsigned int value;
+    di();
+    value = *counter;
+    if (clear) {
+        *counter = 0;
+    }
+    ei();
+    ReadLatch[index] = (unsigned char)value;
+    ReadLatch[index + 1] = (unsigned char)(value >> 8);
+}
+
+/*
+ * This is called from the i2c interrupt when a read starts in the PERF block.
+ */
+void LatchPerformance(void) {
+    unsigned char n;
+    LatchCounter(0, &PerfLoopRate, 0);
+    LatchCounter(2, &PerfMaxLoop, 1);
+    LatchCounter(4, &PerfMaxISR, 1);
+    LatchCounter(6, &PerfMaxI2C, 1);
+    LatchCounter(8, &PerfTransactions, 1);
+    LatchCounter(10, &PerfBusErrors, 1);
+    for (n = 0; n < 4; n++) {
+        LatchCounter(12 + 2 * n, &PerfEdgeLateness[n], 1);
+    }
+}
@@ -0,0 +1,214 @@
+/*
+ * file: profile.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This file has the configuration profiles. A profile is the configuration of
+ * each motor (the fields in ProfileFields) and the i2c settings, kept in one of
+ * the PROFILE_SLOTS slots in the EEPROM. The last profile that was saved or
+ * loaded is loaded at start up, so the controller is ready without the host
+ * having to send the configuration again.
+ *
+ * Each slot starts with a marker and ends with a checksum that makes the sum
+ * of the data and the checksum 0, a slot that doesn't have both is not
+ * loaded. A save writes one byte each time the EEPROM is ready so the main
+ * loop isn't held up for the 4ms each byte takes. The marker is cleared first
+ * and written last so a save that is cut off by a reset leaves an empty slot
+ * instead of a broken one.
+ */
+
+#include "parameters.h"
+
+//The number of bytes in a profile for each motor, and in the whole profile
+//(the motors, then the i2c address, mask and general call)
+#define PROFILE_MOTOR_BYTES 8
+#define PROFILE_DATA_BYTES (4 * PROFILE_MOTOR_BYTES + 3)
+
+//The fields of motor 0 that are kept, the field for motor n is n structs after
+//it, the same as the register table
+unsigned char * const ProfileFields[PROFILE_MOTOR_BYTES] = {
+    &Motors[0].motorType,
+    &Motors[0].accelType,
+    &Motors[0].accelRate,
+    &Motors[0].accelCurve,
+    &Motors[0].minimumDuty,
+    &Motors[0].brakeMode,
+    &Motors[0].brakeTime,
+    &Motors[0].deadTime
+};
+
+//The register values, see PROFILE_ADDRESS
+unsigned char ProfileCommand = 0;
+unsigned char ProfileStatus = PROFILE_READY;
+unsigned char ProfileSlot = 0;
+
+//The slot being saved, the next step of the save (0 when there isn't one) and
+//the sum of the data written so far
+unsigned char ProfileSaveSlot = 0;
+unsigned char ProfileSaveStep = 0;
+unsigned char ProfileSaveSum = 0;
+
+/*
+ * This gives the address of the first byte of a slot in the EEPROM.
+ */
+unsigned char ProfileAddress(unsigned char slot) {
+    return (unsigned char)(EEPROM_PROFILES + slot * PROFILE_SLOT_BYTES);
+}
+
+/*
+ * This gives byte n of the profile from the live configuration.
+ */
+unsigned char ProfileByte(unsigned char n) {
+    if (n == 4 * PROFILE_MOTOR_BYTES) {
+        return I2CAddress;
+    } else if (n == 4 * PROFILE_MOTOR_BYTES + 1) {
+        return I2CMask;
+    } else if (n == 4 * PROFILE_MOTOR_BYTES + 2) {
+        return I2CGeneralCall;
+    }
+    return ProfileFields[n % PROFILE_MOTOR_BYTES][(n / PROFILE_MOTOR_BYTES) * sizeof(struct Motor)];
+}
+
+/*
+ * This sets byte n of the profile in the live configuration.
+ */
+void SetProfileByte(unsigned char n, unsigned char value) {
+    if (n == 4 * PROFILE_MOTOR_BYTES) {
+        //Don't use an address that is reserved by the i2c spec
+        if (value >= 0x08 && value <= 0x77) {
+            I2CAddress = value;
+        }
+        return;
+    } else if (n == 4 * PROFILE_MOTOR_BYTES + 1) {
+        I2CMask = value;
+        return;
+    } else if (n == 4 * PROFILE_MOTOR_BYTES + 2) {
+        I2CGeneralCall = value & 1;
+        return;
+    }
+    ProfileFields[n % PROFILE_MOTOR_BYTES][(n / PROFILE_MOTOR_BYTES) * sizeof(struct Motor)] = value;
+}
+
+/*
+ * This loads the profile in a slot. It gives 0 and leaves the configuration
+ * alone if the slot doesn't have a whole profile in it.
+ */
+unsigned char LoadProfile(unsigned char slot) {
+    unsigned char address = ProfileAddress(slot);
+    unsigned char n, sum;
+    if (EEPROMRead(address) != EEPROM_PROFILE_MARKER) {
+        return 0;
+    }
+    sum = 0;
+    for (n = 0; n <= PROFILE_DATA_BYTES; n++) {
+        sum += EEPROMRead(address + 1 + n);
+    }
+    if (sum != 0) {
+        return 0;
+    }
+    for (n = 0; n < PROFILE_DATA_BYTES; n++) {
+        SetProfileByte(n, EEPROMRead(address + 1 + n));
+    }
+    return 1;
+}
+
+/*
+ * This is called once at start up after InitPWM has set the defaults.
+ */
+void LoadBootProfile(void) {
+    unsigned char slot = EEPROMRead(EEPROM_BOOT_PROFILE);
+    if (slot < PROFILE_SLOTS && LoadProfile(slot)) {
+        ProfileSlot = slot;
+    }
+}
+
+/*
+ * This writes the next byte of a save if the EEPROM is ready for it.
+ */
+void RunProfileSave(void) {
+    unsigned char address = ProfileAddress(ProfileSaveSlot);
+    unsigned char value;
+    if (EECON1bits.WR) {
+        return;
+    }
+    if (ProfileSaveStep == 1) {
+        //Clear the marker first
+        EEPROMWrite(address, 0xFF);
+        ProfileSaveSum = 0;
+    } else if (ProfileSaveStep <= PROFILE_DATA_BYTES + 1) {
+        //The data is summed as it is written so the checksum matches what is
+        //in the EEPROM even if the configuration changes during the save
+        value = ProfileByte(ProfileSaveStep - 2);
+        ProfileSaveSum += value;
+        EEPROMWrite(address + ProfileSaveStep - 1, value);
+    } else if (ProfileSaveStep == PROFILE_DATA_BYTES + 2) {
+        EEPROMWrite(address + PROFILE_DATA_BYTES + 1, (unsigned char)(0 - ProfileSaveSum));
+    } else if (ProfileSaveStep == PROFILE_DATA_BYTES + 3) {
+        EEPROMWrite(address, EEPROM_PROFILE_MARKER);
+    } else {
+        //The saved profile is the one that is loaded at start up
+        EEPROMWrite(EEPROM_BOOT_PROFILE, ProfileSaveSlot);
+        ProfileSaveStep = 0;
+        ProfileStatus = PROFILE_READY;
+        return;
+    }
+    ProfileSaveStep++;
+}
+
+/*
+ * This is called every time around the main loop. It carries on with a save
+ * and does the command written to PROFILE_ADDRESS once any save has finished.
+ */
+void RunProfile(void) {
+    unsigned char command, n;
+    if (ProfileSaveStep) {
+        RunProfileSave();
+        return;
+    }
+    command = ProfileCommand;
+    ProfileCommand = 0;
+    if (command == PROFILE_SAVE) {
+        ProfileSaveSlot = ProfileSlot & (PROFILE_SLOTS - 1);
+        ProfileSaveStep = 1;
+        ProfileStatus = PROFILE_BUSY;
+    } else if (command == PROFILE_LOAD) {
+        if (LoadProfile(ProfileSlot & (PROFILE_SLOTS - 1))) {
+            EEPROMWrite(EEPROM_BOOT_PROFILE, ProfileSlot & (PROFILE_SLOTS - 1));
+            ProfileStatus = PROFILE_READY;
+        } else {
+            ProfileStatus = PROFILE_BAD;
+        }
+    } else if (command == PROFILE_RESET) {
+        for (n = 0; n < 4; n++) {
+            DefaultMotorConfig(n);
+        }
+        I2CAddress = I2C_ADDRESS;
+        I2CMask = I2C_MASK;
+        I2CGeneralCall = 0;
+        //Start up with the defaults too, the slots are kept
+        EEPROMWrite(EEPROM_BOOT_PROFILE, 0xFF);
+        ProfileStatus = PROFILE_READY;
+    } else {
+        return;
+    }
+    //The shadow values have to match the new configuration, a motor that is
+    //now a stepper loses its encoder and the i2c settings are used from the
+    //next transaction
+    if (command != PROFILE_SAVE) {
+        LoadShadow();
+        ConfigureEncoders();
+        ConfigureI2C();
+    }
+}
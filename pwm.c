@@ -23,167 +23,737 @@
 #include "parameters.h"
 
 /*
- * This helper function lets you name a pin and set it as high (1) or low (0)
+ * The pins are numbered 0 to 11, these tables give the port and the bit in the
+ * port for each pin number.
+ * 0-7 are RC0-RC7, 8 is RB5, 9 is RB7, 10 is RA4 and 11 is RA5
  */
-void SetPin(char pin, char value) {
-    switch (pin) {
-        case 0:
-            LATCbits.LC0 = value;
-            break;
-        case 1:
-            LATCbits.LC1 = value;
-            break;
-        case 2:
-            LATCbits.LC2 = value;
-            break;
-        case 3:
-            LATCbits.LC3 = value;
-            break;
-        case 4:
-            LATCbits.LC4 = value;
-            break;
-        case 5:
-            LATCbits.LC5 = value;
-            break;
-        case 6:
-            LATCbits.LC6 = value;
-            break;
-        case 7:
-            LATCbits.LC7 = value;
-            break;
-        case 8:
-            LATBbits.LB5 = value;
-            break;
-        case 9:
-            LATBbits.LB7 = value;
-            break;
-        case 10:
-            LATAbits.LA4 = value;
-            break;
-        case 11:
-            LATAbits.LA5 = value;
-            break;
+const unsigned char PinPort[12] = {
+    PORT_C, PORT_C, PORT_C, PORT_C, PORT_C, PORT_C, PORT_C, PORT_C,
+    PORT_B, PORT_B, PORT_A, PORT_A
+};
+const unsigned char PinMask[12] = {
+    0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+    0x20, 0x80, 0x10, 0x20
+};
+
+/*
+ * The pwm, dir and cdir pin numbers of each motor, see PinPort. The pins are
+ * picked so that the output on the physical chip makes sense and is
+ * consistent across each output.
+ */
+const struct MotorPinNumbers MotorPinNumbers[4] = {
+    {0, 1, 2},
+    {5, 4, 3},
+    {6, 7, 9},
+    {11, 10, 8}
+};
+
+/*
+ * The pwm pins of each set of motors as a mask for each port, bit n of the
+ * index is motor n. Pins that change at the same time are written together
+ * with one write to each of LATA, LATB and LATC, so the edge tables only keep
+ * the motors. These have to be the pwm pins in MotorPinNumbers: RC0, RC5, RC6
+ * and RA5. The direction pins are only changed from the main loop,
+ * SetDirectionPins builds their masks when it needs them.
+ */
+#define PWM_PINS(m) { \
+    (m) & 8 ? 0x20 : 0, \
+    0, \
+    ((m) & 1 ? 0x01 : 0) | ((m) & 2 ? 0x20 : 0) | ((m) & 4 ? 0x40 : 0) \
+}
+const unsigned char PWMPins[16][3] = {
+    PWM_PINS(0), PWM_PINS(1), PWM_PINS(2), PWM_PINS(3),
+    PWM_PINS(4), PWM_PINS(5), PWM_PINS(6), PWM_PINS(7),
+    PWM_PINS(8), PWM_PINS(9), PWM_PINS(10), PWM_PINS(11),
+    PWM_PINS(12), PWM_PINS(13), PWM_PINS(14), PWM_PINS(15)
+};
+//The motors whose cdir pin is an encoder input, it is never driven
+unsigned char CdirInputs = 0;
+
+/*
+ * This sets CdirInputs from the pins on each port that are being used as
+ * encoder inputs.
+ */
+void SetCdirInputs(const unsigned char *inputs) {
+    unsigned int i;
+    unsigned char cdir;
+    CdirInputs = 0;
+    for (i = 0; i < 4; i++) {
+        cdir = MotorPinNumbers[i].cdir;
+        if (inputs[PinPort[cdir]] & PinMask[cdir]) {
+            CdirInputs |= (unsigned char)(1 << i);
+        }
+    }
+}
+
+/*
+ * A motor that is changing direction goes through these states instead of
+ * slowing down with the acceleration profile, see StartBrake. The brake window
+ * uses the state with the same number as its brake mode.
+ */
+#define BRAKE_STATE_NONE 0
+#define BRAKE_STATE_COAST BRAKE_COAST
+#define BRAKE_STATE_SHORT BRAKE_SHORT
+#define BRAKE_STATE_PLUG BRAKE_PLUG
+#define BRAKE_STATE_DEAD 4
+
+/*
+ * This sets the dir and cdir pins for every motor in motors to match their
+ * direction, all of the pins are written at once. A motor that is being
+ * shorted has both pins high.
+ * Interrupts are held off while the ports are written so that a PWM edge can't
+ * happen between reading and writing a port and get lost.
+ */
+void SetDirectionPins(unsigned char motors) {
+    unsigned char set[3] = {0, 0, 0};
+    unsigned char clear[3] = {0, 0, 0};
+    unsigned char n, dir, cdir;
+    for (n = 0; n < 4; n++) {
+        if (motors & (1 << n)) {
+            dir = MotorPinNumbers[n].dir;
+            cdir = MotorPinNumbers[n].cdir;
+            if (Motors[n].brakeState == BRAKE_STATE_SHORT) {
+                set[PinPort[dir]] |= PinMask[dir];
+                set[PinPort[cdir]] |= PinMask[cdir];
+            } else if (Motors[n].direction) {
+                set[PinPort[dir]] |= PinMask[dir];
+                clear[PinPort[cdir]] |= PinMask[cdir];
+            } else {
+                set[PinPort[cdir]] |= PinMask[cdir];
+                clear[PinPort[dir]] |= PinMask[dir];
+            }
+            //An encoder input isn't driven
+            if (CdirInputs & (1 << n)) {
+                set[PinPort[cdir]] &= (unsigned char)~PinMask[cdir];
+                clear[PinPort[cdir]] &= (unsigned char)~PinMask[cdir];
+            }
+        }
     }
+    di();
+    LATA = (LATA & ~clear[PORT_A]) | set[PORT_A];
+    LATB = (LATB & ~clear[PORT_B]) | set[PORT_B];
+    LATC = (LATC & ~clear[PORT_C]) | set[PORT_C];
+    ei();
 }
 
 /*
- * This sets up Timer0 to be used by the pwm modules.
+ * The PWM is generated from a table of edges instead of polling a timer. Every
+ * motor that has a pulse goes high at the start of the period and low at the
+ * edge for its duty. The falling edges are kept sorted so that the CCP1 compare
+ * interrupt only has to fire at the next edge in the table, motors with the
+ * same duty share an edge.
+ *
+ * There are two tables. The main loop builds the table for the next period in
+ * the one that isn't being used and sets PWMTableReady, the interrupt swaps to
+ * it at the start of the next period. This way the interrupt never sees a half
+ * built table.
+ */
+struct PWMEdgeTable {
+    //The length of the period in Timer1 ticks and the Timer1 prescaler, these
+    //are changed at the start of the period that uses the table
+    unsigned int period;
+    unsigned char prescale;
+    //The motors whose pins go high at the start of the period
+    unsigned char start;
+    //The number of falling edges in the table
+    unsigned char count;
+    struct PWMEdge edges[4];
+};
+
+struct PWMEdgeTable PWMTables[2];
+//The table being used by the interrupt
+volatile unsigned char PWMActiveTable = 0;
+//This is set when the other table has been built and is waiting to be used
+volatile unsigned char PWMTableReady = 0;
+//The next edge in the active table, when it is equal to count the next
+//interrupt is the start of a new period
+unsigned char PWMEdgeIndex = 0;
+//The value of Timer1 at the start of the current period
+unsigned int PWMPeriodStart = 0;
+//When the next pwm edge or the start of the next period is due
+unsigned int PWMNextTime = PWM_PERIOD_TICKS;
+//The period from PWMConfig after it has been checked, the next table that is
+//built uses it
+unsigned int PWMPeriodTicks = PWM_PERIOD_TICKS;
+//The last PWMConfig that was saved in the EEPROM, or is being saved
+struct PWMConfig SavedPWMConfig;
+//The next step of saving SavedPWMConfig, 0 when there isn't a save
+unsigned char PWMConfigSaveStep = 0;
+
+/*
+ * This makes sure that the period and prescaler in PWMConfig are usable, they
+ * are changed to the nearest usable values if they aren't. If they are
+ * different to the saved ones a save is started, RunPWMConfigSave does it.
+ * This is called after the i2c registers are committed.
+ */
+void CheckPWMConfig(void) {
+    unsigned int period = ((unsigned int)PWMConfig.periodHigh << 8) | PWMConfig.periodLow;
+    unsigned int minimum;
+    PWMConfig.prescale &= 0b00000011;
+    //Each tick is 2^prescale instruction cycles
+    minimum = PWM_MINIMUM_PERIOD_CYCLES >> PWMConfig.prescale;
+    if (period < minimum) {
+        period = minimum;
+    } else if (period > PWM_MAXIMUM_PERIOD_TICKS) {
+        period = PWM_MAXIMUM_PERIOD_TICKS;
+    }
+    PWMConfig.periodLow = (unsigned char)period;
+    PWMConfig.periodHigh = (unsigned char)(period >> 8);
+    PWMPeriodTicks = period;
+    if (PWMConfig.periodLow != SavedPWMConfig.periodLow ||
+            PWMConfig.periodHigh != SavedPWMConfig.periodHigh ||
+            PWMConfig.prescale != SavedPWMConfig.prescale) {
+        //A save that is already going starts again with the new values
+        SavedPWMConfig = PWMConfig;
+        PWMConfigSaveStep = 1;
+    }
+}
+
+/*
+ * This is called every time around the main loop. It writes the next byte of
+ * a save if the EEPROM is ready for it, the same as RunProfileSave, so a save
+ * doesn't hold up the main loop. The marker is cleared first and written last
+ * so a save that is cut off by a reset leaves the defaults to be used.
+ */
+void RunPWMConfigSave(void) {
+    if (PWMConfigSaveStep == 0 || EECON1bits.WR) {
+        return;
+    }
+    if (PWMConfigSaveStep == 1) {
+        EEPROMWrite(EEPROM_PWM_CONFIG, 0xFF);
+    } else if (PWMConfigSaveStep == 2) {
+        EEPROMWrite(EEPROM_PWM_CONFIG + 1, SavedPWMConfig.periodLow);
+    } else if (PWMConfigSaveStep == 3) {
+        EEPROMWrite(EEPROM_PWM_CONFIG + 2, SavedPWMConfig.periodHigh);
+    } else if (PWMConfigSaveStep == 4) {
+        EEPROMWrite(EEPROM_PWM_CONFIG + 3, SavedPWMConfig.prescale);
+    } else {
+        EEPROMWrite(EEPROM_PWM_CONFIG, EEPROM_PWM_CONFIG_MARKER);
+        PWMConfigSaveStep = 0;
+        return;
+    }
+    PWMConfigSaveStep++;
+}
+
+/*
+ * This gets the period and prescaler from the EEPROM if they have been saved,
+ * otherwise the defaults are kept.
+ */
+void LoadPWMConfig(void) {
+    if (EEPROMRead(EEPROM_PWM_CONFIG) == EEPROM_PWM_CONFIG_MARKER) {
+        PWMConfig.periodLow = EEPROMRead(EEPROM_PWM_CONFIG + 1);
+        PWMConfig.periodHigh = EEPROMRead(EEPROM_PWM_CONFIG + 2);
+        PWMConfig.prescale = EEPROMRead(EEPROM_PWM_CONFIG + 3);
+        SavedPWMConfig = PWMConfig;
+    } else {
+        //Nothing saved yet, CheckPWMConfig will save the defaults
+        SavedPWMConfig.prescale = 0xFF;
+    }
+    CheckPWMConfig();
+}
+
+/*
+ * This sets the parts of a motor's configuration that are kept in the profiles
+ * to their defaults, see profile.c.
+ */
+void DefaultMotorConfig(unsigned int index) {
+    Motors[index].motorType = (unsigned char)MOTOR_TYPE_DC;
+    Motors[index].accelType = (unsigned char)ACCEL_INSTANT;
+    Motors[index].accelRate = (unsigned char)1;
+    Motors[index].accelCurve = (unsigned char)1;
+    Motors[index].minimumDuty = (unsigned char)0;
+    Motors[index].brakeMode = (unsigned char)BRAKE_RAMP;
+    Motors[index].brakeTime = (unsigned char)20;
+    Motors[index].deadTime = (unsigned char)1;
+}
+
+/*
+ * This sets up Timer1 and CCP1 to be used by the pwm.
  * It also initialises the Motors array that holds the structs for the state of
  * each motor
  */
 void InitPWM(void) {
-    //Use a 1:16 prescaler value
-    //T0CONbits.T0PS = 0b011;
-    //USE a 1:256 prescaler value
-    T0CONbits.T0PS = 0b111;
-    //Use prescaler
-    T0CONbits.PSA = 0;
+    LoadPWMConfig();
+    //By default this is a 1:8 prescaler value, so Timer1 counts every 2us
+    T1CONbits.T1CKPS = PWMConfig.prescale;
     //Use internal instruction clock
-    T0CONbits.T0CS = 0;
-    //Make Timer0 a 16 bit counter
-    //T0CONbits.T08BIT = 0;
-    //Make Timer0 a 8 bit counter
-    T0CONbits.T08BIT = 1;
-    //Turn on Timer0
-    T0CONbits.TMR0ON = 1;
+    T1CONbits.TMR1CS = 0;
+    //Read and write Timer1 as one 16 bit value
+    T1CONbits.RD16 = 1;
+    //Compare mode, only generate an interrupt on a match. The CCP1 pin is
+    //left alone because it is used by motor 1.
+    CCP1CONbits.CCP1M = 0b1010;
+    //Timer1 is never reset, the edges are scheduled from the start of each
+    //period and wrap around with Timer1.
+    TMR1 = 0;
+    PWMPeriodStart = 0;
+    PWMEdgeIndex = 0;
+    //Both tables start empty, so the first interrupt is the start of a period
+    PWMTables[0].period = PWMPeriodTicks;
+    PWMTables[0].prescale = PWMConfig.prescale;
+    PWMTables[1] = PWMTables[0];
+    PWMNextTime = PWMPeriodTicks;
+    CCPR1 = PWMPeriodTicks;
+    PIR1bits.CCP1IF = 0;
+    PIE1bits.CCP1IE = 1;
+    //Turn on Timer1
+    T1CONbits.TMR1ON = 1;
     
     //Initialise all the motor structs
     unsigned int n;
     for (n = 0; n < 4; n++) {
-        Motors[n].state = (unsigned char)0;
         Motors[n].enabled = (unsigned char)1;
         Motors[n].paused = (unsigned char)0;
         Motors[n].direction = (unsigned char)1;
         Motors[n].targetDirection = (unsigned char)1;
-        Motors[n].motorType = (unsigned char)0;
         Motors[n].duty = (unsigned char)0;
         Motors[n].target = (unsigned char)0;
-        Motors[n].servoCount = (unsigned char)0;
-        Motors[n].accelType = (unsigned char)0;
-        Motors[n].accelRate = (unsigned char)1;
-        Motors[n].minimumDuty = (unsigned char)0;
+        Motors[n].targetFraction = (unsigned char)0;
+        Motors[n].pidKp = (unsigned char)32;
+        Motors[n].pidKi = (unsigned char)4;
+        Motors[n].pidKd = (unsigned char)0;
+        Motors[n].state.drive.encoderLast = 0;
+        Motors[n].state.drive.lastSpeed = 0;
+        Motors[n].state.drive.pidIntegral = 0;
+        Motors[n].state.drive.moveGoal = 0;
+        Motors[n].state.drive.moveLast = 0;
+        Motors[n].state.drive.moveBraking = (unsigned char)0;
+        Motors[n].brakeState = (unsigned char)BRAKE_STATE_NONE;
+        Motors[n].brakeTicks = (unsigned char)0;
+        Motors[n].brakeDirection = (unsigned char)0;
+        Motors[n].accelStep = (unsigned char)1;
+        Motors[n].accelStepFraction = (unsigned char)0;
+        Motors[n].maxAccel = (unsigned char)16;
+        Motors[n].jerk = (unsigned char)2;
+        Motors[n].dutyFraction = (unsigned char)0;
+        Motors[n].state.drive.velocity = 0;
+        Motors[n].state.drive.acceleration = 0;
         Motors[n].accelCount = (unsigned char)0;
+        DefaultMotorConfig(n);
     }
+    InitQueues();
     
-    //Set which pins each motor uses, look at SetPin for definitions
-    //The pins are picked so that the output on the physical chip makes sense
-    //and is consistent across each output.
-    Motors[0].PWMPin = 0;
-    Motors[0].dirPin = 1;
-    Motors[0].cdirPin = 2;
-    
-    Motors[1].PWMPin = 5;
-    Motors[1].dirPin = 4;
-    Motors[1].cdirPin = 3;
-    
-    Motors[2].PWMPin = 6;
-    Motors[2].dirPin = 7;
-    Motors[2].cdirPin = 9;
-    
-    Motors[3].PWMPin = 11;
-    Motors[3].dirPin = 10;
-    Motors[3].cdirPin = 8;
+    //There are no encoder inputs yet
+    const unsigned char inputs[3] = {0, 0, 0};
+    SetCdirInputs(inputs);
     
     //Set initial direction on the pins
-    unsigned int i;
-    for (i = 0; i < 4; i++) {
-        SetPin(Motors[i].dirPin,HIGH);
-        SetPin(Motors[i].cdirPin,LOW);
-    }
+    SetDirectionPins(0b1111);
 }
 
 /*
- * This function takes the current value and the minimum duty cycle as inputs 
- * and returns the rate of change at that point for the exponential growth or 
+ * This function takes the current value and the target value as inputs and
+ * returns the rate of change at that point for the exponential growth or
  * decay.
- * It isn't a very accurate curve, it should be updated. And maybe more segments
- * added.
- * It has different checks for growing and decaying because the check itself
- * is only based on the current value.
+ * The distance to the target shrinks by the same fraction every step, the step
+ * sizes come from the tables in exponential.c and the motor's accelCurve picks
+ * the time constant. The tables never give a step bigger than the distance so
+ * the target is never overshot.
  */
-char ExponentialProfile(unsigned char current, unsigned char target, unsigned int index) {
-    unsigned char change = 0;
+unsigned char ExponentialProfile(unsigned char current, unsigned char target, unsigned int index) {
+    unsigned char distance;
     if (current > target) {
-        //decay
-        if (current-Motors[index].minimumDuty > 200) {
-            change = 50;
-        } else if (current-Motors[index].minimumDuty > 150) {
-            change = 25;
-        } else if (current-Motors[index].minimumDuty > 100) {
-            change = 20;
-        } else if (current-Motors[index].minimumDuty > 75) {
-            change = 10;
-        } else if (current-Motors[index].minimumDuty > 50) {
-            change = 5;
+        distance = current - target;
+    } else {
+        distance = target - current;
+    }
+    return ExponentialSteps[Motors[index].accelCurve & (EXPONENTIAL_CURVES - 1)][distance];
+}
+
+/*
+ * The duty is kept in fixed point with 8 fractional bits so that ramps can
+ * move by less than one step of duty each time and the pwm can be finer than
+ * 256 steps. The registers and the status block only show the whole part
+ * (duty), dutyFraction is below it.
+ */
+unsigned int DutyPosition(unsigned int index) {
+    return ((unsigned int)Motors[index].duty << 8) | Motors[index].dutyFraction;
+}
+
+/*
+ * This is the target in the same fixed point as DutyPosition.
+ */
+unsigned int TargetPosition(unsigned int index) {
+    if (Motors[index].target == 0) {
+        return 0;
+    }
+    return ((unsigned int)Motors[index].target << 8) | Motors[index].targetFraction;
+}
+
+void SetDutyPosition(unsigned int index, unsigned int position) {
+    Motors[index].duty = (unsigned char)(position >> 8);
+    Motors[index].dutyFraction = (unsigned char)position;
+}
+
+/*
+ * This gives a position (or speed) with the sign from a direction, so that
+ * moves that change direction can go through 0 instead of stopping there.
+ */
+long SignedPosition(unsigned int position, unsigned char direction) {
+    return direction ? (long)position : -(long)position;
+}
+
+/*
+ * This is one step of the linear acceleration profile. The duty moves towards
+ * goal by accelStep.accelStepFraction each step, stopping on the goal. The goal
+ * is in the same fixed point as DutyPosition.
+ */
+void LinearProfile(unsigned int index, unsigned int goal) {
+    unsigned int position = DutyPosition(index);
+    unsigned int step = ((unsigned int)Motors[index].accelStep << 8) | Motors[index].accelStepFraction;
+    if (position < goal) {
+        position = (goal - position > step) ? position + step : goal;
+    } else {
+        position = (position - goal > step) ? position - step : goal;
+    }
+    SetDutyPosition(index, position);
+}
+
+/*
+ * This is one step of the S-curve acceleration profile. It moves the duty
+ * towards goal with the acceleration limited to maxAccel and the change in
+ * acceleration (the jerk) limited to jerk, so the acceleration ramps up and
+ * down instead of starting and stopping all at once.
+ *
+ * Everything is in fixed point with 8 fractional bits. The position is the
+ * duty from DutyPosition, velocity is in 1/256 duty per step and
+ * acceleration, maxAccel and jerk are in 1/256 duty per step per step. The
+ * sums are done along the direction of the goal, so a speed or acceleration
+ * below 0 is away from it.
+ *
+ * Each step it looks at where the motor would be if it sped up for one more
+ * step and starts slowing down if it couldn't stop from there. If it is still
+ * speeding up the acceleration has to come back to 0 first, which takes
+ * acceleration/jerk steps and adds some more speed. From there it needs
+ * v^2/(2*maxAccel) plus v*maxAccel/(2*jerk) for the acceleration to ramp down
+ * and back up, and one more step of travel because the speed only changes
+ * once per step. This is never less than it takes so it stops short and
+ * creeps the rest of the way, it is checked with multiplications only so the
+ * only divisions in the step are 8 bit ones.
+ *
+ * While it slows down the braking is eased off once the speed left is what
+ * the braking takes away while it ramps back to 0, so the acceleration gets
+ * to 0 when the speed does, and it stops at a speed of 0 instead of turning
+ * around as long as that is within the jerk. The only step that breaks the
+ * jerk limit is the last one, when the motor is less than one duty from the
+ * goal and slow enough to stop there.
+ */
+void SCurveProfile(unsigned int index, unsigned int goal) {
+    unsigned int position = DutyPosition(index);
+    unsigned char maxAccel = Motors[index].maxAccel;
+    unsigned char jerk = Motors[index].jerk;
+    unsigned char turnSteps = 0;
+    unsigned char steps;
+    unsigned long distance, peak, rampDistance = 0, shed;
+    int speed, along, lastAlong, wanted, nextAlong;
+    long next;
+    
+    if (position < goal) {
+        distance = goal - position;
+        speed = Motors[index].state.drive.velocity;
+        along = Motors[index].state.drive.acceleration;
+    } else {
+        distance = position - goal;
+        speed = -Motors[index].state.drive.velocity;
+        along = -Motors[index].state.drive.acceleration;
+    }
+    
+    //The acceleration and the speed after one more step of speeding up
+    nextAlong = jerk ? along + jerk : (int)maxAccel;
+    if (nextAlong > (int)maxAccel) {
+        nextAlong = maxAccel;
+    }
+    peak = (unsigned long)((long)speed + nextAlong);
+    
+    //Pick the acceleration that we want, slow down if we are moving towards
+    //the target and couldn't stop after that step.
+    wanted = maxAccel;
+    if (speed > 0) {
+        if (peak >= distance) {
+            wanted = -(int)maxAccel;
         } else {
-            change = 1;
+            distance -= peak;
+            if (jerk) {
+                turnSteps = (unsigned char)((maxAccel + jerk - 1) / jerk);
+                if (nextAlong > 0) {
+                    //The speed and distance gained while the acceleration
+                    //comes back down to 0
+                    steps = (unsigned char)((nextAlong + jerk - 1) / jerk);
+                    rampDistance = peak * steps;
+                    peak += (unsigned long)nextAlong * steps / 2;
+                    rampDistance = (rampDistance + peak * steps) / 2;
+                }
+            }
+            if (2 * (unsigned long)maxAccel * (distance - (rampDistance < distance ? rampDistance : distance)) <=
+                    peak * peak + (unsigned long)maxAccel * peak * (turnSteps + 2)) {
+                wanted = -(int)maxAccel;
+            }
         }
-        //make sure that the change doesn't bring the speed lower than the 
-        //target
-        if (current-target < change) {
-            change = (unsigned) current-target;
+    }
+    
+    //Ease off the braking once the speed is down to what ramping the
+    //acceleration back to 0 takes off, (-along - jerk) + (-along - 2 * jerk)
+    //and so on
+    if (wanted < 0 && along < 0 && speed > 0 && jerk) {
+        steps = (unsigned char)((-along - 1) / jerk);
+        shed = (unsigned long)(-along) * steps - (unsigned long)jerk * steps * (steps + 1) / 2;
+        if ((unsigned long)speed < (unsigned long)(-along) + shed) {
+            wanted = 0;
         }
-    } else {
-        //growth
-        if (current-Motors[index].minimumDuty > 200) {
-            change = (unsigned) current-target;
-        } else if (current-Motors[index].minimumDuty > 150) {
-            change = 25;
-        } else if (current-Motors[index].minimumDuty > 100) {
-            change = 20;
-        } else if (current-Motors[index].minimumDuty > 75) {
-            change = 10;
-        } else if (current-Motors[index].minimumDuty > 50) {
-            change = 5;
-        } else {
-            change = 1;
+    }
+    
+    //Move the acceleration towards that by at most jerk, with jerk 0 the
+    //acceleration changes straight away.
+    lastAlong = along;
+    if (jerk == 0) {
+        along = wanted;
+    } else if (along < wanted) {
+        along += jerk;
+        if (along > wanted) {
+            along = wanted;
         }
-        //Make sure that the change doesn't overshoot the target value
-        if (target-current < change) {
-            change = (unsigned) target-current;
+    } else if (along > wanted) {
+        along -= jerk;
+        if (along < wanted) {
+            along = wanted;
+        }
+    }
+    if (wanted < 0 && speed > 0 && speed + along < 0) {
+        //Slowing down stops the motor instead of turning it around
+        along = -speed;
+        if (jerk && along > lastAlong + jerk) {
+            along = lastAlong + jerk;
         }
     }
-    return change;
+    speed += along;
+    //From here they are the velocity and the acceleration again
+    if (position > goal) {
+        speed = -speed;
+        along = -along;
+    }
+    
+    next = (long)position + speed;
+    if ((position < goal && next >= (long)goal) || (position > goal && next <= (long)goal) || position == goal ||
+            (next - (long)goal < 256 && (long)goal - next < 256 && speed <= (int)maxAccel && speed >= -(int)maxAccel)) {
+        //We got to the target, or are less than one duty away and slow enough
+        //to stop there
+        next = goal;
+        speed = 0;
+        along = 0;
+    } else if (next < 0) {
+        next = 0;
+        speed = 0;
+        along = 0;
+    } else if (next > 0xFFFF) {
+        next = 0xFFFF;
+        speed = 0;
+        along = 0;
+    }
+    
+    SetDutyPosition(index, (unsigned int)next);
+    Motors[index].state.drive.velocity = speed;
+    Motors[index].state.drive.acceleration = along;
+}
+
+/*
+ * This clears the duty fraction, the S-curve state and the PID integral when the
+ * motor is stopped or jumps to a new duty. A motor in a synchronised move
+ * keeps its move, its state is in the same bytes.
+ */
+void ResetProfile(unsigned int index) {
+    Motors[index].dutyFraction = 0;
+    if (SyncMask & (1 << index)) {
+        return;
+    }
+    Motors[index].state.drive.velocity = 0;
+    Motors[index].state.drive.acceleration = 0;
+    Motors[index].state.drive.pidIntegral = 0;
+}
+
+/*
+ * This is one step of the PID speed control. The speed is the change in the
+ * encoder position since the last step, with 8 fractional bits to match the
+ * target. The output is the duty with the sign giving the direction, counts
+ * going up is direction 1. The derivative is taken from the speed instead of
+ * the error so that changing the target doesn't give the motor a kick.
+ */
+void PIDProfile(unsigned int index) {
+    long position = ReadEncoder(index);
+    int speed = (int)((unsigned int)position - Motors[index].state.drive.encoderLast);
+    long error, integral, change, output;
+    unsigned char direction;
+    Motors[index].state.drive.encoderLast = (unsigned int)position;
+    
+    error = SignedPosition(TargetPosition(index), Motors[index].targetDirection) - ((long)speed << 8);
+    if (error > PID_ERROR_LIMIT) {
+        error = PID_ERROR_LIMIT;
+    } else if (error < -PID_ERROR_LIMIT) {
+        error = -PID_ERROR_LIMIT;
+    }
+    change = (long)(speed - Motors[index].state.drive.lastSpeed) << 8;
+    if (change > PID_ERROR_LIMIT) {
+        change = PID_ERROR_LIMIT;
+    } else if (change < -PID_ERROR_LIMIT) {
+        change = -PID_ERROR_LIMIT;
+    }
+    Motors[index].state.drive.lastSpeed = speed;
+    integral = Motors[index].state.drive.pidIntegral + error;
+    if (integral > PID_INTEGRAL_LIMIT) {
+        integral = PID_INTEGRAL_LIMIT;
+    } else if (integral < -PID_INTEGRAL_LIMIT) {
+        integral = -PID_INTEGRAL_LIMIT;
+    }
+    
+    output = ((long)Motors[index].pidKp * error + (long)Motors[index].pidKi * integral -
+            (long)Motors[index].pidKd * change) >> PID_GAIN_SHIFT;
+    if (output > 0xFF00) {
+        output = 0xFF00;
+    } else if (output < -0xFF00) {
+        output = -0xFF00;
+    } else {
+        //Only keep the integral while the output isn't at its limit, otherwise
+        //it winds up and overshoots when the motor catches up
+        Motors[index].state.drive.pidIntegral = integral;
+    }
+    
+    if (output < 0) {
+        direction = 0;
+        output = -output;
+    } else if (output > 0) {
+        direction = 1;
+    } else {
+        direction = Motors[index].direction;
+    }
+    if (direction != Motors[index].direction) {
+        ReverseMotor(index, direction);
+        return;
+    }
+    SetDutyPosition(index, (unsigned int)output);
+}
+
+/*
+ * This starts the dead time before a change of direction, the motor changes to
+ * direction at the end of it. The pwm pin is held off until it is over, see
+ * OutputPosition.
+ *
+ * Waiting for a new table would leave the pin on for up to two more periods,
+ * so the pin is turned off now and taken out of the start of both tables.
+ */
+void StartDeadTime(unsigned int index, unsigned char direction) {
+    const unsigned char *pins = PWMPins[1 << index];
+    Motors[index].brakeState = BRAKE_STATE_DEAD;
+    Motors[index].brakeTicks = Motors[index].deadTime;
+    Motors[index].brakeDirection = direction;
+    di();
+    PWMTables[0].start &= (unsigned char)~(1 << index);
+    PWMTables[1].start &= (unsigned char)~(1 << index);
+    LATA &= (unsigned char)~pins[PORT_A];
+    LATB &= (unsigned char)~pins[PORT_B];
+    LATC &= (unsigned char)~pins[PORT_C];
+    ei();
+}
+
+/*
+ * This starts changing the direction of a motor that is moving to direction
+ * using its brake mode.
+ *  BRAKE_COAST and BRAKE_SHORT cut the duty to 0 and brake for brakeTime
+ *  control ticks, then there is the dead time and the direction changes.
+ *  BRAKE_PLUG starts with the dead time and keeps the duty, after the
+ *  direction changes the motor is driven at that duty for brakeTime control
+ *  ticks before the acceleration takes over again.
+ * The states are run by RunBrake on every control tick whatever accelRate is.
+ */
+void StartBrake(unsigned int index, unsigned char direction) {
+    unsigned char mode = Motors[index].brakeMode;
+    //Shorting the motor needs both direction pins
+    if (mode == BRAKE_SHORT && (CdirInputs & (1 << index))) {
+        mode = BRAKE_COAST;
+    }
+    switch (mode) {
+        case BRAKE_COAST:
+        case BRAKE_SHORT:
+            Motors[index].duty = 0;
+            ResetProfile(index);
+            Motors[index].brakeState = mode;
+            Motors[index].brakeTicks = Motors[index].brakeTime;
+            Motors[index].brakeDirection = direction;
+            SetDirectionPins((unsigned char)(1 << index));
+            break;
+        default:
+            StartDeadTime(index, direction);
+            break;
+    }
+}
+
+/*
+ * This is called every control tick for a motor that is braking or waiting
+ * for the dead time.
+ */
+void RunBrake(unsigned int index) {
+    if (Motors[index].brakeTicks) {
+        Motors[index].brakeTicks--;
+        return;
+    }
+    switch (Motors[index].brakeState) {
+        case BRAKE_STATE_COAST:
+        case BRAKE_STATE_SHORT:
+            StartDeadTime(index, Motors[index].brakeDirection);
+            //Stop shorting the motor
+            SetDirectionPins((unsigned char)(1 << index));
+            break;
+        case BRAKE_STATE_DEAD:
+            Motors[index].brakeState = BRAKE_STATE_NONE;
+            if (Motors[index].direction != Motors[index].brakeDirection) {
+                Motors[index].direction = Motors[index].brakeDirection;
+                SetDirectionPins((unsigned char)(1 << index));
+                //Only BRAKE_PLUG gets here with the duty still set
+                if (Motors[index].duty) {
+                    Motors[index].brakeState = BRAKE_STATE_PLUG;
+                    Motors[index].brakeTicks = Motors[index].brakeTime;
+                }
+                ResetProfile(index);
+            }
+            break;
+        default:
+            //The end of BRAKE_PLUG, the acceleration carries on from here
+            Motors[index].brakeState = BRAKE_STATE_NONE;
+            break;
+    }
+}
+
+/*
+ * This gives the duty that the pwm uses for a motor. It is the same as the
+ * duty except while a motor is being shorted, when the pwm pin is on for the
+ * whole period (BuildPWMEdges leaves out its falling edge), and during the
+ * dead time when it is off.
+ */
+unsigned int OutputPosition(unsigned int index) {
+    if (Motors[index].brakeState == BRAKE_STATE_SHORT) {
+        return 0xFFFF;
+    } else if (Motors[index].brakeState == BRAKE_STATE_DEAD) {
+        return 0;
+    }
+    return DutyPosition(index);
+}
+
+/*
+ * This changes the direction of a motor that the PID or a synchronised move is
+ * driving, their output can go from one direction to the other between two
+ * control ticks. The change goes through the brake mode and the dead time the
+ * same as a change of targetDirection does in AcceleratePWM, so the driver
+ * never has the direction pins change while the pwm pin is on.
+ */
+void ReverseMotor(unsigned int index, unsigned char direction) {
+    if (Motors[index].brakeMode == BRAKE_RAMP || Motors[index].brakeMode > BRAKE_PLUG ||
+            Motors[index].duty == 0 || Motors[index].motorType == MOTOR_TYPE_STEPPER) {
+        //The PID and the move are the ramp, so there is nothing left to slow
+        //down before the dead time
+        Motors[index].duty = 0;
+        Motors[index].dutyFraction = 0;
+        StartDeadTime(index, direction);
+    } else {
+        StartBrake(index, direction);
+    }
 }
 
 /*
@@ -196,24 +766,23 @@ void StopMotor(unsigned int index) {
     //If the motor has stopped and it is not set to the targetDirection, set the
     //motor to the target direction
     if (Motors[index].duty == 0 && Motors[index].direction != Motors[index].targetDirection) {
-        //Set the direction flag
-        Motors[index].direction = Motors[index].targetDirection;
-        //Actually change the pin values.
-        SetPin(Motors[index].dirPin, Motors[index].direction);
-        SetPin(Motors[index].cdirPin, (unsigned) !Motors[index].direction);
-    } else if (Motors[index].duty > 0) {
+        //The direction is changed by RunBrake after the dead time
+        StartDeadTime(index, Motors[index].targetDirection);
+    } else if (DutyPosition(index) > 0) {
         //Slow the motor down using the desired acceleration profile
         //See AccelerateMotor function for descriptions of the acceleration 
         //types
         switch (Motors[index].accelType) {
             case ACCEL_INSTANT:
                 Motors[index].duty = 0;
+                ResetProfile(index);
                 break;
             case ACCEL_LINEAR:
                 if (Motors[index].duty > Motors[index].minimumDuty) {
-                    Motors[index].duty -= 1;
+                    LinearProfile(index, (unsigned int)Motors[index].minimumDuty << 8);
                 } else {
                     Motors[index].duty = 0;
+                    ResetProfile(index);
                 }
                 break;
             case ACCEL_EXPONENT:
@@ -221,8 +790,25 @@ void StopMotor(unsigned int index) {
                     Motors[index].duty -= ExponentialProfile(Motors[index].duty, Motors[index].minimumDuty, index);
                 } else {
                     Motors[index].duty = 0;
+                    ResetProfile(index);
+                }
+                break;
+            case ACCEL_SCURVE:
+                if (Motors[index].duty > Motors[index].minimumDuty) {
+                    SCurveProfile(index, (unsigned int)Motors[index].minimumDuty << 8);
+                } else {
+                    Motors[index].duty = 0;
+                    ResetProfile(index);
                 }
                 break;
+            case ACCEL_PID:
+                //Stop straight away, the speed is measured from here when
+                //the motor starts again
+                Motors[index].duty = 0;
+                ResetProfile(index);
+                Motors[index].state.drive.encoderLast = (unsigned int)ReadEncoder(index);
+                Motors[index].state.drive.lastSpeed = 0;
+                break;
             default:
                 break;
         }
@@ -235,32 +821,238 @@ void StopMotor(unsigned int index) {
 void AccelerateMotor(unsigned int index) {
     if (Motors[index].duty < Motors[index].minimumDuty && Motors[index].target >= Motors[index].minimumDuty) {
         Motors[index].duty = Motors[index].minimumDuty;
+        ResetProfile(index);
     } else if (Motors[index].duty <= Motors[index].minimumDuty && Motors[index].target  < Motors[index].minimumDuty) {
         Motors[index].duty = 0;
+        ResetProfile(index);
     }
     switch (Motors[index].accelType) {
         case ACCEL_INSTANT:
-            Motors[index].duty = Motors[index].target;
+            SetDutyPosition(index, TargetPosition(index));
             break;
         case ACCEL_LINEAR:
-            if (Motors[index].duty > Motors[index].target) {
-                Motors[index].duty -= 1;
-            } else if (Motors[index].duty < Motors[index].target) {
-                Motors[index].duty += 1;
-            }
+            LinearProfile(index, TargetPosition(index));
             break;
         case ACCEL_EXPONENT:
+            //This moves in whole steps of duty and picks up the fraction of
+            //the target when it gets there
+            Motors[index].dutyFraction = 0;
             if (Motors[index].duty > Motors[index].target) {
                 Motors[index].duty -= ExponentialProfile(Motors[index].duty, Motors[index].target, index);
             } else if (Motors[index].duty < Motors[index].target) {
                 Motors[index].duty += ExponentialProfile(Motors[index].duty, Motors[index].target, index);
             }
+            if (Motors[index].duty == Motors[index].target) {
+                SetDutyPosition(index, TargetPosition(index));
+            }
+            break;
+        case ACCEL_SCURVE:
+            SCurveProfile(index, TargetPosition(index));
             break;
         default:
             break;
     }
 }
 
+/*
+ * A synchronised move takes SyncTicksTotal control ticks, SyncTicksLeft counts
+ * them down. The motors in SyncMask move every control tick whatever their
+ * accelRate is.
+ */
+unsigned int SyncTicksTotal = 0;
+unsigned int SyncTicksLeft = 0;
+
+/*
+ * This takes the motors in motors out of the synchronised move. Their state
+ * was used by the move (see union MotorState) so the S-curve, the PID and the
+ * moves start again from where the motor is.
+ */
+void EndSync(unsigned char motors) {
+    unsigned char n;
+    motors &= SyncMask;
+    SyncMask &= (unsigned char)~motors;
+    for (n = 0; n < 4; n++) {
+        if (motors & (1 << n)) {
+            Motors[n].state.drive.velocity = 0;
+            Motors[n].state.drive.acceleration = 0;
+            Motors[n].state.drive.pidIntegral = 0;
+            Motors[n].state.drive.lastSpeed = 0;
+            Motors[n].state.drive.encoderLast = (unsigned int)ReadEncoder(n);
+        }
+    }
+}
+
+/*
+ * This starts a synchronised move for the motors in SyncRequest. It is called
+ * when the i2c registers are committed so the targets for the move are set.
+ * Each motor gets its own step so that they all get to their targets after
+ * the same number of control ticks, the remainder of the division is spread
+ * over the move like a line is drawn on a screen. The motors leave the move
+ * they were in and their moves, a motor can only be in one of them.
+ */
+void StartSync(void) {
+    unsigned long distance, longest;
+    unsigned int step;
+    long change;
+    unsigned char n;
+    longest = ((unsigned int)SyncTicksHigh << 8) | SyncTicksLow;
+    EndSync(SyncMask);
+    MoveMask &= (unsigned char)~SyncRequest;
+    for (n = 0; n < 4; n++) {
+        if (SyncRequest & (1 << n)) {
+            change = SignedPosition(TargetPosition(n), Motors[n].targetDirection) -
+                    SignedPosition(DutyPosition(n), Motors[n].direction);
+            Motors[n].state.sync.up = change > 0;
+            distance = (unsigned long)(change > 0 ? change : -change);
+            //The step holds the distance until the length of the move is known
+            Motors[n].state.sync.step = (long)distance;
+            if (SyncTicksHigh == 0 && SyncTicksLow == 0) {
+                //Find how long the linear acceleration would take
+                step = ((unsigned int)Motors[n].accelStep << 8) | Motors[n].accelStepFraction;
+                if (step == 0) {
+                    step = 1;
+                }
+                distance = (distance + step - 1) / step;
+                distance *= Motors[n].accelRate ? Motors[n].accelRate : 1;
+                if (distance > longest) {
+                    longest = distance;
+                }
+            }
+            SyncMask |= (unsigned char)(1 << n);
+        }
+    }
+    SyncRequest = 0;
+    if (longest > 0xFFFF) {
+        longest = 0xFFFF;
+    }
+    if (longest == 0) {
+        //Everything is already there
+        EndSync(SyncMask);
+        return;
+    }
+    for (n = 0; n < 4; n++) {
+        if (SyncMask & (1 << n)) {
+            distance = (unsigned long)Motors[n].state.sync.step;
+            Motors[n].state.sync.step = (long)(distance / longest);
+            Motors[n].state.sync.remainder = (unsigned int)(distance % longest);
+            Motors[n].state.sync.error = 0;
+            if (!Motors[n].state.sync.up) {
+                Motors[n].state.sync.step = -Motors[n].state.sync.step;
+            }
+        }
+    }
+    SyncTicksTotal = (unsigned int)longest;
+    SyncTicksLeft = (unsigned int)longest;
+}
+
+/*
+ * This is one control tick of a synchronised move for one motor.
+ */
+void SyncMotor(unsigned int index) {
+    long position = SignedPosition(DutyPosition(index), Motors[index].direction);
+    unsigned char direction;
+    position += Motors[index].state.sync.step;
+    Motors[index].state.sync.error += Motors[index].state.sync.remainder;
+    if (Motors[index].state.sync.error >= SyncTicksTotal) {
+        Motors[index].state.sync.error -= SyncTicksTotal;
+        position += Motors[index].state.sync.up ? 1 : -1;
+    }
+    if (position < 0) {
+        direction = 0;
+        position = -position;
+    } else if (position > 0) {
+        direction = 1;
+    } else {
+        direction = Motors[index].direction;
+    }
+    if (direction != Motors[index].direction) {
+        ReverseMotor(index, direction);
+        return;
+    }
+    SetDutyPosition(index, (unsigned int)position);
+}
+
+/*
+ * This starts a move for each motor in MoveRequest. It is called when the i2c
+ * registers are committed so the distances and speeds for the moves are set.
+ * A motor that starts a move leaves the synchronised move.
+ */
+void StartMoves(void) {
+    long distance, position;
+    unsigned char n;
+    for (n = 0; n < 4; n++) {
+        if ((MoveRequest & (1 << n)) && (EncoderEnable & (1 << n))) {
+            //The top byte has the sign
+            distance = (signed char)Motors[n].moveDistance[3] * 0x1000000L +
+                    ((long)Motors[n].moveDistance[2] << 16) +
+                    ((long)Motors[n].moveDistance[1] << 8) +
+                    Motors[n].moveDistance[0];
+            if (distance != 0) {
+                EndSync((unsigned char)(1 << n));
+                position = ReadEncoder(n);
+                Motors[n].state.drive.moveGoal = position + distance;
+                Motors[n].state.drive.moveLast = (unsigned int)position;
+                Motors[n].state.drive.moveBraking = 0;
+                Motors[n].targetDirection = distance > 0 ? 1 : 0;
+                MoveMask |= (unsigned char)(1 << n);
+            }
+        }
+    }
+    MoveRequest = 0;
+}
+
+/*
+ * This checks how far a moving motor has to go. It gives 1 when the move has
+ * finished and the motor has been stopped, otherwise the acceleration profile
+ * carries on as normal.
+ *
+ * The motor starts slowing down when the distance left is what it would take
+ * to stop with the linear acceleration. Slowing down from duty D by step s
+ * each acceleration step takes D/s steps and the speed falls evenly from v to
+ * 0, so it goes v*D/(2*s) counts. That is checked as 2*remaining*s <= v*D so
+ * there is no division. The target is then the minimum duty, which keeps the
+ * motor going until it gets to the end, and the motor is stopped on the count.
+ */
+unsigned char CheckMove(unsigned int index) {
+    long position = ReadEncoder(index);
+    long remaining = Motors[index].state.drive.moveGoal - position;
+    int speed = (int)((unsigned int)position - Motors[index].state.drive.moveLast);
+    unsigned long distance, step;
+    Motors[index].state.drive.moveLast = (unsigned int)position;
+    if (!Motors[index].targetDirection) {
+        remaining = -remaining;
+        speed = -speed;
+    }
+    if (remaining <= 0) {
+        //Got to the end, stop here
+        Motors[index].duty = 0;
+        ResetProfile(index);
+        Motors[index].target = 0;
+        Motors[index].targetFraction = 0;
+        MoveMask &= (unsigned char)~(1 << index);
+        return 1;
+    }
+    if (speed < 0) {
+        speed = 0;
+    }
+    if (!Motors[index].state.drive.moveBraking) {
+        distance = remaining > 0x7FFF ? 0x7FFF : (unsigned long)remaining;
+        step = ((unsigned int)Motors[index].accelStep << 8) | Motors[index].accelStepFraction;
+        if (step == 0) {
+            step = 1;
+        }
+        if (2 * distance * step <= (unsigned long)speed * DutyPosition(index)) {
+            Motors[index].state.drive.moveBraking = 1;
+            Motors[index].target = Motors[index].minimumDuty;
+            Motors[index].targetFraction = 0;
+        }
+    } else if (DutyPosition(index) == 0 && speed == 0) {
+        //The minimum duty isn't enough to keep it going, it stopped short
+        MoveMask &= (unsigned char)~(1 << index);
+    }
+    return 0;
+}
+
 /*
  * This function checks the current value and the target value, if they are 
  * different it applies the selected acceleration profile to change the values.
@@ -270,82 +1062,265 @@ void AccelerateMotor(unsigned int index) {
  */
 void AcceleratePWM(unsigned int index) {
     if (PWMPause || Motors[index].paused) {
-        StopMotor(index);
+        //A paused motor leaves the synchronised move and its move
+        EndSync((unsigned char)(1 << index));
+        MoveMask &= (unsigned char)~(1 << index);
+        //A paused servo stays where it is
+        if (Motors[index].motorType != MOTOR_TYPE_SERVO) {
+            StopMotor(index);
+        }
+    } else if (SyncMask & (1 << index)) {
+        SyncMotor(index);
+    } else if ((MoveMask & (1 << index)) && CheckMove(index)) {
+        //The move is finished and the motor has stopped
+    } else if (Motors[index].accelType == ACCEL_PID) {
+        //The PID sets the direction itself
+        PIDProfile(index);
     } else {
         //If the direction isn't equal to the targetDirection than reduce 
         //duty according to the current acceleration, otherwise if the duty 
         //isn't at the target accelerate
-        if (Motors[index].direction != Motors[index].targetDirection) {
-            StopMotor(index);
-        } else if (Motors[index].duty != Motors[index].target) {
+        //Servos don't have a direction and steppers can't be braked
+        if (Motors[index].direction != Motors[index].targetDirection && Motors[index].motorType != MOTOR_TYPE_SERVO) {
+            if (Motors[index].brakeMode == BRAKE_RAMP || Motors[index].brakeMode > BRAKE_PLUG ||
+                    Motors[index].duty == 0 || Motors[index].motorType == MOTOR_TYPE_STEPPER) {
+                StopMotor(index);
+            } else {
+                StartBrake(index, Motors[index].targetDirection);
+            }
+        } else if (DutyPosition(index) != TargetPosition(index) || Motors[index].state.drive.velocity != 0) {
+            //The S-curve can still be moving when the duty matches the target
             AccelerateMotor(index);
         }
     }
 }
 
 /*
- * We are going to make out own pwm using timers because this only has one real
- * pwm module.
- * So we just have the start and stop times for the left and right, and we 
- * toggle a digital pin state based on that.
- * We have two, one for left and one for right.
- * 
- * To make this work we have a single timer (Timer0) that gives us the period of
- * the generated pwm signal. Then we have two variables that control the duty
- * cycle for the left and right outputs.
- * 
- * Each time this function is called it checks to see if the value of Timer0 is 
- * greater than the value in either of the variables. When the value is less
- * than the output pin is high, when the value is greater than the output pin is
- * low.
- * To prevent glitches we are going to have a state variable that we check
- * against that lets us know the value without having to read the pin. 
+ * This adds the motors to the edge at time in a sorted list of count edges, a
+ * new edge is made if there isn't one at that time already. It gives the new
+ * number of edges. The servo tables use this too.
  */
-void CheckPWMOutput(void) {
+unsigned char AddEdge(struct PWMEdge *edges, unsigned char count, unsigned int time, unsigned char motors) {
+    unsigned char j, k;
+    //Find where the edge goes to keep the list sorted
+    for (j = 0; j < count && edges[j].time < time; j++);
+    if (j == count || edges[j].time != time) {
+        //Move the later edges up to make room
+        for (k = count; k > j; k--) {
+            edges[k] = edges[k-1];
+        }
+        edges[j].time = time;
+        edges[j].motors = 0;
+        count++;
+    }
+    //Pins that fall at the same time share the edge
+    edges[j].motors |= motors;
+    return count;
+}
+
+/*
+ * This builds the edge table for the next period from the current duty of each
+ * motor. Only enabled DC motors with a pulse at least one Timer1 tick long get
+ * a pulse, the servo pulses are made by servo.c.
+ */
+void BuildPWMEdges(void) {
+    struct PWMEdgeTable *table = &PWMTables[PWMActiveTable ^ 1];
+    unsigned int time;
+    unsigned char n;
+    table->start = 0;
+    table->count = 0;
+    table->period = PWMPeriodTicks;
+    table->prescale = PWMConfig.prescale;
     if (PWMEnable) {
-        unsigned int i;
-        for (i = 0; i < 4; i++) {
-            if (Motors[i].enabled) {
-                if (Motors[i].motorType == MOTOR_TYPE_SERVO) {
-                    if (TMR0 < Motors[i].duty && Motors[i].state == 0 && Motors[i].servoCount < 19) {
-                        Motors[i].servoCount++;
-                        Motors[i].state = 1;
-                    } else if (TMR0 < Motors[i].duty && Motors[i].state == 0 && Motors[i].servoCount == 20) {
-                        Motors[i].state = 1;
-                        SetPin(Motors[i].PWMPin,1);
-                    } else if (TMR0 >= Motors[i].duty && Motors[i].state == 1 && Motors[i].servoCount < 19) {
-                        Motors[i].state = 0;
-                    } else if (TMR0 < Motors[i].duty && Motors[i].state == 0 && Motors[i].servoCount == 20) {
-                        Motors[i].state = 0;
-                        Motors[i].servoCount = 0;
-                        SetPin(Motors[i].PWMPin,0);
-                    }
-                } else if (Motors[i].motorType == MOTOR_TYPE_DC) {
-                    //Check if the right state should be changed
-                    if (TMR0 < Motors[i].duty && Motors[i].state == 0) {
-                        //Set the state as high
-                        Motors[i].state = 1;
-                        //Set the pin as high
-                        SetPin(Motors[i].PWMPin,1);
-                    } else if (TMR0 >= Motors[i].duty && Motors[i].state == 1) {
-                        //Set the state as low
-                        Motors[i].state = 0;
-                        //Set the pin as low
-                        SetPin(Motors[i].PWMPin,0);
-                    }
+        for (n = 0; n < 4; n++) {
+            //The whole duty with its fraction is scaled to the period, a duty
+            //of 256.0 would be the whole period
+            time = (unsigned int)(((unsigned long)OutputPosition(n) * table->period) >> 16);
+            if (Motors[n].enabled && Motors[n].motorType == MOTOR_TYPE_DC && time) {
+                //A motor that is being shorted has its pin on all of the
+                //time, an edge at the end of the period would turn it off
+                //for a tick
+                if (Motors[n].brakeState != BRAKE_STATE_SHORT) {
+                    table->count = AddEdge(table->edges, table->count, time, (unsigned char)(1 << n));
                 }
-            } else if (Motors[i].state) {
-                //If it isn't enabled check the state, turn off the PWM if it is on.
-                Motors[i].state = 0;
-                SetPin(Motors[i].PWMPin,0);
+                table->start |= (unsigned char)(1 << n);
             }
+        }
+    }
+    PWMTableReady = 1;
+}
+
+/*
+ * This does the pwm edge that is due, or starts the next period, and sets
+ * PWMNextTime to when the next one is due.
+ */
+void PWMEdge(void) {
+    struct PWMEdgeTable *table = &PWMTables[PWMActiveTable];
+    const unsigned char *pins;
+    if (PWMEdgeIndex < table->count) {
+        //A falling edge, all of the pins are written at the same time
+        pins = PWMPins[table->edges[PWMEdgeIndex].motors];
+        LATA &= ~pins[PORT_A];
+        LATB &= ~pins[PORT_B];
+        LATC &= ~pins[PORT_C];
+        PWMEdgeIndex++;
+    } else {
+        //The start of a new period, use the new table if there is one
+        PWMPeriodStart += table->period;
+        if (PWMTableReady) {
+            PWMActiveTable ^= 1;
+            PWMTableReady = 0;
+            table = &PWMTables[PWMActiveTable];
+            //Timer1 keeps its count when the prescaler changes, only the
+            //length of a tick is different, so the servo edge that is
+            //waiting is moved to the same time in the new ticks
+            T1CONbits.T1CKPS = table->prescale;
+            ServoPrescaleChanged();
+        }
+        pins = PWMPins[table->start];
+        LATA |= pins[PORT_A];
+        LATB |= pins[PORT_B];
+        LATC |= pins[PORT_C];
+        PWMEdgeIndex = 0;
+    }
+    if (PWMEdgeIndex < table->count) {
+        PWMNextTime = PWMPeriodStart + table->edges[PWMEdgeIndex].time;
+    } else {
+        PWMNextTime = PWMPeriodStart + table->period;
+    }
+}
+
+/*
+ * This is called from the interrupt when CCP1 matches Timer1. CCP1 is the only
+ * compare module so it times the servo edges and the steps as well as the pwm
+ * edges, each keeps the Timer1 count of its next edge and CCPR1 is set to the
+ * earliest.
+ * Timer1 is never written so no counts are lost, and nothing waits in the
+ * interrupt for an edge.
+ *
+ * If the next edge is already in the past (something held off the interrupt
+ * for too long) it is done straight away, otherwise it would be missed until
+ * Timer1 wraps around. The times are compared with signed differences, which
+ * works because no edge is ever more than half of the Timer1 range away.
+ */
+void PWMEdgeInterrupt(void) {
+    unsigned int now, next;
+    do {
+        PIR1bits.CCP1IF = 0;
+        //CCPR1 is still the time this edge was due
+        now = CCPR1;
+        CountEdgeLateness(TMR1 - now);
+        if ((int)(PWMNextTime - now) <= 0) {
+            PWMEdge();
+        }
+        if ((int)(ServoNextTime - now) <= 0) {
+            ServoInterrupt();
+        }
+        if (SteppersRunning && (int)(StepNextTime - now) <= 0) {
+            StepperInterrupt();
+        }
+        next = PWMNextTime;
+        if ((int)(ServoNextTime - next) < 0) {
+            next = ServoNextTime;
+        }
+        if (SteppersRunning && (int)(StepNextTime - next) < 0) {
+            next = StepNextTime;
+        }
+        CCPR1 = next;
+    } while ((int)(next - TMR1) <= 0);
+}
+
+/*
+ * The acceleration is run from a fixed rate control tick so that ramps take
+ * the same time no matter how fast the main loop is going.
+ * Timer2 sets TMR2IF CONTROL_TICK_HZ times a second, the interrupt only counts
+ * the tick and the main loop runs ControlTick once for each tick that has
+ * been counted. If the main loop is held up the ticks are caught up
+ * afterwards instead of being lost.
+ */
+volatile unsigned char ControlTickPending = 0;
+
+/*
+ * This sets up Timer2 to give the control tick.
+ */
+void InitControlTick(void) {
+    //Use a 1:16 prescaler value so Timer2 counts at 250kHz
+    T2CONbits.T2CKPS = 0b10;
+    //Use a 1:1 postscaler
+    T2CONbits.T2OUTPS = 0b0000;
+    //Timer2 is reset when it matches PR2, so it matches every
+    //250000/CONTROL_TICK_HZ counts
+    PR2 = (unsigned char)(250000 / CONTROL_TICK_HZ - 1);
+    TMR2 = 0;
+    PIR1bits.TMR2IF = 0;
+    PIE1bits.TMR2IE = 1;
+    //Turn on Timer2
+    T2CONbits.TMR2ON = 1;
+}
+
+/*
+ * This is called from the interrupt when Timer2 matches PR2.
+ */
+void ControlTickInterrupt(void) {
+    PIR1bits.TMR2IF = 0;
+    ControlTickPending++;
+}
+
+/*
+ * This is run once for each control tick. accelRate is the number of control
+ * ticks between each step of the acceleration.
+ */
+void ControlTick(void) {
+    unsigned char duty, direction;
+    ControlTickCount++;
+    RunTrace();
+    if (PWMEnable) {
+        unsigned int i;
+        for (i = 0; i < 4; i++) {
+            duty = Motors[i].duty;
+            direction = Motors[i].direction;
+            //Start the next segment from the setpoint queue if it is time
+            RunQueue(i);
             //Keep a count to see when we should update the pwm acceleration.
-            if (Motors[i].accelCount >= Motors[i].accelRate) {
+            Motors[i].accelCount++;
+            if (Motors[i].brakeState != BRAKE_STATE_NONE) {
+                //Braking and the dead time are timed in control ticks
+                RunBrake(i);
+            } else if (Motors[i].accelCount >= Motors[i].accelRate || (SyncMask & (1 << i))) {
                 AcceleratePWM(i);
                 Motors[i].accelCount = 0;
-            } else {
-                Motors[i].accelCount++;
             }
+            TraceMotor(i, duty, direction);
+        }
+        if (SyncMask && --SyncTicksLeft == 0) {
+            EndSync(SyncMask);
         }
     }
+    //This also stops the steppers when the pwm is turned off
+    UpdateSteppers();
+    //Give the i2c status block the state at the end of this tick
+    UpdateStatus();
+}
+
+/*
+ * We are going to make out own pwm using timers because this only has one real
+ * pwm module.
+ * The pins are switched by PWMEdgeInterrupt, all that is left for the main
+ * loop is to build the edge table for the next period once the interrupt has
+ * started using the last one, and the same for the servo frame, and to run the
+ * control ticks that are due.
+ */
+void CheckPWMOutput(void) {
+    if (!PWMTableReady) {
+        BuildPWMEdges();
+    }
+    CheckServoOutput();
+    while (ControlTickPending) {
+        //The interrupt can add a tick at any time so don't let it happen
+        //between reading and writing the count.
+        di();
+        ControlTickPending--;
+        ei();
+        ControlTick();
+    }
 }
@@ -0,0 +1,214 @@
+/*
+ * file: queue.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This file has the setpoint queues. The host can send a list of targets with
+ * the time between them and the control tick works through the list, so the
+ * timing doesn't depend on when the host gets around to sending each one.
+ *
+ * The segments of all four queues come from one pool, Segments, so a motor
+ * that isn't using its queue doesn't keep any RAM for it. Each queue is a list
+ * starting at queueFirst and linked by next, the first queueDepth segments
+ * have been committed and the ones after them have been received since the
+ * last commit. The free segments are a list starting at SegmentFree. A segment
+ * is taken from the pool when its first byte comes in, only one segment is
+ * received at a time so its state is kept once for all of the motors.
+ * Everything here is run from the main loop so nothing has to be protected
+ * from the interrupt.
+ */
+
+#include "parameters.h"
+
+//The number of bytes the host sends for each segment
+#define SEGMENT_BYTES 4
+//The direction is kept in the top bit of next, the rest is the next segment
+//or SEGMENT_NONE at the end of a list
+#define SEGMENT_DIRECTION 0x80
+#define SEGMENT_NONE 0x7F
+
+//One segment of a setpoint queue
+struct Segment {
+    unsigned int delay;
+    unsigned char target;
+    unsigned char next;
+};
+
+struct Segment Segments[SEGMENT_POOL_SIZE];
+//The first segment that isn't being used
+unsigned char SegmentFree = SEGMENT_NONE;
+//The segment being received, the motor it is for and the number of bytes of
+//it that have come in
+unsigned char SegmentReceive = SEGMENT_NONE;
+unsigned char SegmentMotor = 0;
+unsigned char SegmentFill = 0;
+
+/*
+ * This empties all of the queues and puts every segment in the free list.
+ */
+void InitQueues(void) {
+    unsigned char n;
+    for (n = 0; n < SEGMENT_POOL_SIZE; n++) {
+        Segments[n].next = n + 1;
+    }
+    Segments[SEGMENT_POOL_SIZE - 1].next = SEGMENT_NONE;
+    SegmentFree = 0;
+    SegmentReceive = SEGMENT_NONE;
+    SegmentFill = 0;
+    for (n = 0; n < 4; n++) {
+        Motors[n].queueFirst = SEGMENT_NONE;
+        Motors[n].queueDepth = 0;
+        Motors[n].queueUnderruns = 0;
+        Motors[n].queueTicks = 0;
+    }
+}
+
+/*
+ * This gives a segment back to the pool.
+ */
+void FreeSegment(unsigned char segment) {
+    Segments[segment].next = SegmentFree;
+    SegmentFree = segment;
+}
+
+/*
+ * This throws away a segment that has only been partly received.
+ */
+void DropSegment(void) {
+    if (SegmentReceive != SEGMENT_NONE) {
+        FreeSegment(SegmentReceive);
+        SegmentReceive = SEGMENT_NONE;
+    }
+    SegmentFill = 0;
+}
+
+/*
+ * This adds a segment that has been received to the end of a motor's queue.
+ */
+void AppendSegment(unsigned char index, unsigned char segment) {
+    unsigned char last = Motors[index].queueFirst;
+    if (last == SEGMENT_NONE) {
+        Motors[index].queueFirst = segment;
+        return;
+    }
+    while ((Segments[last].next & SEGMENT_NONE) != SEGMENT_NONE) {
+        last = Segments[last].next & SEGMENT_NONE;
+    }
+    Segments[last].next = (Segments[last].next & SEGMENT_DIRECTION) | segment;
+}
+
+/*
+ * This takes one byte written to a queue register. When all 4 bytes of a
+ * segment are in it is added to the queue, it is run after the next commit.
+ * If there wasn't a free segment for it the bytes are dropped and counted.
+ */
+void QueueSegmentByte(unsigned char index, unsigned char value) {
+    struct Segment *segment;
+    if (SegmentFill != 0 && index != SegmentMotor) {
+        //The rest of the other motor's segment isn't coming
+        DropSegment();
+    }
+    if (SegmentFill == 0) {
+        SegmentReceive = SegmentFree;
+        if (SegmentReceive != SEGMENT_NONE) {
+            SegmentFree = Segments[SegmentReceive].next;
+        }
+        SegmentMotor = index;
+    }
+    SegmentFill++;
+    if (SegmentReceive == SEGMENT_NONE) {
+        if (SegmentFill == SEGMENT_BYTES) {
+            SegmentFill = 0;
+            //The pool is empty, the count stops at 255 instead of wrapping
+            if (CommandOverflows != 0xFF) {
+                CommandOverflows++;
+            }
+        }
+        return;
+    }
+    segment = &Segments[SegmentReceive];
+    switch (SegmentFill) {
+        case 1:
+            segment->delay = value;
+            break;
+        case 2:
+            segment->delay |= (unsigned int)value << 8;
+            break;
+        case 3:
+            segment->target = value;
+            break;
+        default:
+            segment->next = value ? SEGMENT_DIRECTION | SEGMENT_NONE : SEGMENT_NONE;
+            AppendSegment(index, SegmentReceive);
+            SegmentReceive = SEGMENT_NONE;
+            SegmentFill = 0;
+            break;
+    }
+}
+
+/*
+ * This is called when the i2c registers are committed. The segments that
+ * have been received can be run and half received segments are thrown away
+ * so that the next write starts with a new segment.
+ */
+void CommitQueues(void) {
+    unsigned char n, segment, depth;
+    DropSegment();
+    for (n = 0; n < 4; n++) {
+        depth = 0;
+        for (segment = Motors[n].queueFirst; segment != SEGMENT_NONE; segment = Segments[segment].next & SEGMENT_NONE) {
+            depth++;
+        }
+        Motors[n].queueDepth = depth;
+    }
+}
+
+/*
+ * This is called every control tick. When the delay of the running segment is
+ * over the next segment is started and its segment goes back to the pool.
+ */
+void RunQueue(unsigned int index) {
+    struct Segment *segment;
+    unsigned char first;
+    if (Motors[index].queueTicks) {
+        Motors[index].queueTicks--;
+        if (Motors[index].queueTicks) {
+            return;
+        }
+        if (Motors[index].queueDepth == 0) {
+            //The host didn't send the next segment in time
+            if (Motors[index].queueUnderruns != 0xFF) {
+                Motors[index].queueUnderruns++;
+            }
+            return;
+        }
+    } else if (Motors[index].queueDepth == 0) {
+        return;
+    }
+    first = Motors[index].queueFirst;
+    segment = &Segments[first];
+    //Targets below the minimum duty are 0, the same as the speed registers
+    if (segment->target < Motors[index].minimumDuty) {
+        Motors[index].target = 0;
+    } else {
+        Motors[index].target = segment->target;
+    }
+    Motors[index].targetFraction = 0;
+    Motors[index].targetDirection = (segment->next & SEGMENT_DIRECTION) ? 1 : 0;
+    Motors[index].queueTicks = segment->delay;
+    Motors[index].queueFirst = segment->next & SEGMENT_NONE;
+    Motors[index].queueDepth--;
+    FreeSegment(first);
+}
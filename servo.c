@@ -0,0 +1,181 @@
+/*
+ * file: servo.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This file has the servo outputs. Servos need a pulse of 1-2ms every 20ms,
+ * which is too long for the pwm period, so they have their own frame.
+ *
+ * CCP1 is the only compare module, so the servo edges are timed by it along
+ * with the pwm edges, see PWMEdgeInterrupt. Each servo pin goes high at the
+ * start of the frame and the falling edges are kept sorted the same as the pwm
+ * edges. The interrupt keeps ServoNextTime, the Timer1 count when the next
+ * servo edge is due, and CCPR1 is set to it when it comes before the next pwm
+ * edge. Nothing waits in the interrupt and Timer1 is never written, so the
+ * pulses are as exact as the pwm ones and the pwm edges aren't held up.
+ *
+ * The times in the tables are in microseconds from the start of the frame.
+ * Each gap between edges is turned into Timer1 ticks for the prescaler that
+ * is being used, the instruction cycles that don't make a whole tick are
+ * carried on to the next gap so nothing adds up over a frame. An edge can
+ * only be on a tick, so the pulse width goes in steps of one Timer1 tick:
+ * 2us with the default 1:8 prescaler, 1us with 1:4 and less below that.
+ * The prescaler can change at the start of any pwm period, the part of the
+ * gap to the next servo edge that is left is turned into ticks of the new
+ * length then, see ServoPrescaleChanged.
+ *
+ * The tables are double buffered the same as the pwm tables, the main loop
+ * builds the next one and the interrupt swaps to it at the start of a frame.
+ */
+
+#include "parameters.h"
+
+struct ServoTable {
+    //The motors whose pins go high at the start of the frame
+    unsigned char start;
+    //The number of falling edges in the table
+    unsigned char count;
+    struct PWMEdge edges[4];
+};
+
+struct ServoTable ServoTables[2];
+//The table being used by the interrupt
+volatile unsigned char ServoActiveTable = 0;
+//This is set when the other table has been built and is waiting to be used
+volatile unsigned char ServoTableReady = 0;
+//The next edge in the active table, when it is equal to count the next edge
+//is the start of a new frame
+unsigned char ServoEdgeIndex = 0;
+//The time in the frame of the edge that is due next, and when it is due in
+//Timer1 ticks
+unsigned int ServoFrameTime = SERVO_FRAME_US;
+volatile unsigned int ServoNextTime = 0;
+//The instruction cycles left over when the last gap was turned into ticks,
+//and the Timer1 prescaler it was worked out for
+unsigned char ServoCarry = 0;
+unsigned char ServoPrescale = 0;
+
+/*
+ * This starts the servo frames, the first one starts with the first pwm
+ * period so InitPWM has to be called first.
+ */
+void InitServo(void) {
+    ServoEdgeIndex = 0;
+    ServoFrameTime = SERVO_FRAME_US;
+    ServoNextTime = CCPR1;
+    ServoCarry = 0;
+    ServoPrescale = T1CONbits.T1CKPS;
+}
+
+/*
+ * This builds the table for the next frame from the duty of each servo. Only
+ * enabled servos get a pulse.
+ */
+void BuildServoEdges(void) {
+    struct ServoTable *table = &ServoTables[ServoActiveTable ^ 1];
+    unsigned int time;
+    unsigned char n;
+    table->start = 0;
+    table->count = 0;
+    if (PWMEnable) {
+        for (n = 0; n < 4; n++) {
+            if (Motors[n].enabled && Motors[n].motorType == MOTOR_TYPE_SERVO) {
+                time = SERVO_MINIMUM_PULSE_US +
+                        (unsigned int)(((unsigned long)DutyPosition(n) * SERVO_PULSE_RANGE_US) >> 16);
+                table->count = AddEdge(table->edges, table->count, time, (unsigned char)(1 << n));
+                table->start |= (unsigned char)(1 << n);
+            }
+        }
+    }
+    ServoTableReady = 1;
+}
+
+/*
+ * This is called every time around the main loop, the next table is built
+ * once the interrupt has started using the last one.
+ */
+void CheckServoOutput(void) {
+    if (!ServoTableReady) {
+        BuildServoEdges();
+    }
+}
+
+/*
+ * This is called from the CCP1 interrupt when the next servo edge is due. It
+ * does the edge and sets ServoNextTime to when the one after it is due.
+ */
+void ServoInterrupt(void) {
+    struct ServoTable *table = &ServoTables[ServoActiveTable];
+    unsigned int target, cycles, ticks;
+    if (ServoFrameTime == SERVO_FRAME_US) {
+        //The start of a new frame, use the new table if there is one
+        ServoFrameTime = 0;
+        if (ServoTableReady) {
+            ServoActiveTable ^= 1;
+            ServoTableReady = 0;
+            table = &ServoTables[ServoActiveTable];
+        }
+        LATA |= PWMPins[table->start][PORT_A];
+        LATB |= PWMPins[table->start][PORT_B];
+        LATC |= PWMPins[table->start][PORT_C];
+        ServoEdgeIndex = 0;
+    } else if (ServoEdgeIndex < table->count && table->edges[ServoEdgeIndex].time == ServoFrameTime) {
+        //A falling edge, all of the pins are written at the same time
+        LATA &= ~PWMPins[table->edges[ServoEdgeIndex].motors][PORT_A];
+        LATB &= ~PWMPins[table->edges[ServoEdgeIndex].motors][PORT_B];
+        LATC &= ~PWMPins[table->edges[ServoEdgeIndex].motors][PORT_C];
+        ServoEdgeIndex++;
+    }
+    //Otherwise it is one of the edges that split up a long gap
+    if (ServoEdgeIndex < table->count) {
+        target = table->edges[ServoEdgeIndex].time;
+    } else {
+        target = SERVO_FRAME_US;
+    }
+    if (target - ServoFrameTime > SERVO_WAIT_US) {
+        target = ServoFrameTime + SERVO_WAIT_US;
+    }
+    //Each microsecond is 4 instruction cycles and each tick is 2^prescale
+    ServoPrescale = T1CONbits.T1CKPS;
+    cycles = ((target - ServoFrameTime) << 2) + ServoCarry;
+    ticks = cycles >> ServoPrescale;
+    ServoCarry = (unsigned char)(cycles - (ticks << ServoPrescale));
+    ServoFrameTime = target;
+    ServoNextTime += ticks;
+}
+
+/*
+ * This is called from the CCP1 interrupt when a new pwm table starts, which is
+ * the only time the Timer1 prescaler changes. If it has changed, the part of
+ * the gap to the next servo edge that is left was worked out in ticks of the
+ * old length, it is turned into ticks of the new length so the pulse that is
+ * going on keeps its width. Timer1 has counted in the old ticks up to now, the
+ * interrupt can be late so this has to be from Timer1 and not from when the
+ * pwm period started.
+ */
+void ServoPrescaleChanged(void) {
+    //The ticks that are left, then the cycles
+    unsigned int now = TMR1, left = ServoNextTime - now;
+    //If the edge is due now ServoInterrupt works out the next gap with the
+    //new prescaler
+    if (ServoPrescale == T1CONbits.T1CKPS || (int)left <= 0) {
+        return;
+    }
+    //The gap is at most SERVO_WAIT_US, 16000 cycles, so this doesn't overflow
+    left = (left << ServoPrescale) + ServoCarry;
+    ServoPrescale = T1CONbits.T1CKPS;
+    ServoNextTime = now + (left >> ServoPrescale);
+    ServoCarry = (unsigned char)(left & ((1 << ServoPrescale) - 1));
+}
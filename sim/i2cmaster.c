@@ -0,0 +1,227 @@
+/*
+ * file: sim/i2cmaster.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This file is the i2c master for the simulation. It plays the part of the bus
+ * and of the MSSP module, one byte at a time:
+ *
+ *  - a start or a stop sets S or P and SSPIF, the module is in the mode with
+ *    start and stop interrupts
+ *  - each byte takes 8 bit times, then on the 9th clock the byte is put in
+ *    SSPBUF with BF, D_nA and R_nW set the way the MSSP sets them and SSPIF
+ *    is set
+ *  - the clock is stretched (CKP cleared) after every byte of a read and,
+ *    with SEN set, every byte of a write, and the bus waits until the
+ *    firmware sets CKP again
+ *  - an address only gets an acknowledge if it matches SSPADD in the bits
+ *    that are set in SSPMSK, or it is the general call and GCEN is set
+ *
+ * The state of the MSSP after a read that the master ended with a NACK
+ * follows AN734, SSPIF is set with D_nA set and R_nW and BF clear.
+ */
+
+#include "sim.h"
+
+//100kHz
+unsigned long SimI2CBitCycles = SIM_US(10);
+//The number of times the firmware held the clock for longer than a bus would
+//wait for it
+unsigned long SimI2CTimeouts = 0;
+//The address used by the register functions
+unsigned char SimI2CAddress = I2C_ADDRESS;
+
+//The registers behind SSPADD and SSPMSK, these are in sim.c
+extern volatile unsigned char SimSSPAddress, SimSSPMask;
+
+//How long the master waits for the clock to be released
+#define SIM_I2C_TIMEOUT SIM_MS(25)
+
+static int ClockReleased(void) {
+    return SSPCON1bits.CKP;
+}
+
+/*
+ * This gives the firmware its interrupt for a byte on the 9th clock and waits
+ * for it to release the clock.
+ */
+static void SimI2CNinthClock(unsigned char stretch) {
+    if (stretch) {
+        SSPCON1bits.CKP = 0;
+    }
+    PIR1bits.SSPIF = 1;
+    if (stretch) {
+        if (!SimRunUntil(ClockReleased, SIM_I2C_TIMEOUT)) {
+            SimI2CTimeouts++;
+            SSPCON1bits.CKP = 1;
+        }
+    }
+    SimRun(SimI2CBitCycles);
+    //Reading SSPBUF clears BF, if the firmware hasn't got to the byte yet the
+    //next one overflows
+    if (!PIR1bits.SSPIF) {
+        SSPSTATbits.BF = 0;
+    }
+}
+
+static void SimI2CStart(void) {
+    SSPSTATbits.S = 1;
+    SSPSTATbits.P = 0;
+    PIR1bits.SSPIF = 1;
+    SimRun(SimI2CBitCycles);
+}
+
+static void SimI2CStop(void) {
+    SSPSTATbits.S = 0;
+    SSPSTATbits.P = 1;
+    SSPSTATbits.BF = 0;
+    SSPSTATbits.R_nW = 0;
+    PIR1bits.SSPIF = 1;
+    SimRun(SimI2CBitCycles);
+}
+
+/*
+ * This sends an address byte and gives 1 if the controller acknowledged it.
+ */
+static int SimI2CAddressByte(unsigned char address, unsigned char read) {
+    unsigned char byte = (unsigned char)((address << 1) | read);
+    unsigned char match;
+    SimRun(8 * SimI2CBitCycles);
+    match = ((byte ^ SimSSPAddress) & SimSSPMask & 0xFE) == 0;
+    if (address == 0 && !read && SSPCON2bits.GCEN) {
+        match = 1;
+    }
+    if (!SSPCON1bits.SSPEN || !match) {
+        return 0;
+    }
+    if (SSPSTATbits.BF) {
+        SSPCON1bits.SSPOV = 1;
+    }
+    SSPBUF = byte;
+    SSPSTATbits.BF = 1;
+    SSPSTATbits.D_nA = 0;
+    SSPSTATbits.R_nW = read;
+    SimI2CNinthClock(read || SSPCON2bits.SEN);
+    return 1;
+}
+
+/*
+ * This sends a data byte.
+ */
+static void SimI2CWriteByte(unsigned char value) {
+    SimRun(8 * SimI2CBitCycles);
+    if (SSPSTATbits.BF) {
+        SSPCON1bits.SSPOV = 1;
+    }
+    SSPBUF = value;
+    SSPSTATbits.BF = 1;
+    SSPSTATbits.D_nA = 1;
+    SSPSTATbits.R_nW = 0;
+    SimI2CNinthClock(SSPCON2bits.SEN);
+}
+
+/*
+ * This reads a data byte, the firmware put it in SSPBUF when it released the
+ * clock. The byte is acknowledged if more are wanted.
+ */
+static unsigned char SimI2CReadByte(unsigned char more) {
+    unsigned char value = SSPBUF;
+    SimRun(8 * SimI2CBitCycles);
+    SSPSTATbits.BF = 0;
+    SSPSTATbits.D_nA = 1;
+    SSPSTATbits.R_nW = more;
+    SimI2CNinthClock(more);
+    return value;
+}
+
+int SimI2CWriteRead(unsigned char address, const unsigned char *out, int outCount, unsigned char *in, int inCount) {
+    int n, acked = 0;
+    SimI2CStart();
+    if (outCount || !inCount) {
+        if (SimI2CAddressByte(address, 0)) {
+            acked++;
+            for (n = 0; n < outCount; n++) {
+                SimI2CWriteByte(out[n]);
+                acked++;
+            }
+        }
+        if (inCount && acked) {
+            //A repeated start
+            SimI2CStart();
+        }
+    }
+    if (inCount && (acked || !outCount)) {
+        if (SimI2CAddressByte(address, 1)) {
+            acked++;
+            for (n = 0; n < inCount; n++) {
+                in[n] = SimI2CReadByte(n + 1 < inCount);
+            }
+        } else {
+            for (n = 0; n < inCount; n++) {
+                in[n] = 0xFF;
+            }
+        }
+    }
+    SimI2CStop();
+    return acked;
+}
+
+int SimI2CWrite(unsigned char address, const unsigned char *bytes, int count) {
+    return SimI2CWriteRead(address, bytes, count, 0, 0);
+}
+
+int SimI2CRead(unsigned char address, unsigned char *bytes, int count) {
+    return SimI2CWriteRead(address, 0, 0, bytes, count);
+}
+
+unsigned char SimCRC8(unsigned char crc, const unsigned char *bytes, int count) {
+    int n, bit;
+    for (n = 0; n < count; n++) {
+        crc ^= bytes[n];
+        for (bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (unsigned char)((crc << 1) ^ 0x07) : (unsigned char)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+int SimI2CWriteRegisters(unsigned char reg, const unsigned char *values, int count, int pec) {
+    unsigned char bytes[258];
+    unsigned char address = (unsigned char)(SimI2CAddress << 1);
+    int n;
+    bytes[0] = reg;
+    for (n = 0; n < count; n++) {
+        bytes[n + 1] = values[n];
+    }
+    if (pec) {
+        bytes[count + 1] = SimCRC8(SimCRC8(0, &address, 1), bytes, count + 1);
+        count++;
+    }
+    return SimI2CWrite(SimI2CAddress, bytes, count + 1);
+}
+
+int SimI2CReadRegisters(unsigned char reg, unsigned char *values, int count, int pec) {
+    unsigned char bytes[258];
+    unsigned char header[3] = {(unsigned char)(SimI2CAddress << 1), reg, (unsigned char)((SimI2CAddress << 1) | 1)};
+    int n;
+    SimI2CWriteRead(SimI2CAddress, &reg, 1, bytes, pec ? count + 1 : count);
+    for (n = 0; n < count; n++) {
+        values[n] = bytes[n];
+    }
+    if (pec && SimCRC8(SimCRC8(0, header, 3), bytes, count) != bytes[count]) {
+        return -1;
+    }
+    return count;
+}
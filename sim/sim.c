@@ -0,0 +1,484 @@
+/*
+ * file: sim/sim.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This file has the simulated registers, the clock and the peripherals that
+ * count with it, the interrupts and the pin recorder, see sim.h.
+ */
+
+#include <stdlib.h>
+#include <ucontext.h>
+#include "sim.h"
+
+//The registers that are plain values
+volatile unsigned char TRISA, TRISB, TRISC;
+volatile unsigned char PORTA, PORTB, PORTC;
+volatile PORTAbits_t PORTAbits;
+volatile PORTBbits_t PORTBbits;
+volatile OSCCONbits_t OSCCONbits;
+volatile T0CONbits_t T0CONbits;
+volatile T1CONbits_t T1CONbits;
+volatile T2CONbits_t T2CONbits;
+volatile T3CONbits_t T3CONbits;
+volatile CCP1CONbits_t CCP1CONbits;
+volatile unsigned char PR2 = 0xFF, TMR2;
+volatile unsigned short CCPR1;
+volatile INTCONbits_t INTCONbits;
+volatile INTCON2bits_t INTCON2bits;
+volatile PIR1bits_t PIR1bits;
+volatile PIE1bits_t PIE1bits;
+volatile IPR1bits_t IPR1bits;
+volatile PIR2bits_t PIR2bits;
+volatile PIE2bits_t PIE2bits;
+volatile IPR2bits_t IPR2bits;
+volatile RCONbits_t RCONbits;
+volatile WPUBbits_t WPUBbits;
+volatile SSPSTATbits_t SSPSTATbits;
+volatile SSPCON1bits_t SSPCON1bits;
+volatile SSPCON2bits_t SSPCON2bits;
+volatile unsigned char SSPBUF;
+volatile unsigned char IOCA, IOCB;
+volatile ANSELHbits_t ANSELHbits;
+volatile unsigned char EEADR, EECON2;
+
+//The registers behind the functions in xc.h
+static volatile unsigned short Timer0, Timer1, Timer3;
+static volatile unsigned char Latches[3];
+volatile unsigned char SimSSPAddress, SimSSPMask = 0xFF;
+static volatile EECON1bits_t EEControl;
+static volatile unsigned char EEData;
+
+unsigned long SimTime = 0;
+unsigned long SimReadCycles = 2;
+unsigned long SimMainCycles = 100;
+unsigned long SimLatchCycles = 1;
+unsigned long SimEntryCycles = 12;
+unsigned long SimISRCycles[2] = {12, 12};
+unsigned char SimLevel = SIM_MAIN;
+unsigned long SimInterruptCount[2];
+unsigned long SimLongestISR[2];
+unsigned long SimBusyISR[2];
+unsigned char SimEEPROM[256];
+unsigned long SimEEPROMWriteCycles = SIM_MS(4);
+unsigned long SimEEPROMWrites = 0;
+unsigned long SimFaults = 0;
+unsigned long SimFailures = 0;
+struct SimEdge *SimEdges = 0;
+unsigned long SimEdgeCount = 0;
+
+//The timer values the clock last set, a different value means the firmware
+//wrote the timer, and the prescaler counts
+static unsigned short timer0Set, timer1Set, timer3Set;
+static unsigned long prescale0, prescale1, prescale2, postscale2, prescale3;
+//The EEPROM write that is going on
+static unsigned long eepromLeft = 0;
+static unsigned char eepromAddress, eepromValue;
+//The pins as they were last recorded
+static unsigned char pinsRecorded[3];
+static unsigned long edgeSpace = 0;
+//The firmware runs on its own stack
+static ucontext_t testContext, firmwareContext;
+static unsigned char firmwareStarted = 0, inFirmware = 0;
+static unsigned long runUntil;
+static int (*runDone)(void);
+
+static void SimTakeInterrupts(void);
+
+void SimClearEdges(void) {
+    SimEdgeCount = 0;
+}
+
+static void SimAddEdge(unsigned char pin, unsigned char level) {
+    if (SimEdgeCount == edgeSpace) {
+        edgeSpace = edgeSpace ? 2 * edgeSpace : 4096;
+        SimEdges = realloc(SimEdges, edgeSpace * sizeof(struct SimEdge));
+        if (!SimEdges) {
+            printf("out of memory for the pin recorder\n");
+            exit(2);
+        }
+    }
+    SimEdges[SimEdgeCount].time = SimTime;
+    SimEdges[SimEdgeCount].pin = pin;
+    SimEdges[SimEdgeCount].level = level;
+    SimEdgeCount++;
+}
+
+/*
+ * This records the pins that changed since the last time, they changed on this
+ * cycle because the clock doesn't move while the firmware runs.
+ */
+static void SimRecordPins(void) {
+    unsigned char now[3] = {Latches[0], Latches[1], Latches[2]};
+    unsigned char p, bit, changed;
+    for (p = 0; p < 3; p++) {
+        changed = now[p] ^ pinsRecorded[p];
+        if (changed) {
+            for (bit = 0; bit < 8; bit++) {
+                if (changed & (1 << bit)) {
+                    SimAddEdge(SIM_PIN(p, bit), (now[p] >> bit) & 1);
+                }
+            }
+            pinsRecorded[p] = now[p];
+        }
+    }
+}
+
+unsigned long SimPulses(unsigned char pin, unsigned long from, unsigned long *start, unsigned long *width, unsigned long size) {
+    unsigned long n, count = 0, rise = 0;
+    unsigned char high = 0;
+    for (n = 0; n < SimEdgeCount && count < size; n++) {
+        if (SimEdges[n].pin != pin) {
+            continue;
+        }
+        if (SimEdges[n].level) {
+            rise = SimEdges[n].time;
+            high = 1;
+        } else if (high) {
+            high = 0;
+            if (rise >= from) {
+                start[count] = rise;
+                width[count] = SimEdges[n].time - rise;
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+unsigned char SimFirmwarePin(unsigned char pin) {
+    unsigned char bit = 0;
+    while (!(PinMask[pin] & (1 << bit))) {
+        bit++;
+    }
+    return SIM_PIN(PinPort[pin], bit);
+}
+
+void SimSetPort(unsigned char port, unsigned char value) {
+    if (port == PORT_A) {
+        if ((PORTA ^ value) & IOCA) {
+            INTCONbits.RABIF = 1;
+        }
+        PORTA = value;
+    } else if (port == PORT_B) {
+        if ((PORTB ^ value) & IOCB) {
+            INTCONbits.RABIF = 1;
+        }
+        PORTB = value;
+    } else {
+        PORTC = value;
+    }
+    SimTakeInterrupts();
+}
+
+/*
+ * A timer that the firmware wrote starts counting from the new value and its
+ * prescaler starts again, the same as on the chip. An EEPROM write starts when
+ * WR is set.
+ */
+static void SimCheckWrites(void) {
+    if (Timer0 != timer0Set) {
+        prescale0 = 0;
+        timer0Set = Timer0;
+    }
+    if (Timer1 != timer1Set) {
+        prescale1 = 0;
+        timer1Set = Timer1;
+    }
+    if (Timer3 != timer3Set) {
+        prescale3 = 0;
+        timer3Set = Timer3;
+    }
+    if (EEControl.WR && eepromLeft == 0) {
+        if (!EEControl.WREN) {
+            //The write isn't allowed
+            EEControl.WR = 0;
+            EEControl.WRERR = 1;
+        } else {
+            eepromLeft = SimEEPROMWriteCycles;
+            eepromAddress = EEADR;
+            eepromValue = EEData;
+        }
+    }
+}
+
+/*
+ * One instruction cycle.
+ */
+static void SimTick(void) {
+    static const unsigned char timer2Prescale[4] = {1, 4, 16, 16};
+    unsigned short compare;
+    SimTime++;
+    if (T0CONbits.TMR0ON && !T0CONbits.T0CS &&
+            (T0CONbits.PSA || ++prescale0 >= (2UL << T0CONbits.T0PS))) {
+        prescale0 = 0;
+        Timer0 = T0CONbits.T08BIT ? (Timer0 & 0xFF00) | ((Timer0 + 1) & 0xFF) : Timer0 + 1;
+        if ((T0CONbits.T08BIT ? Timer0 & 0xFF : Timer0) == 0) {
+            INTCONbits.TMR0IF = 1;
+        }
+    }
+    if (T1CONbits.TMR1ON && !T1CONbits.TMR1CS && ++prescale1 >= (1UL << T1CONbits.T1CKPS)) {
+        prescale1 = 0;
+        Timer1++;
+        if (Timer1 == 0) {
+            PIR1bits.TMR1IF = 1;
+        }
+    }
+    if (T3CONbits.TMR3ON && !T3CONbits.TMR3CS && ++prescale3 >= (1UL << T3CONbits.T3CKPS)) {
+        prescale3 = 0;
+        Timer3++;
+        if (Timer3 == 0) {
+            PIR2bits.TMR3IF = 1;
+        }
+    }
+    //The compare modes set CCP1IF when the timer matches
+    if (CCP1CONbits.CCP1M >= 0b1000 && CCP1CONbits.CCP1M <= 0b1011) {
+        compare = T3CONbits.T3CCP1 ? Timer3 : Timer1;
+        if (compare == CCPR1 && (T3CONbits.T3CCP1 ? prescale3 : prescale1) == 0) {
+            PIR1bits.CCP1IF = 1;
+        }
+    }
+    if (T2CONbits.TMR2ON && ++prescale2 >= timer2Prescale[T2CONbits.T2CKPS]) {
+        prescale2 = 0;
+        if (TMR2 == PR2) {
+            TMR2 = 0;
+            if (++postscale2 > T2CONbits.T2OUTPS) {
+                postscale2 = 0;
+                PIR1bits.TMR2IF = 1;
+            }
+        } else {
+            TMR2++;
+        }
+    }
+    if (eepromLeft && --eepromLeft == 0) {
+        SimEEPROM[eepromAddress] = eepromValue;
+        SimEEPROMWrites++;
+        EEControl.WR = 0;
+        PIR2bits.EEIF = 1;
+    }
+    timer0Set = Timer0;
+    timer1Set = Timer1;
+    timer3Set = Timer3;
+}
+
+/*
+ * The interrupt sources that are waiting, for the high priority interrupt if
+ * high is set and the low priority one if it isn't. Without IPEN everything is
+ * high priority.
+ */
+static unsigned char SimPending(unsigned char high) {
+    unsigned char all = !RCONbits.IPEN;
+    return (PIR1bits.CCP1IF && PIE1bits.CCP1IE && (all || IPR1bits.CCP1IP == high)) ||
+            (PIR1bits.TMR1IF && PIE1bits.TMR1IE && (all || IPR1bits.TMR1IP == high)) ||
+            (PIR1bits.TMR2IF && PIE1bits.TMR2IE && (all || IPR1bits.TMR2IP == high)) ||
+            (PIR1bits.SSPIF && PIE1bits.SSPIE && (all || IPR1bits.SSPIP == high)) ||
+            (PIR2bits.TMR3IF && PIE2bits.TMR3IE && (all || IPR2bits.TMR3IP == high)) ||
+            (PIR2bits.EEIF && PIE2bits.EEIE && (all || IPR2bits.EEIP == high)) ||
+            (INTCONbits.TMR0IF && INTCONbits.TMR0IE && (all || INTCON2bits.TMR0IP == high)) ||
+            (INTCONbits.RABIF && INTCONbits.RABIE && (all || INTCON2bits.RABIP == high));
+}
+
+/*
+ * This runs one interrupt. The chip turns off GIEH (or GIEL) when it goes into
+ * the interrupt and RETFIE turns it back on.
+ */
+static void SimInterrupt(unsigned char level) {
+    unsigned char previous = SimLevel;
+    unsigned long start = SimTime, taken;
+    if (!RCONbits.IPEN) {
+        //The firmware always uses the priorities
+        SimFaults++;
+        printf("fault: interrupt taken before IPEN was set at cycle %lu\n", SimTime);
+    }
+    SimInterruptCount[level]++;
+    if (level == SIM_HIGH) {
+        INTCONbits.GIEH = 0;
+    } else {
+        INTCONbits.GIEL = 0;
+    }
+    SimLevel = level;
+    SimAdvance(SimEntryCycles);
+    if (level == SIM_HIGH) {
+        HighISR();
+    } else {
+        LowISR();
+    }
+    SimAdvance(SimISRCycles[level]);
+    SimLevel = previous;
+    if (level == SIM_HIGH) {
+        INTCONbits.GIEH = 1;
+    } else {
+        INTCONbits.GIEL = 1;
+    }
+    taken = SimTime - start;
+    SimBusyISR[level] += taken;
+    if (taken > SimLongestISR[level]) {
+        SimLongestISR[level] = taken;
+    }
+}
+
+/*
+ * This takes the interrupts that are waiting and allowed at this level.
+ */
+static void SimTakeInterrupts(void) {
+    while (1) {
+        if (SimLevel > SIM_HIGH && INTCONbits.GIEH && SimPending(1)) {
+            SimInterrupt(SIM_HIGH);
+        } else if (SimLevel > SIM_LOW && RCONbits.IPEN && INTCONbits.GIEH && INTCONbits.GIEL && SimPending(0)) {
+            SimInterrupt(SIM_LOW);
+        } else {
+            break;
+        }
+    }
+}
+
+void SimEnableInterrupts(void) {
+    SimRecordPins();
+    SimCheckWrites();
+    if (SimLevel == SIM_HIGH) {
+        //This would let the high priority interrupt interrupt itself
+        SimFaults++;
+        printf("fault: ei() in the high priority interrupt at cycle %lu\n", SimTime);
+    }
+    INTCONbits.GIE = 1;
+    SimTakeInterrupts();
+}
+
+/*
+ * This goes back to the test if the main loop has run for long enough.
+ */
+static void SimYield(void) {
+    if (inFirmware && SimLevel == SIM_MAIN && (SimTime >= runUntil || (runDone && runDone()))) {
+        swapcontext(&firmwareContext, &testContext);
+    }
+}
+
+void SimAdvance(unsigned long cycles) {
+    while (cycles--) {
+        SimRecordPins();
+        SimCheckWrites();
+        SimTick();
+        SimTakeInterrupts();
+        SimYield();
+    }
+    SimRecordPins();
+}
+
+/*
+ * The time a read of a timer or the EEPROM takes, see sim.h.
+ */
+static void SimRead(void) {
+    SimAdvance(SimLevel == SIM_MAIN ? SimMainCycles : SimReadCycles);
+}
+
+volatile unsigned short *SimTimer0(void) {
+    SimRead();
+    return &Timer0;
+}
+
+volatile unsigned short *SimTimer1(void) {
+    SimRead();
+    return &Timer1;
+}
+
+volatile unsigned short *SimTimer3(void) {
+    SimRead();
+    return &Timer3;
+}
+
+volatile unsigned char *SimLAT(unsigned char port) {
+    SimAdvance(SimLatchCycles);
+    return &Latches[port];
+}
+
+volatile unsigned char *SimSSPADD(void) {
+    return SSPCON1bits.SSPM == 0b1001 ? &SimSSPMask : &SimSSPAddress;
+}
+
+volatile EECON1bits_t *SimEECON1(void) {
+    SimRead();
+    if (EEControl.RD) {
+        EEControl.RD = 0;
+        EEData = SimEEPROM[EEADR];
+    }
+    return &EEControl;
+}
+
+volatile unsigned char *SimEEDATA(void) {
+    if (EEControl.RD) {
+        EEControl.RD = 0;
+        EEData = SimEEPROM[EEADR];
+    }
+    return &EEData;
+}
+
+static void SimFirmware(void) {
+    FirmwareMain();
+    printf("main() returned\n");
+    exit(2);
+}
+
+void SimStart(void) {
+    static unsigned char stack[1 << 20];
+    unsigned short n;
+    //The EEPROM is erased to 0xFF unless the test has put something in it
+    for (n = 0; n < 256 && SimEEPROM[n] == 0; n++);
+    if (n == 256) {
+        for (n = 0; n < 256; n++) {
+            SimEEPROM[n] = 0xFF;
+        }
+    }
+    getcontext(&firmwareContext);
+    firmwareContext.uc_stack.ss_sp = stack;
+    firmwareContext.uc_stack.ss_size = sizeof(stack);
+    firmwareContext.uc_link = 0;
+    makecontext(&firmwareContext, SimFirmware, 0);
+    firmwareStarted = 1;
+}
+
+int SimRunUntil(int (*done)(void), unsigned long cycles) {
+    if (done && done()) {
+        return 1;
+    }
+    runUntil = SimTime + cycles;
+    runDone = done;
+    if (firmwareStarted) {
+        inFirmware = 1;
+        swapcontext(&testContext, &firmwareContext);
+        inFirmware = 0;
+    } else {
+        while (SimTime < runUntil && !(done && done())) {
+            SimAdvance(1);
+        }
+    }
+    runDone = 0;
+    return done ? done() : 0;
+}
+
+void SimRun(unsigned long cycles) {
+    SimRunUntil(0, cycles);
+}
+
+int SimExit(void) {
+    if (SimFaults) {
+        printf("%lu simulation faults\n", SimFaults);
+    }
+    if (SimFailures || SimFaults) {
+        printf("FAILED\n");
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
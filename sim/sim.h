@@ -0,0 +1,173 @@
+/*
+ * file: sim/sim.h
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * The host simulation of the controller. The firmware sources are built
+ * unchanged against the mock xc.h in this directory and run on a simulated
+ * clock counted in instruction cycles (4 a microsecond).
+ *
+ *  - Timer0-3, CCP1 and the EEPROM count with the clock and set their flags
+ *    at the right cycle.
+ *  - The interrupts are taken with the same rules as the PIC18: the high
+ *    priority one can interrupt the low priority one and the main loop,
+ *    nothing interrupts the high priority one, and di() holds both off.
+ *  - Every change of LATA, LATB and LATC is recorded with the cycle it
+ *    happened on, see SimEdges.
+ *  - The i2c master in i2cmaster.c drives the MSSP registers the way the bus
+ *    does, a byte at a time with clock stretching.
+ *
+ * Code doesn't take any time to run except where the cost model says so.
+ * Reading a timer or the EEPROM control register moves the clock on by
+ * SimReadCycles in an interrupt and by SimMainCycles in the main loop, that
+ * is what lets the main loop and the busy waits get anywhere. Each use of
+ * LATA, LATB or LATC takes SimLatchCycles, so a pin that is turned on and off
+ * in the same interrupt has a width. Going into an interrupt takes
+ * SimEntryCycles and each interrupt takes SimISRCycles more when it returns,
+ * so the time an interrupt holds the others off can be set by the test.
+ *
+ * So the clock is not a cycle count of the firmware. The costs are set by
+ * hand and the C code between them runs in no time, so the harness can check
+ * when the edges happen and how long the interrupts hold each other off for
+ * interrupts of a given length, but it can't say how many cycles a function
+ * like HighISR or CheckPWMOutput takes on the chip. That needs the XC8
+ * listing or the stopwatch of the MPLAB simulator, the cycle figures in the
+ * comments of the firmware are counted by hand from the C.
+ *
+ * The firmware is built with int as a 16 bit type so that the timer
+ * arithmetic wraps the same as it does on the chip. This header does the
+ * same for the firmware declarations, so include it after any system headers
+ * and don't use int to talk to the firmware without going through these.
+ *
+ * SimStart runs main() from main.c on its own stack and SimRun lets it go for
+ * a number of cycles, the test gets control back between main loop
+ * instructions, never in the middle of an interrupt.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdio.h>
+
+#define int short
+#include "../parameters.h"
+
+//Functions and values that are only declared in the file that has them
+void FirmwareMain(void);
+void HighISR(void);
+void LowISR(void);
+void ControlTick(void);
+void BuildPWMEdges(void);
+void WriteRegister(unsigned char address, unsigned char value);
+unsigned char ReadRegister(unsigned char address);
+extern unsigned char PECEnable;
+extern unsigned char PECReadLength;
+extern unsigned char PECErrors;
+extern const unsigned char PinPort[12];
+extern const unsigned char PinMask[12];
+extern volatile unsigned int PerfMaxLoop;
+extern volatile unsigned int PerfMaxISR;
+extern volatile unsigned int PerfMaxI2C;
+#undef int
+
+//The clock, in instruction cycles
+#define SIM_US(us) ((unsigned long)(us) * 4)
+#define SIM_MS(ms) ((unsigned long)(ms) * 4000)
+extern unsigned long SimTime;
+
+//The cost model, see above
+extern unsigned long SimReadCycles;
+extern unsigned long SimMainCycles;
+extern unsigned long SimLatchCycles;
+extern unsigned long SimEntryCycles;
+extern unsigned long SimISRCycles[2];
+#define SIM_HIGH 0
+#define SIM_LOW 1
+
+//The interrupt that is running, SIM_MAIN when it is the main loop, and the
+//number of times each one has been taken
+#define SIM_MAIN 2
+extern unsigned char SimLevel;
+extern unsigned long SimInterruptCount[2];
+//The longest time each interrupt took, from the cycle it was due to the
+//cycle it returned, and the total cycles spent in each
+extern unsigned long SimLongestISR[2];
+extern unsigned long SimBusyISR[2];
+
+//The EEPROM, tests can fill it before SimStart. A write takes
+//SimEEPROMWriteCycles.
+extern unsigned char SimEEPROM[256];
+extern unsigned long SimEEPROMWriteCycles;
+extern unsigned long SimEEPROMWrites;
+
+//Faults the simulation found, like an EEPROM write with the interrupts on
+extern unsigned long SimFaults;
+
+//Start the firmware from main() and run it. SimRunUntil stops early when
+//done gives non zero, it gives 0 if it ran out of time.
+void SimStart(void);
+void SimRun(unsigned long cycles);
+int SimRunUntil(int (*done)(void), unsigned long cycles);
+//Move the clock on without running the main loop, interrupts are still taken
+void SimAdvance(unsigned long cycles);
+
+//Pins are numbered port * 8 + bit, the same as the firmware's PORT_A etc.
+#define SIM_PIN(port, bit) ((port) * 8 + (bit))
+//The pin that a firmware pin number (see PinPort in pwm.c) is on
+unsigned char SimFirmwarePin(unsigned char pin);
+
+//One change of an output pin
+struct SimEdge {
+    unsigned long time;
+    unsigned char pin;
+    unsigned char level;
+};
+extern struct SimEdge *SimEdges;
+extern unsigned long SimEdgeCount;
+void SimClearEdges(void);
+//This gives the number of whole high pulses on a pin that started at or
+//after from, with the start and the width of each one
+unsigned long SimPulses(unsigned char pin, unsigned long from, unsigned long *start, unsigned long *width, unsigned long size);
+
+//The input pins, a change on a pin with interrupt on change sets RABIF
+void SimSetPort(unsigned char port, unsigned char value);
+
+//The i2c master, see i2cmaster.c. Addresses are 7 bit. The functions give
+//the number of bytes that were acknowledged, including the address.
+extern unsigned long SimI2CBitCycles;
+extern unsigned long SimI2CTimeouts;
+extern unsigned char SimI2CAddress;
+int SimI2CWrite(unsigned char address, const unsigned char *bytes, int count);
+int SimI2CRead(unsigned char address, unsigned char *bytes, int count);
+int SimI2CWriteRead(unsigned char address, const unsigned char *out, int outCount, unsigned char *in, int inCount);
+//Register writes and reads to SimI2CAddress, with the PEC added and checked
+//when pec is set. SimI2CReadRegisters gives -1 if the PEC was wrong.
+int SimI2CWriteRegisters(unsigned char reg, const unsigned char *values, int count, int pec);
+int SimI2CReadRegisters(unsigned char reg, unsigned char *values, int count, int pec);
+unsigned char SimCRC8(unsigned char crc, const unsigned char *bytes, int count);
+
+//Checks for the tests, SimExit gives the exit status
+extern unsigned long SimFailures;
+#define SIM_CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            SimFailures++; \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+        } \
+    } while (0)
+int SimExit(void);
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * file: sim/test_boot.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This starts the controller, sets the speed of motor 0 over i2c and checks
+ * the pulses on its pin and the speed read back.
+ */
+
+#include "sim.h"
+
+int main(void) {
+    unsigned long start[8], width[8];
+    unsigned long count, period, n;
+    unsigned char value = 128, readBack = 0;
+    unsigned char pin = SimFirmwarePin(0);
+
+    //A controller that has had its pwm config saved before
+    for (n = 0; n < 256; n++) {
+        SimEEPROM[n] = 0xFF;
+    }
+    SimEEPROM[EEPROM_PWM_CONFIG] = EEPROM_PWM_CONFIG_MARKER;
+    SimEEPROM[EEPROM_PWM_CONFIG + 1] = (unsigned char)PWM_PERIOD_TICKS;
+    SimEEPROM[EEPROM_PWM_CONFIG + 2] = (unsigned char)(PWM_PERIOD_TICKS >> 8);
+    SimEEPROM[EEPROM_PWM_CONFIG + 3] = PWM_PRESCALE;
+
+    SimStart();
+    SimRun(SIM_MS(5));
+    SIM_CHECK(SimI2CWriteRegisters(MOTOR_0_SPEED_ADDRESS, &value, 1, 0) == 3, "speed write not acknowledged");
+    SIM_CHECK(SimI2CReadRegisters(MOTOR_0_SPEED_ADDRESS, &readBack, 1, 0) == 1, "speed read failed");
+    SIM_CHECK(readBack == value, "speed read back as %u", readBack);
+
+    SimClearEdges();
+    SimRun(SIM_MS(100));
+    count = SimPulses(pin, 0, start, width, 8);
+    SIM_CHECK(count >= 4, "%lu pulses on motor 0", count);
+    //The default period is 8192 Timer1 ticks of 2us
+    period = SIM_US(2UL * PWM_PERIOD_TICKS);
+    for (n = 1; n < count && n < 8; n++) {
+        SIM_CHECK(start[n] - start[n - 1] == period, "pulse %lu started %lu cycles after the one before", n, start[n] - start[n - 1]);
+        SIM_CHECK(width[n] * 256 / period >= 127 && width[n] * 256 / period <= 129, "pulse %lu is %lu cycles wide", n, width[n]);
+    }
+    return SimExit();
+}
@@ -0,0 +1,116 @@
+/*
+ * file: sim/test_bus.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This hammers the i2c bus while four DC motors run and measures the error of
+ * every pwm pulse. The i2c is handled by the low priority interrupt, so the
+ * pwm edges from the high priority interrupt shouldn't move however busy the
+ * bus is, how slow the master is or how long each i2c interrupt takes.
+ *
+ * The traffic is back to back writes of the speeds the motors already have
+ * and reads of the status block, at 400kHz and at 10kHz. The slow bus is
+ * also run with the i2c interrupt made to take 200us, much longer than a
+ * pwm edge can wait.
+ */
+
+#include "sim.h"
+
+#define PULSES 32
+//A 2ms period with the default prescaler
+#define PERIOD 1000
+#define PRESCALE 3
+//The most an edge can be out, the same as in test_jitter.c
+#define JITTER SIM_US(10)
+
+static const unsigned char Duties[4] = {32, 64, 64, 200};
+
+/*
+ * This gives the worst width error of the pulses since from, checking that
+ * there are PULSES of them on every motor.
+ */
+static unsigned long WorstError(const char *name, unsigned long from) {
+    unsigned long start[PULSES], width[PULSES];
+    unsigned long count, n, expected, error, worst = 0;
+    unsigned char m;
+    for (m = 0; m < 4; m++) {
+        //The duty is scaled to the period the same as BuildPWMEdges does
+        expected = (((unsigned long)Duties[m] << 8) * PERIOD >> 16) << PRESCALE;
+        count = SimPulses(SimFirmwarePin(MotorPinNumbers[m].pwm), from, start, width, PULSES);
+        SIM_CHECK(count == PULSES, "%s: %lu pulses on motor %u", name, count, m);
+        for (n = 0; n < count; n++) {
+            error = width[n] > expected ? width[n] - expected : expected - width[n];
+            if (error > worst) {
+                worst = error;
+            }
+        }
+    }
+    return worst;
+}
+
+/*
+ * This runs the bus with back to back transactions for the time the pulses
+ * take and checks every pulse.
+ */
+static void Hammer(const char *name, unsigned long bitCycles, unsigned long isrCycles) {
+    unsigned long from, end, worst, transactions = 0, bad = 0;
+    unsigned char status[STATUS_LENGTH];
+
+    SimI2CBitCycles = bitCycles;
+    SimISRCycles[SIM_LOW] = isrCycles;
+    SimLongestISR[SIM_LOW] = 0;
+    from = SimTime;
+    end = from + SIM_MS(2 * PULSES + 4);
+    while (SimTime < end) {
+        if (transactions & 1) {
+            if (SimI2CReadRegisters(STATUS_ADDRESS, status, STATUS_LENGTH, 0) != STATUS_LENGTH ||
+                    status[2] != Duties[0] || status[5] != Duties[3]) {
+                bad++;
+            }
+        } else if (SimI2CWriteRegisters(MOTOR_0_SPEED_ADDRESS, Duties, 4, 0) != 6) {
+            bad++;
+        }
+        transactions++;
+    }
+    worst = WorstError(name, from);
+    printf("%s: %lu transactions, the i2c interrupt held on for up to %lu cycles, "
+            "pulses out by up to %lu cycles\n", name, transactions, SimLongestISR[SIM_LOW], worst);
+    SIM_CHECK(bad == 0, "%s: %lu transactions failed", name, bad);
+    SIM_CHECK(worst <= JITTER, "%s: a pulse was out by %lu cycles", name, worst);
+}
+
+int main(void) {
+    unsigned char period[3] = {(unsigned char)PERIOD, PERIOD >> 8, PRESCALE};
+    unsigned long from;
+
+    SimStart();
+    SimRun(SIM_MS(5));
+    SimI2CWriteRegisters(PWM_PERIOD_ADDRESS, period, 3, 0);
+    SimI2CWriteRegisters(MOTOR_0_SPEED_ADDRESS, Duties, 4, 0);
+    //Two of the default 16ms periods can go by before the new one starts
+    SimRun(SIM_MS(40));
+
+    //The same time with nothing on the bus
+    from = SimTime;
+    SimRun(SIM_MS(2 * PULSES + 4));
+    printf("quiet bus: pulses out by up to %lu cycles\n", WorstError("quiet bus", from));
+
+    //A bit is 2.5us at 400kHz
+    Hammer("400kHz", 10, 12);
+    Hammer("10kHz", SIM_US(100), 12);
+    Hammer("10kHz with a 200us i2c interrupt", SIM_US(100), SIM_US(200));
+    SIM_CHECK(SimI2CTimeouts == 0, "the firmware held the clock too long %lu times", SimI2CTimeouts);
+    return SimExit();
+}
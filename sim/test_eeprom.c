@@ -0,0 +1,48 @@
+/*
+ * file: sim/test_eeprom.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This checks that the pwm config is saved in the EEPROM without holding up
+ * the main loop or turning the interrupts on, starting from an EEPROM that has
+ * never been written.
+ */
+
+#include "sim.h"
+
+int main(void) {
+    unsigned char config[3] = {0x00, 0x10, 2};
+
+    SimStart();
+    //The defaults are saved at start up, before the interrupts are set up
+    SimRun(SIM_MS(30));
+    SIM_CHECK(SimEEPROM[EEPROM_PWM_CONFIG] == EEPROM_PWM_CONFIG_MARKER, "the defaults weren't saved");
+    SIM_CHECK(SimEEPROM[EEPROM_PWM_CONFIG + 1] == (unsigned char)PWM_PERIOD_TICKS &&
+            SimEEPROM[EEPROM_PWM_CONFIG + 2] == PWM_PERIOD_TICKS >> 8 &&
+            SimEEPROM[EEPROM_PWM_CONFIG + 3] == PWM_PRESCALE, "the defaults were saved wrong");
+
+    //A new config is saved a byte at a time from the main loop
+    PerfMaxLoop = 0;
+    SIM_CHECK(SimI2CWriteRegisters(PWM_PERIOD_ADDRESS, config, 3, 0) == 5, "config write not acknowledged");
+    SimRun(SIM_MS(30));
+    SIM_CHECK(SimEEPROM[EEPROM_PWM_CONFIG] == EEPROM_PWM_CONFIG_MARKER &&
+            SimEEPROM[EEPROM_PWM_CONFIG + 1] == config[0] &&
+            SimEEPROM[EEPROM_PWM_CONFIG + 2] == config[1] &&
+            SimEEPROM[EEPROM_PWM_CONFIG + 3] == config[2], "the new config wasn't saved");
+    //Each EEPROM write takes 4ms, the loop mustn't wait for one. PerfMaxLoop
+    //is in Timer1 ticks, which are now 1us.
+    SIM_CHECK(PerfMaxLoop < 1000, "a main loop took %u ticks", PerfMaxLoop);
+    return SimExit();
+}
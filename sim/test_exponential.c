@@ -0,0 +1,102 @@
+/*
+ * file: sim/test_exponential.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This checks the exponential acceleration profile against the ideal curve.
+ * Every step in the tables in exponential.c has to be the ideal step rounded,
+ * and the ramps up and down that the control tick makes with each curve have
+ * to stay close to d * e^(-k/tau), never overshoot and finish.
+ *
+ * Each rounded step is out by at most half a duty, and the distance shrinks by
+ * 1 - 1/tau of itself each step, so the error of a whole ramp is at most about
+ * 0.5 * tau, more than a single step. Near the end every step is 1, which
+ * gets there before the ideal curve does.
+ */
+
+#include <math.h>
+#include "sim.h"
+
+//The time constant of each curve, these are TIME_CONSTANTS in
+//tools/exponential.py
+static const unsigned char TimeConstants[EXPONENTIAL_CURVES] = {4, 8, 16, 32};
+
+/*
+ * This checks every step in the table for one curve.
+ */
+static void CheckTable(unsigned char curve) {
+    double fraction = 1 - exp(-1.0 / TimeConstants[curve]), ideal;
+    unsigned int distance;
+    unsigned char step;
+    SIM_CHECK(ExponentialSteps[curve][0] == 0, "curve %u moves when it is at the target", curve);
+    for (distance = 1; distance < 256; distance++) {
+        step = ExponentialSteps[curve][distance];
+        ideal = distance * fraction;
+        SIM_CHECK(step >= 1 && step <= distance, "curve %u has a step of %u at %u", curve, step, distance);
+        SIM_CHECK(fabs(step - ideal) <= 0.5 || (ideal < 0.5 && step == 1),
+                "curve %u has a step of %u at %u, the ideal step is %.2f", curve, step, distance, ideal);
+    }
+}
+
+/*
+ * This runs a ramp from start to target with one curve, one acceleration step
+ * each control tick, and checks it against the ideal curve.
+ */
+static void CheckRamp(unsigned char curve, unsigned char start, unsigned char target) {
+    double tau = TimeConstants[curve], fraction = 1 - exp(-1.0 / tau);
+    double ideal, error, worst = 0, bound = 0.5 / fraction + 1;
+    unsigned int from = start > target ? start - target : target - start, distance, last = from;
+    unsigned int k, limit = (unsigned int)(tau * log(2.0 * from) + 0.5 / fraction) + 2;
+
+    Motors[0].accelType = ACCEL_INSTANT;
+    Motors[0].target = start;
+    ControlTick();
+    Motors[0].accelType = ACCEL_EXPONENT;
+    Motors[0].accelRate = 1;
+    Motors[0].accelCurve = curve;
+    Motors[0].target = target;
+    for (k = 1; k <= limit && last != 0; k++) {
+        ControlTick();
+        distance = Motors[0].duty > target ? Motors[0].duty - target : target - Motors[0].duty;
+        SIM_CHECK(distance < last, "curve %u, %u to %u: the duty went from %u to %u away at step %u",
+                curve, start, target, last, distance, k);
+        SIM_CHECK((Motors[0].duty >= target) == (start > target) || distance == 0,
+                "curve %u, %u to %u: the target was overshot at step %u", curve, start, target, k);
+        ideal = from * exp(-(double)k / tau);
+        error = fabs(distance - ideal);
+        if (error > worst) {
+            worst = error;
+        }
+        last = distance;
+    }
+    printf("curve %u (tau %u), %u to %u: %u steps, at most %.2f from the ideal curve\n",
+            curve, TimeConstants[curve], start, target, k - 1, worst);
+    SIM_CHECK(last == 0, "curve %u, %u to %u: not there after %u steps", curve, start, target, limit);
+    SIM_CHECK(worst <= bound, "curve %u, %u to %u: %.2f from the ideal curve, more than %.2f",
+            curve, start, target, worst, bound);
+}
+
+int main(void) {
+    unsigned char curve;
+    InitPWM();
+    for (curve = 0; curve < EXPONENTIAL_CURVES; curve++) {
+        CheckTable(curve);
+        CheckRamp(curve, 0, 255);
+        CheckRamp(curve, 255, 0);
+        CheckRamp(curve, 40, 200);
+        CheckRamp(curve, 200, 199);
+    }
+    return SimExit();
+}
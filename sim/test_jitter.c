@@ -0,0 +1,151 @@
+/*
+ * file: sim/test_jitter.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This measures the error of every pwm edge of four DC motors, with a short
+ * and a long main loop. The edges come from the CCP1 interrupt so the error
+ * should be a few cycles and not change with the main loop. A pwm made by
+ * polling the timer from the main loop, the way it used to be done, can only
+ * change a pin once a pass, so the longest pass is printed next to it.
+ *
+ * With all four motors at the same duty it also checks that their pins switch
+ * together. The pins are written a port at a time with masks, so the pins on
+ * the same port switch on the same cycle and the ports are only the latch
+ * writes between them apart. Setting the pins one at a time, the way SetPin()
+ * used to, put each motor's edge a pin's worth of code after the last one.
+ */
+
+#include "sim.h"
+
+#define PULSES 32
+//A 2ms period with the default prescaler
+#define PERIOD 1000
+#define PRESCALE 3
+//The most an edge can be out, the time to get into the interrupt and to do
+//the edges before it in the same interrupt
+#define JITTER SIM_US(10)
+
+static const unsigned char Duties[4] = {32, 64, 64, 200};
+
+/*
+ * This runs the motors with the main loop taking loopCycles each time it
+ * reads a timer and checks every pulse.
+ */
+static void CheckJitter(unsigned long loopCycles) {
+    unsigned long start[PULSES], width[PULSES];
+    unsigned long count, n, from, expected, error, worst = 0, periodError, worstPeriod = 0;
+    unsigned char m;
+
+    SimMainCycles = loopCycles;
+    //Two of the default 16ms periods can go by before the new one starts
+    SimRun(SIM_MS(40));
+    PerfMaxLoop = 0;
+    from = SimTime;
+    SimRun(SIM_MS(2 * PULSES + 4));
+    for (m = 0; m < 4; m++) {
+        //The duty is scaled to the period the same as BuildPWMEdges does
+        expected = (((unsigned long)Duties[m] << 8) * PERIOD >> 16) << PRESCALE;
+        count = SimPulses(SimFirmwarePin(MotorPinNumbers[m].pwm), from, start, width, PULSES);
+        SIM_CHECK(count == PULSES, "loop %lu: %lu pulses on motor %u", loopCycles, count, m);
+        for (n = 0; n < count; n++) {
+            error = width[n] > expected ? width[n] - expected : expected - width[n];
+            if (error > worst) {
+                worst = error;
+            }
+            if (n) {
+                periodError = start[n] - start[n - 1];
+                periodError = periodError > (PERIOD << PRESCALE) ? periodError - (PERIOD << PRESCALE) :
+                        (PERIOD << PRESCALE) - periodError;
+                if (periodError > worstPeriod) {
+                    worstPeriod = periodError;
+                }
+            }
+        }
+    }
+    printf("main loop %lu cycles a read: edges out by up to %lu cycles, periods by %lu, "
+            "a polling loop would be out by up to %lu\n",
+            loopCycles, worst, worstPeriod, (unsigned long)PerfMaxLoop << PRESCALE);
+    SIM_CHECK(worst <= JITTER, "loop %lu: an edge was out by %lu cycles", loopCycles, worst);
+    SIM_CHECK(worstPeriod <= JITTER, "loop %lu: a period was out by %lu cycles", loopCycles, worstPeriod);
+}
+
+/*
+ * This runs all four motors at the same duty and checks how far apart their
+ * edges are in each period.
+ */
+static void CheckSkew(void) {
+    unsigned long start[4][PULSES], width[4][PULSES];
+    unsigned long count, n, from, rise, fall, worstSame = 0, worst = 0, lowest, highest;
+    unsigned char m, pin, duty = 128, samePort[4];
+
+    for (m = 0; m < 4; m++) {
+        SimI2CWriteRegisters(MOTOR_0_SPEED_ADDRESS + m, &duty, 1, 0);
+        samePort[m] = PinPort[MotorPinNumbers[m].pwm] == PinPort[MotorPinNumbers[0].pwm];
+    }
+    SimRun(SIM_MS(40));
+    from = SimTime;
+    SimRun(SIM_MS(2 * PULSES + 4));
+    for (m = 0; m < 4; m++) {
+        pin = SimFirmwarePin(MotorPinNumbers[m].pwm);
+        count = SimPulses(pin, from, start[m], width[m], PULSES);
+        SIM_CHECK(count == PULSES, "same duty: %lu pulses on motor %u", count, m);
+    }
+    for (n = 0; n < PULSES; n++) {
+        lowest = ~0UL;
+        highest = 0;
+        for (m = 0; m < 4; m++) {
+            rise = start[m][n] > start[0][n] ? start[m][n] - start[0][n] : start[0][n] - start[m][n];
+            fall = start[m][n] + width[m][n];
+            fall = fall > start[0][n] + width[0][n] ? fall - start[0][n] - width[0][n] :
+                    start[0][n] + width[0][n] - fall;
+            if (samePort[m] && (rise > worstSame || fall > worstSame)) {
+                worstSame = rise > fall ? rise : fall;
+            }
+            if (start[m][n] < lowest) {
+                lowest = start[m][n];
+            }
+            if (start[m][n] > highest) {
+                highest = start[m][n];
+            }
+            if (fall > worst) {
+                worst = fall;
+            }
+        }
+        if (highest - lowest > worst) {
+            worst = highest - lowest;
+        }
+    }
+    printf("same duty: pins on one port up to %lu cycles apart, all four up to %lu\n", worstSame, worst);
+    SIM_CHECK(worstSame == 0, "same duty: pins on the same port switched %lu cycles apart", worstSame);
+    //One latch write for each of the other two ports
+    SIM_CHECK(worst <= 2 * SimLatchCycles, "same duty: the motors switched %lu cycles apart", worst);
+}
+
+int main(void) {
+    unsigned char period[3] = {(unsigned char)PERIOD, PERIOD >> 8, PRESCALE};
+    unsigned char m;
+
+    SimStart();
+    SimRun(SIM_MS(5));
+    SimI2CWriteRegisters(PWM_PERIOD_ADDRESS, period, 3, 0);
+    for (m = 0; m < 4; m++) {
+        SimI2CWriteRegisters(MOTOR_0_SPEED_ADDRESS + m, &Duties[m], 1, 0);
+    }
+    CheckJitter(100);
+    CheckJitter(2000);
+    CheckSkew();
+    return SimExit();
+}
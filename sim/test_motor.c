@@ -0,0 +1,223 @@
+/*
+ * file: sim/test_motor.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This runs motor 0 against a simple model of a DC motor with a quadrature
+ * encoder on RA0 and RA1. The speed of the model follows the average voltage
+ * from the pwm and direction pins with a time constant, and every count it
+ * turns changes the encoder pins the way a real encoder does.
+ *
+ * The PID speed control has to hold a speed when the supply drops, which an
+ * open loop duty can't do, and the encoder position read over i2c has to be
+ * the count the model turned. A move of a set number of counts has to show
+ * that it is moving, stop near its goal and clear its flag, forwards and
+ * backwards through a change of direction.
+ */
+
+#include "sim.h"
+
+//The model is run in slices this long
+#define SLICE SIM_US(100)
+//The speed at full duty and full supply in counts a millisecond, and the
+//time constant of the motor
+#define FREE_SPEED 8.0
+#define TAU SIM_MS(30)
+//The PID target, counts each control tick (ms)
+#define PID_SPEED 3
+//How far out the speed held by the PID can be
+#define PID_TOLERANCE 0.03
+//The moves, with the linear acceleration and a minimum duty that keeps the
+//motor turning at the end
+#define MOVE_DISTANCE 3000L
+#define MOVE_DUTY 200
+#define MINIMUM_DUTY 40
+//How far past the goal the motor can be when a move stops driving it, it is
+//checked once a control tick
+#define MOVE_TOLERANCE 4
+
+static unsigned char PWMPin, DirPin;
+
+//The state of the model
+static double Supply = 1.0, Speed = 0, Position = 0;
+static long Count = 0;
+static unsigned char PWMLevel = 0, DirLevel = 0;
+
+/*
+ * This gives the encoder pins for a count, the A channel is bit 0 and B is
+ * bit 1. Counting up goes 0, 1, 3, 2.
+ */
+static unsigned char EncoderPins(long count) {
+    static const unsigned char gray[4] = {0, 1, 3, 2};
+    return gray[count & 3];
+}
+
+/*
+ * This runs the firmware and the model for cycles.
+ */
+static void RunMotor(unsigned long cycles) {
+    unsigned long end = SimTime + cycles, start, high, last, n;
+    double applied;
+    while (SimTime < end) {
+        start = SimTime;
+        SimRun(SLICE);
+        //The time the pwm pin was on during the slice, the i2c writes run
+        //the firmware between the slices so the first edges can be earlier
+        high = 0;
+        last = start;
+        for (n = 0; n < SimEdgeCount; n++) {
+            if (SimEdges[n].pin == PWMPin) {
+                if (PWMLevel && SimEdges[n].time > last) {
+                    high += SimEdges[n].time - last;
+                }
+                if (SimEdges[n].time > last) {
+                    last = SimEdges[n].time;
+                }
+                PWMLevel = SimEdges[n].level;
+            } else if (SimEdges[n].pin == DirPin) {
+                DirLevel = SimEdges[n].level;
+            }
+        }
+        if (PWMLevel) {
+            high += SimTime - last;
+        }
+        SimClearEdges();
+        applied = Supply * high / (SimTime - start);
+        if (!DirLevel) {
+            applied = -applied;
+        }
+        Speed += (applied * FREE_SPEED - Speed) * (SimTime - start) / TAU;
+        Position += Speed * (SimTime - start) / SIM_MS(1);
+        while (Count < (long)Position - (Position < 0)) {
+            Count++;
+            SimSetPort(PORT_A, EncoderPins(Count));
+        }
+        while (Count > (long)Position - (Position < 0)) {
+            Count--;
+            SimSetPort(PORT_A, EncoderPins(Count));
+        }
+    }
+}
+
+static void WriteRegister8(unsigned char address, unsigned char value) {
+    SimI2CWriteRegisters(address, &value, 1, 0);
+}
+
+static long ReadPosition(void) {
+    unsigned char bytes[4];
+    SimI2CReadRegisters(ENCODER_ADDRESS, bytes, 4, 0);
+    return (long)((unsigned long)bytes[0] | ((unsigned long)bytes[1] << 8) |
+            ((unsigned long)bytes[2] << 16) | ((unsigned long)bytes[3] << 24));
+}
+
+/*
+ * This gives the counts the motor turns in ms milliseconds.
+ */
+static long MeasureSpeed(unsigned long ms) {
+    long from = Count;
+    RunMotor(SIM_MS(ms));
+    return Count - from;
+}
+
+/*
+ * This runs a move of distance counts and checks it. The firmware has to
+ * slow down to the minimum duty before the goal and stop driving the motor
+ * on the count, from there the motor coasts the way the model says.
+ */
+static void CheckMove(long distance) {
+    unsigned char bytes[4], moving = 0, seen = 0, duty = 0;
+    long goal = Count + distance, stopped = 0;
+    double speed = 0;
+    unsigned long ms;
+    bytes[0] = (unsigned char)distance;
+    bytes[1] = (unsigned char)(distance >> 8);
+    bytes[2] = (unsigned char)(distance >> 16);
+    bytes[3] = (unsigned char)(distance >> 24);
+    SimI2CWriteRegisters(MOTOR0_MOVE_ADDRESS, bytes, 4, 0);
+    WriteRegister8(MOTOR_0_SPEED_ADDRESS, MOVE_DUTY);
+    WriteRegister8(MOVE_ADDRESS, 1);
+    for (ms = 0; ms < 5000; ms++) {
+        duty = Motors[0].duty;
+        RunMotor(SIM_MS(1));
+        SimI2CReadRegisters(MOVE_ADDRESS, &moving, 1, 0);
+        if (!moving) {
+            stopped = Count;
+            speed = Speed;
+            break;
+        }
+        seen = 1;
+    }
+    SIM_CHECK(seen, "the move of %ld wasn't shown as moving", distance);
+    SIM_CHECK(!moving, "the move of %ld hadn't finished after %lu ms", distance, ms);
+    SIM_CHECK(duty == MINIMUM_DUTY, "the move of %ld was at a duty of %u just before the goal", distance, duty);
+    SIM_CHECK(Motors[0].duty == 0, "the move of %ld left a duty of %u", distance, Motors[0].duty);
+    RunMotor(SIM_MS(300));
+    printf("move of %ld counts: took %lu ms, stopped driving %ld past the goal at %.2f counts a ms, "
+            "coasted %ld more\n", distance, ms, distance < 0 ? goal - stopped : stopped - goal,
+            speed, Count - stopped);
+    if (distance < 0) {
+        stopped = -stopped;
+        goal = -goal;
+    }
+    SIM_CHECK(stopped - goal >= 0 && stopped - goal <= MOVE_TOLERANCE,
+            "the move of %ld stopped driving %ld from its goal", distance, stopped - goal);
+    SIM_CHECK(ReadPosition() == Count, "the encoder read %ld, the motor turned %ld", ReadPosition(), Count);
+}
+
+int main(void) {
+    unsigned char period[3] = {(unsigned char)1000, 1000 >> 8, 3};
+    long counts, openLoop;
+
+    PWMPin = SimFirmwarePin(0);
+    DirPin = SimFirmwarePin(1);
+    SimStart();
+    SimRun(SIM_MS(5));
+    SimI2CWriteRegisters(PWM_PERIOD_ADDRESS, period, 3, 0);
+    WriteRegister8(ENCODER_ENABLE_ADDRESS, 1);
+
+    //The PID has to hold its speed when the supply drops
+    WriteRegister8(MOTOR0_ACCEL_TYPE_ADDRESS, ACCEL_PID);
+    WriteRegister8(MOTOR_0_SPEED_ADDRESS, PID_SPEED);
+    RunMotor(SIM_MS(500));
+    counts = MeasureSpeed(200);
+    printf("PID at full supply: %ld counts in 200 ms at a duty of %u\n", counts, Motors[0].duty);
+    SIM_CHECK(counts >= 200 * PID_SPEED * (1 - PID_TOLERANCE) && counts <= 200 * PID_SPEED * (1 + PID_TOLERANCE),
+            "the PID held %ld counts in 200 ms at full supply", counts);
+    SIM_CHECK(ReadPosition() == Count, "the encoder read %ld, the motor turned %ld", ReadPosition(), Count);
+
+    Supply = 0.6;
+    RunMotor(SIM_MS(500));
+    counts = MeasureSpeed(200);
+    printf("PID at 60%% supply: %ld counts in 200 ms at a duty of %u\n", counts, Motors[0].duty);
+    SIM_CHECK(counts >= 200 * PID_SPEED * (1 - PID_TOLERANCE) && counts <= 200 * PID_SPEED * (1 + PID_TOLERANCE),
+            "the PID held %ld counts in 200 ms at 60%% supply", counts);
+
+    //The same duty with the PID off goes faster when the supply comes back
+    WriteRegister8(MOTOR0_ACCEL_TYPE_ADDRESS, ACCEL_INSTANT);
+    WriteRegister8(MOTOR_0_SPEED_ADDRESS, Motors[0].duty);
+    Supply = 1.0;
+    RunMotor(SIM_MS(500));
+    openLoop = MeasureSpeed(200);
+    printf("open loop at that duty and full supply: %ld counts in 200 ms\n", openLoop);
+    SIM_CHECK(openLoop > counts * (1 + 4 * PID_TOLERANCE), "the open loop speed didn't go up with the supply");
+
+    WriteRegister8(MOTOR_0_SPEED_ADDRESS, 0);
+    RunMotor(SIM_MS(300));
+    WriteRegister8(MOTOR0_ACCEL_TYPE_ADDRESS, ACCEL_LINEAR);
+    WriteRegister8(MOTOR0_MINIMUM_DUTY_ADDRESS, MINIMUM_DUTY);
+    CheckMove(MOVE_DISTANCE);
+    CheckMove(-MOVE_DISTANCE);
+    return SimExit();
+}
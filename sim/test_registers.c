@@ -0,0 +1,318 @@
+/*
+ * file: sim/test_registers.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This checks every address of the register map against parameters.h. Each
+ * register is written and committed the way the main loop does it and the
+ * value it should have changed is checked, along with the values of the other
+ * motors that it shouldn't have. Every address has to be checked by one of
+ * the Check functions, so a register added to the table without being added
+ * here fails.
+ */
+
+#include <stddef.h>
+#include "sim.h"
+
+//The addresses after the last register
+#define REGISTER_END (TRACE_DIVISOR_ADDRESS + 1)
+
+//What a Check function expects of a register
+//The value only changes at the commit
+#define SHADOWED 0x01
+//The value is one bit
+#define BIT 0x02
+//The value is a request that is taken at the commit
+#define REQUEST 0x04
+
+static unsigned char Covered[256];
+
+static void Cover(unsigned char address) {
+    SIM_CHECK(!Covered[address], "address %u is checked twice", address);
+    Covered[address] = 1;
+}
+
+static void Commit(void) {
+    WriteRegister(COMMIT_ADDRESS, 0);
+}
+
+static unsigned char *MotorByte(unsigned char motor, size_t offset) {
+    return (unsigned char *)&Motors[motor] + offset;
+}
+
+/*
+ * This checks a register for one motor that writes the value at write in the
+ * Motor struct and reads the value at read.
+ */
+static void CheckMotorRegister(unsigned char address, unsigned char motor, size_t write, size_t read,
+        unsigned char value, unsigned char flags) {
+    unsigned char before[4], n, expected = (flags & BIT) ? value & 1 : value;
+    Cover(address);
+    for (n = 0; n < 4; n++) {
+        before[n] = *MotorByte(n, write);
+    }
+    WriteRegister(address, value);
+    if (flags & SHADOWED) {
+        SIM_CHECK(*MotorByte(motor, write) == before[motor], "address %u changed before the commit", address);
+    }
+    Commit();
+    for (n = 0; n < 4; n++) {
+        if (n == motor) {
+            SIM_CHECK(*MotorByte(n, write) == expected, "address %u wrote %u to motor %u, not %u",
+                    address, *MotorByte(n, write), n, expected);
+        } else {
+            SIM_CHECK(*MotorByte(n, write) == before[n], "address %u changed motor %u", address, n);
+        }
+    }
+    SIM_CHECK(ReadRegister(address) == *MotorByte(motor, read), "address %u read %u, not %u",
+            address, ReadRegister(address), *MotorByte(motor, read));
+}
+
+/*
+ * This checks the four registers of a value that each motor has, starting at
+ * address, and the register before them that writes all four if all is set.
+ */
+static void CheckMotorGroup(unsigned char address, unsigned char all, size_t write, size_t read,
+        unsigned char value, unsigned char flags) {
+    unsigned char n, expected = (flags & BIT) ? value & 1 : value;
+    if (all) {
+        Cover(address);
+        WriteRegister(address, value);
+        Commit();
+        for (n = 0; n < 4; n++) {
+            SIM_CHECK(*MotorByte(n, write) == expected, "address %u wrote %u to motor %u, not %u",
+                    address, *MotorByte(n, write), n, expected);
+        }
+        SIM_CHECK(ReadRegister(address) == *MotorByte(0, read), "address %u read %u", address, ReadRegister(address));
+        address++;
+    }
+    for (n = 0; n < 4; n++) {
+        //A different value for each motor, so one landing on the wrong motor
+        //shows
+        CheckMotorRegister(address + n, n, write, read, (unsigned char)(value + 1 + n), flags);
+    }
+}
+
+/*
+ * This checks a register that holds two bits for each motor.
+ */
+static void CheckPacked(unsigned char address, size_t write, size_t read, unsigned char flags) {
+    unsigned char value = 0b10010010, n, expected;
+    Cover(address);
+    WriteRegister(address, value);
+    Commit();
+    for (n = 0; n < 4; n++) {
+        expected = (value >> (2 * n)) & 0b11;
+        if (flags & BIT) {
+            expected = expected ? 1 : 0;
+        }
+        SIM_CHECK(*MotorByte(n, write) == expected, "address %u wrote %u to motor %u, not %u",
+                address, *MotorByte(n, write), n, expected);
+    }
+    expected = 0;
+    for (n = 0; n < 4; n++) {
+        expected |= (unsigned char)((*MotorByte(n, read) & 0b11) << (2 * n));
+    }
+    SIM_CHECK(ReadRegister(address) == expected, "address %u read %u, not %u", address, ReadRegister(address), expected);
+}
+
+/*
+ * This checks a register for a value that isn't a motor's. The write goes to
+ * write and leaves expected there after the commit, the read comes from read.
+ */
+static void CheckGlobal(unsigned char address, volatile unsigned char *write, volatile unsigned char *read,
+        unsigned char value, unsigned char expected, unsigned char flags) {
+    unsigned char before = *write;
+    Cover(address);
+    WriteRegister(address, value);
+    if (flags & SHADOWED) {
+        SIM_CHECK(*write == before, "address %u changed before the commit", address);
+    } else if (flags & REQUEST) {
+        SIM_CHECK(*write == value, "address %u wrote %u, not %u", address, *write, value);
+    } else {
+        SIM_CHECK(*write == expected, "address %u wrote %u, not %u", address, *write, expected);
+    }
+    Commit();
+    SIM_CHECK(*write == expected, "address %u has %u after the commit, not %u", address, *write, expected);
+    SIM_CHECK(ReadRegister(address) == *read, "address %u read %u, not %u", address, ReadRegister(address), *read);
+}
+
+/*
+ * This checks registers that can only be read, each one reads values[n] and
+ * writing them changes nothing.
+ */
+static void CheckReadOnly(unsigned char address, unsigned char count, const volatile unsigned char *values, size_t stride) {
+    unsigned char n, before;
+    for (n = 0; n < count; n++) {
+        Cover(address + n);
+        before = values[n * stride];
+        WriteRegister(address + n, (unsigned char)(before + 1));
+        Commit();
+        SIM_CHECK(values[n * stride] == before, "address %u can be written", address + n);
+        SIM_CHECK(ReadRegister(address + n) == values[n * stride], "address %u read %u, not %u",
+                address + n, ReadRegister(address + n), values[n * stride]);
+    }
+}
+
+/*
+ * This checks a latched block, the reads come from ReadLatch.
+ */
+static void CheckLatched(unsigned char address, unsigned char length) {
+    unsigned char n;
+    for (n = 0; n < length; n++) {
+        ReadLatch[n] = (unsigned char)(0xA0 + n);
+    }
+    CheckReadOnly(address, length, ReadLatch, 1);
+}
+
+/*
+ * This checks that the queue registers add a segment to their own motor's
+ * queue.
+ */
+static void CheckQueues(void) {
+    const unsigned char segment[4] = {10, 0, 100, 1};
+    unsigned char n, m, k;
+    for (n = 0; n < 4; n++) {
+        Cover(MOTOR0_QUEUE_ADDRESS + n);
+        InitQueues();
+        for (k = 0; k < 4; k++) {
+            WriteRegister(MOTOR0_QUEUE_ADDRESS + n, segment[k]);
+        }
+        Commit();
+        for (m = 0; m < 4; m++) {
+            SIM_CHECK(ReadRegister(MOTOR0_QUEUE_DEPTH_ADDRESS + m) == (m == n),
+                    "a segment for motor %u left %u in the queue of motor %u", n, ReadRegister(MOTOR0_QUEUE_DEPTH_ADDRESS + m), m);
+        }
+        SIM_CHECK(ReadRegister(MOTOR0_QUEUE_ADDRESS + n) == 0xFF, "address %u can be read", MOTOR0_QUEUE_ADDRESS + n);
+    }
+    InitQueues();
+}
+
+/*
+ * This checks the whole map and that the addresses around it aren't
+ * registers.
+ */
+static void CheckMap(void) {
+    const unsigned char *move;
+    unsigned int address;
+    unsigned char n, k;
+
+    Cover(0);
+    SIM_CHECK(ReadRegister(0) == 0xFF, "address 0 can be read");
+    CheckMotorGroup(SPEED_ADDRESS, 1, offsetof(struct Motor, target), offsetof(struct Motor, duty), 100, SHADOWED);
+    CheckPacked(MOTOR_TYPE_ADDRESS, offsetof(struct Motor, motorType), offsetof(struct Motor, motorType), 0);
+    CheckMotorGroup(MOTOR0_TYPE_ADDRESS, 0, offsetof(struct Motor, motorType), offsetof(struct Motor, motorType), 0xFF, 0);
+    for (n = 0; n < 4; n++) {
+        Motors[n].motorType = MOTOR_TYPE_DC;
+    }
+    CheckPacked(DIRECTION_ADDRESS, offsetof(struct Motor, targetDirection), offsetof(struct Motor, direction), BIT);
+    CheckMotorGroup(MOTOR0_DIRECTION_ADDRESS, 0, offsetof(struct Motor, targetDirection), offsetof(struct Motor, direction), 0, SHADOWED | BIT);
+    CheckGlobal(PAUSE_ADDRESS, &PWMPause, &PWMPause, 1, 1, SHADOWED);
+    CheckMotorGroup(MOTOR0_PAUSE_ADDRESS, 0, offsetof(struct Motor, paused), offsetof(struct Motor, paused), 0, SHADOWED | BIT);
+    CheckGlobal(ENABLE_ADDRESS, &PWMEnable, &PWMEnable, 0, 0, SHADOWED);
+    CheckMotorGroup(MOTOR0_ENABLE_ADDRESS, 0, offsetof(struct Motor, enabled), offsetof(struct Motor, enabled), 0, SHADOWED | BIT);
+    CheckMotorGroup(ACCEL_ADDRESS, 1, offsetof(struct Motor, accelType), offsetof(struct Motor, accelType), 1, 0);
+    CheckMotorGroup(ACCEL_RATE_ADDRESS, 1, offsetof(struct Motor, accelRate), offsetof(struct Motor, accelRate), 3, 0);
+    CheckMotorGroup(MINIMUM_DUTY_ADDRESS, 1, offsetof(struct Motor, minimumDuty), offsetof(struct Motor, minimumDuty), 0, 0);
+    for (n = 0; n < 4; n++) {
+        Motors[n].minimumDuty = 0;
+    }
+    CheckReadOnly(MOTOR0_TARGET_ADDRESS, 4, &Motors[0].target, sizeof(struct Motor));
+    CheckMotorGroup(MOTOR0_TARGET_DIRECTION_ADDRESS, 0, offsetof(struct Motor, targetDirection),
+            offsetof(struct Motor, targetDirection), 0, SHADOWED | BIT);
+    CheckGlobal(COMMAND_OVERFLOW_ADDRESS, &CommandOverflows, &CommandOverflows, 0, 0, 0);
+    Cover(COMMIT_ADDRESS);
+    SIM_CHECK(ReadRegister(COMMIT_ADDRESS) == 0xFF, "the commit address can be read");
+    CheckLatched(STATUS_ADDRESS, STATUS_LENGTH);
+    CheckMotorGroup(ACCEL_CURVE_ADDRESS, 1, offsetof(struct Motor, accelCurve), offsetof(struct Motor, accelCurve), 2, 0);
+    CheckMotorGroup(SCURVE_ACCEL_ADDRESS, 1, offsetof(struct Motor, maxAccel), offsetof(struct Motor, maxAccel), 20, 0);
+    CheckMotorGroup(SCURVE_JERK_ADDRESS, 1, offsetof(struct Motor, jerk), offsetof(struct Motor, jerk), 30, 0);
+    CheckMotorGroup(ACCEL_STEP_ADDRESS, 1, offsetof(struct Motor, accelStep), offsetof(struct Motor, accelStep), 1, 0);
+    CheckMotorGroup(ACCEL_STEP_FRACTION_ADDRESS, 1, offsetof(struct Motor, accelStepFraction),
+            offsetof(struct Motor, accelStepFraction), 40, 0);
+    //A period of 0x1034 ticks is in range with the 1:4 prescaler
+    CheckGlobal(PWM_PERIOD_ADDRESS, &PWMConfig.periodLow, &PWMConfig.periodLow, 0x34, 0x34, SHADOWED);
+    CheckGlobal(PWM_PERIOD_HIGH_ADDRESS, &PWMConfig.periodHigh, &PWMConfig.periodHigh, 0x10, 0x10, SHADOWED);
+    CheckGlobal(PWM_PRESCALE_ADDRESS, &PWMConfig.prescale, &PWMConfig.prescale, 2, 2, SHADOWED);
+    CheckMotorGroup(TARGET_FRACTION_ADDRESS, 1, offsetof(struct Motor, targetFraction), offsetof(struct Motor, targetFraction), 50, SHADOWED);
+    //The motors are already at their targets, so the sync ends straight away
+    CheckGlobal(SYNC_ADDRESS, &SyncRequest, &SyncMask, 0b0011, 0, REQUEST);
+    CheckGlobal(SYNC_TICKS_ADDRESS, &SyncTicksLow, &SyncTicksLow, 60, 60, 0);
+    CheckGlobal(SYNC_TICKS_HIGH_ADDRESS, &SyncTicksHigh, &SyncTicksHigh, 1, 1, 0);
+    CheckQueues();
+    CheckReadOnly(MOTOR0_QUEUE_DEPTH_ADDRESS, 4, &Motors[0].queueDepth, sizeof(struct Motor));
+    CheckMotorGroup(MOTOR0_QUEUE_UNDERRUN_ADDRESS, 0, offsetof(struct Motor, queueUnderruns),
+            offsetof(struct Motor, queueUnderruns), 0, 0);
+    //Motor 3 doesn't have encoder inputs so it can't be turned on
+    CheckGlobal(ENCODER_ENABLE_ADDRESS, &EncoderEnable, &EncoderEnable, 0b1111, 0b0111, REQUEST);
+    WriteRegister(ENCODER_ENABLE_ADDRESS, 0);
+    Commit();
+    CheckLatched(ENCODER_ADDRESS, ENCODER_LENGTH);
+    CheckMotorGroup(PID_KP_ADDRESS, 1, offsetof(struct Motor, pidKp), offsetof(struct Motor, pidKp), 60, 0);
+    CheckMotorGroup(PID_KI_ADDRESS, 1, offsetof(struct Motor, pidKi), offsetof(struct Motor, pidKi), 70, 0);
+    CheckMotorGroup(PID_KD_ADDRESS, 1, offsetof(struct Motor, pidKd), offsetof(struct Motor, pidKd), 80, 0);
+    //Without encoders the moves don't start
+    CheckGlobal(MOVE_ADDRESS, &MoveRequest, &MoveMask, 0b0101, 0, REQUEST);
+    SIM_CHECK(MoveMask == 0, "moves started without encoders");
+    for (n = 0; n < 4; n++) {
+        for (k = 0; k < 4; k++) {
+            move = &Motors[0].moveDistance[k];
+            CheckMotorRegister(MOTOR0_MOVE_ADDRESS + 4 * n + k, n, move - (const unsigned char *)&Motors[0],
+                    move - (const unsigned char *)&Motors[0], (unsigned char)(16 * n + k + 1), 0);
+        }
+    }
+    CheckMotorGroup(BRAKE_MODE_ADDRESS, 1, offsetof(struct Motor, brakeMode), offsetof(struct Motor, brakeMode), BRAKE_COAST, 0);
+    CheckMotorGroup(BRAKE_TIME_ADDRESS, 1, offsetof(struct Motor, brakeTime), offsetof(struct Motor, brakeTime), 90, 0);
+    CheckMotorGroup(DEAD_TIME_ADDRESS, 1, offsetof(struct Motor, deadTime), offsetof(struct Motor, deadTime), 2, 0);
+    CheckLatched(STEP_ADDRESS, STEP_LENGTH);
+    CheckLatched(PERF_ADDRESS, PERF_LENGTH);
+    //The trace and the profiles act on the command in the main loop
+    CheckGlobal(TRACE_ADDRESS, &TraceCommand, &TraceState, TRACE_ARMED, TRACE_ARMED, 0);
+    TraceCommand = 0;
+    CheckGlobal(TRACE_MOTORS_ADDRESS, &TraceMotors, &TraceMotors, 0b0110, 0b0110, 0);
+    CheckReadOnly(TRACE_COUNT_ADDRESS, 1, &TraceCount, 1);
+    Cover(TRACE_DATA_ADDRESS);
+    SIM_CHECK(ReadRegister(TRACE_DATA_ADDRESS) == 0xFF, "the trace data can be read before it is frozen");
+    CheckGlobal(PROFILE_ADDRESS, &ProfileCommand, &ProfileStatus, PROFILE_SAVE, PROFILE_SAVE, 0);
+    ProfileCommand = 0;
+    CheckGlobal(PROFILE_SLOT_ADDRESS, &ProfileSlot, &ProfileSlot, 2, 2, 0);
+    CheckGlobal(I2C_ADDRESS_ADDRESS, &I2CAddress, &I2CAddress, 0x30, 0x30, 0);
+    CheckGlobal(I2C_MASK_ADDRESS, &I2CMask, &I2CMask, 0x01, 0x01, 0);
+    CheckGlobal(I2C_GENERAL_CALL_ADDRESS, &I2CGeneralCall, &I2CGeneralCall, 3, 1, 0);
+    CheckGlobal(PEC_ADDRESS, &PECEnable, &PECEnable, 3, 1, SHADOWED);
+    CheckGlobal(PEC_READ_LENGTH_ADDRESS, &PECReadLength, &PECReadLength, 4, 4, SHADOWED);
+    CheckGlobal(PEC_ERRORS_ADDRESS, &PECErrors, &PECErrors, 0, 0, 0);
+    CheckGlobal(TRACE_DIVISOR_ADDRESS, &TraceDivisor, &TraceDivisor, 8, 8, 0);
+
+    for (address = 0; address < 256; address++) {
+        if (address < REGISTER_END) {
+            SIM_CHECK(Covered[address], "address %u isn't checked", address);
+        } else {
+            WriteRegister((unsigned char)address, 1);
+            SIM_CHECK(ReadRegister((unsigned char)address) == 0xFF, "address %u can be read", address);
+        }
+    }
+}
+
+int main(void) {
+    InitPWM();
+    InitControlTick();
+    InitServo();
+    InitStepper();
+    InitI2C();
+    LoadShadow();
+    CheckMap();
+    return SimExit();
+}
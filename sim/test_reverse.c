@@ -0,0 +1,164 @@
+/*
+ * file: sim/test_reverse.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This checks that the direction pins of a motor only change after its pwm
+ * pin has been off for the dead time, when the PID and a synchronised move
+ * reverse the motor as well as when the host does, and that the pwm pin stays
+ * on while the motor is shorted by BRAKE_SHORT.
+ */
+
+#include "sim.h"
+
+static unsigned char PWMPin, DirPin, CDirPin;
+
+/*
+ * This gives the level of a pin at a time and the number of times it changed
+ * from then until the end time.
+ */
+static unsigned char PinLevel(unsigned char pin, unsigned long time, unsigned long end, unsigned long *changes) {
+    unsigned long n;
+    unsigned char level = 0;
+    *changes = 0;
+    for (n = 0; n < SimEdgeCount && SimEdges[n].time < end; n++) {
+        if (SimEdges[n].pin != pin) {
+            continue;
+        }
+        if (SimEdges[n].time <= time) {
+            level = SimEdges[n].level;
+        } else {
+            (*changes)++;
+        }
+    }
+    return level;
+}
+
+/*
+ * This checks every change of the direction pin since from and gives the
+ * number of them.
+ */
+static unsigned long CheckDirectionChanges(unsigned long from) {
+    unsigned long n, pwmLow = 0, changes = 0;
+    unsigned char pwm = 0;
+    for (n = 0; n < SimEdgeCount; n++) {
+        if (SimEdges[n].pin == PWMPin) {
+            pwm = SimEdges[n].level;
+            pwmLow = SimEdges[n].time;
+        } else if (SimEdges[n].pin == DirPin && SimEdges[n].time >= from) {
+            changes++;
+            SIM_CHECK(!pwm, "the direction changed at %lu with the pwm pin on", SimEdges[n].time);
+            //The default dead time is 1 control tick, 1ms
+            SIM_CHECK(SimEdges[n].time - pwmLow >= SIM_US(900),
+                    "the direction changed at %lu only %lu cycles after the pwm pin went off", SimEdges[n].time, SimEdges[n].time - pwmLow);
+        }
+    }
+    return changes;
+}
+
+int main(void) {
+    //A 2ms period so the pwm pin is switching all of the time
+    unsigned char period[3] = {(unsigned char)1000, 1000 >> 8, 3};
+    unsigned char value, forward[2], backward[2];
+    unsigned char sync[3] = {0, 100, 0};
+    unsigned long from;
+
+    PWMPin = SimFirmwarePin(0);
+    DirPin = SimFirmwarePin(1);
+    CDirPin = SimFirmwarePin(2);
+    SimStart();
+    SimRun(SIM_MS(5));
+    SimI2CWriteRegisters(PWM_PERIOD_ADDRESS, period, 3, 0);
+
+    //The host changing the direction
+    value = 200;
+    SimI2CWriteRegisters(MOTOR_0_SPEED_ADDRESS, &value, 1, 0);
+    SimRun(SIM_MS(20));
+    from = SimTime;
+    value = 0;
+    SimI2CWriteRegisters(MOTOR0_DIRECTION_ADDRESS, &value, 1, 0);
+    SimRun(SIM_MS(100));
+    SIM_CHECK(CheckDirectionChanges(from) == 1, "the host didn't reverse the motor");
+
+    //A synchronised move from 200 forward to 200 backward goes through 0.
+    //The acceleration is slowed right down so only the move changes the
+    //duty.
+    value = 255;
+    SimI2CWriteRegisters(MOTOR0_ACCEL_RATE_ADDRESS, &value, 1, 0);
+    forward[0] = 200;
+    forward[1] = 1;
+    SimI2CWriteRegisters(MOTOR0_TARGET_ADDRESS, forward, 1, 0);
+    SimI2CWriteRegisters(MOTOR0_TARGET_DIRECTION_ADDRESS, &forward[1], 1, 0);
+    value = 0;
+    SimI2CWriteRegisters(MOTOR0_ACCEL_RATE_ADDRESS, &value, 1, 0);
+    SimRun(SIM_MS(100));
+    value = 255;
+    SimI2CWriteRegisters(MOTOR0_ACCEL_RATE_ADDRESS, &value, 1, 0);
+    from = SimTime;
+    backward[0] = 200;
+    backward[1] = 0;
+    SimI2CWriteRegisters(MOTOR0_TARGET_ADDRESS, backward, 1, 0);
+    SimI2CWriteRegisters(MOTOR0_TARGET_DIRECTION_ADDRESS, &backward[1], 1, 0);
+    sync[0] = 1;
+    SimI2CWriteRegisters(SYNC_TICKS_ADDRESS, &sync[1], 2, 0);
+    SimI2CWriteRegisters(SYNC_ADDRESS, sync, 1, 0);
+    SimRun(SIM_MS(150));
+    SIM_CHECK(CheckDirectionChanges(from) == 1, "the synchronised move didn't reverse the motor once");
+
+    //Without an encoder the PID sees the motor stopped, so it drives flat out
+    //the way the target points and reverses when the target does
+    value = 1;
+    SimI2CWriteRegisters(MOTOR0_ACCEL_RATE_ADDRESS, &value, 1, 0);
+    value = ACCEL_PID;
+    SimI2CWriteRegisters(MOTOR0_ACCEL_TYPE_ADDRESS, &value, 1, 0);
+    SimI2CWriteRegisters(MOTOR0_TARGET_DIRECTION_ADDRESS, &forward[1], 1, 0);
+    value = 10;
+    SimI2CWriteRegisters(MOTOR0_TARGET_ADDRESS, &value, 1, 0);
+    SimRun(SIM_MS(300));
+    from = SimTime;
+    SimI2CWriteRegisters(MOTOR0_TARGET_DIRECTION_ADDRESS, &backward[1], 1, 0);
+    SimRun(SIM_MS(500));
+    SIM_CHECK(CheckDirectionChanges(from) == 1, "the PID didn't reverse the motor once");
+
+    //BRAKE_SHORT for 50 control ticks, both direction pins and the pwm pin are
+    //on. The pwm pin comes on at the start of the next period.
+    value = ACCEL_INSTANT;
+    SimI2CWriteRegisters(MOTOR0_ACCEL_TYPE_ADDRESS, &value, 1, 0);
+    value = BRAKE_SHORT;
+    SimI2CWriteRegisters(MOTOR0_BRAKE_MODE_ADDRESS, &value, 1, 0);
+    value = 50;
+    SimI2CWriteRegisters(MOTOR0_BRAKE_TIME_ADDRESS, &value, 1, 0);
+    value = 200;
+    SimI2CWriteRegisters(MOTOR0_TARGET_ADDRESS, &value, 1, 0);
+    SimRun(SIM_MS(20));
+    from = SimTime;
+    SimI2CWriteRegisters(MOTOR0_TARGET_DIRECTION_ADDRESS, &forward[1], 1, 0);
+    SimRun(SIM_MS(100));
+    {
+        unsigned long n, start = 0, changes;
+        for (n = 0; n < SimEdgeCount; n++) {
+            //The motor is going backwards so the short starts when the
+            //direction pin comes on
+            if (SimEdges[n].time >= from && SimEdges[n].pin == DirPin && SimEdges[n].level) {
+                start = SimEdges[n].time;
+                break;
+            }
+        }
+        SIM_CHECK(start && PinLevel(CDirPin, start, start, &changes), "the motor wasn't shorted");
+        SIM_CHECK(PinLevel(PWMPin, start + SIM_MS(5), start + SIM_MS(45), &changes) && changes == 0,
+                "the pwm pin changed %lu times while the motor was shorted", changes);
+    }
+    return SimExit();
+}
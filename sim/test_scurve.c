@@ -0,0 +1,111 @@
+/*
+ * file: sim/test_scurve.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This checks the bounds of the S-curve acceleration. Ramps are run with
+ * different maximum accelerations and jerks, one acceleration step each
+ * control tick, and on every step the acceleration has to be at most maxAccel,
+ * it can only change by jerk and the speed has to change by the acceleration.
+ * The ramp has to get to the target without going past it, and the speed it
+ * stops from when it snaps onto the target has to be small.
+ */
+
+#include "sim.h"
+
+//The maximum acceleration and the jerk of each ramp, the first one is the
+//default from InitPWM
+static const unsigned char Limits[][2] = {
+    {16, 2}, {16, 1}, {64, 8}, {255, 1}, {8, 16}, {255, 255},
+};
+
+static int Magnitude(int value) {
+    return value < 0 ? -value : value;
+}
+
+/*
+ * This runs a ramp of motor 0 from start to target and checks every step.
+ */
+static void CheckRamp(unsigned char maxAccel, unsigned char jerk, unsigned char start, unsigned char target) {
+    long position, last, goal = (long)target << 8;
+    int velocity, acceleration, lastVelocity = 0, lastAcceleration = 0;
+    int worstJerk = 0, worstAccel = 0, arrival = 0;
+    unsigned long n, limit;
+
+    Motors[0].accelType = ACCEL_INSTANT;
+    Motors[0].target = start;
+    ControlTick();
+    Motors[0].accelType = ACCEL_SCURVE;
+    Motors[0].accelRate = 1;
+    Motors[0].maxAccel = maxAccel;
+    Motors[0].jerk = jerk;
+    Motors[0].target = target;
+    last = (long)Motors[0].duty << 8;
+    //Long enough to get there with the acceleration ramping up by 1 each step
+    limit = 4 * (unsigned long)((start > target ? start - target : target - start) + 256);
+    for (n = 0; n < limit && last != goal; n++) {
+        ControlTick();
+        position = ((long)Motors[0].duty << 8) | Motors[0].dutyFraction;
+        velocity = Motors[0].state.drive.velocity;
+        acceleration = Motors[0].state.drive.acceleration;
+        SIM_CHECK(Magnitude(acceleration) <= maxAccel, "%u/%u, %u to %u: an acceleration of %d at step %lu",
+                maxAccel, jerk, start, target, acceleration, n);
+        SIM_CHECK((goal - position) * (goal - last) >= 0, "%u/%u, %u to %u: went past the target at step %lu",
+                maxAccel, jerk, start, target, n);
+        if (position == goal) {
+            //The last step lines the motor up on the target and stops it
+            arrival = Magnitude(lastVelocity);
+        } else {
+            if (jerk && Magnitude(acceleration - lastAcceleration) > worstJerk) {
+                worstJerk = Magnitude(acceleration - lastAcceleration);
+            }
+            if (Magnitude(acceleration) > worstAccel) {
+                worstAccel = Magnitude(acceleration);
+            }
+            SIM_CHECK(velocity == 0 || velocity - lastVelocity == acceleration,
+                    "%u/%u, %u to %u: the speed went from %d to %d with an acceleration of %d at step %lu",
+                    maxAccel, jerk, start, target, lastVelocity, velocity, acceleration, n);
+            SIM_CHECK(position - last == velocity, "%u/%u, %u to %u: moved %ld at a speed of %d at step %lu",
+                    maxAccel, jerk, start, target, position - last, velocity, n);
+        }
+        lastVelocity = velocity;
+        lastAcceleration = acceleration;
+        last = position;
+    }
+    printf("max %u jerk %u, %u to %u: %lu steps, acceleration up to %d, changing by up to %d, "
+            "stopped from %d\n", maxAccel, jerk, start, target, n, worstAccel, worstJerk, arrival);
+    SIM_CHECK(last == goal, "%u/%u, %u to %u: not there after %lu steps", maxAccel, jerk, start, target, limit);
+    SIM_CHECK(worstJerk <= jerk, "%u/%u, %u to %u: the acceleration changed by %d in a step",
+            maxAccel, jerk, start, target, worstJerk);
+    //It only snaps onto the target when it is less than a duty away and the
+    //speed it would have next is at most maxAccel, so the speed it had is at
+    //most twice that
+    SIM_CHECK(arrival <= 2 * maxAccel, "%u/%u, %u to %u: stopped from a speed of %d",
+            maxAccel, jerk, start, target, arrival);
+}
+
+int main(void) {
+    unsigned char n;
+    InitPWM();
+    SIM_CHECK(Motors[0].maxAccel == Limits[0][0] && Motors[0].jerk == Limits[0][1],
+            "the default S-curve is %u/%u", Motors[0].maxAccel, Motors[0].jerk);
+    for (n = 0; n < sizeof(Limits) / sizeof(Limits[0]); n++) {
+        CheckRamp(Limits[n][0], Limits[n][1], 10, 255);
+        CheckRamp(Limits[n][0], Limits[n][1], 255, 10);
+        CheckRamp(Limits[n][0], Limits[n][1], 100, 110);
+        CheckRamp(Limits[n][0], Limits[n][1], 110, 109);
+    }
+    return SimExit();
+}
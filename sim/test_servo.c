@@ -0,0 +1,137 @@
+/*
+ * file: sim/test_servo.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This checks the servo pulses and frames with each Timer1 prescaler, and that
+ * the servo edges don't hold up the pwm edges of a DC motor running with them.
+ * The prescaler is also changed while a pulse is going on, the pulse has to
+ * keep its width.
+ */
+
+#include "sim.h"
+
+#define PULSES 16
+//How late an edge can be when it comes at the same time as another one and
+//waits for it in the interrupt
+#define LATENESS SIM_US(10)
+
+/*
+ * This runs a servo on motor 1 next to a DC motor on motor 0 and checks both.
+ * The servo pulse should be pulse microseconds, to within a Timer1 tick and
+ * the time it can wait for a pwm edge, and the frames shouldn't drift.
+ */
+static void CheckServo(unsigned char prescale, unsigned int period, unsigned char duty, unsigned long pulse) {
+    unsigned long start[PULSES], width[PULSES];
+    unsigned long count, n, from, tick = 1UL << prescale;
+    unsigned long longest = 0, shortest = ~0UL;
+    unsigned char config[3];
+    unsigned char servo = SimFirmwarePin(5), dc = SimFirmwarePin(0);
+    unsigned char value;
+
+    config[0] = (unsigned char)period;
+    config[1] = (unsigned char)(period >> 8);
+    config[2] = prescale;
+    SimI2CWriteRegisters(PWM_PERIOD_ADDRESS, config, 3, 0);
+    value = MOTOR_TYPE_SERVO;
+    SimI2CWriteRegisters(MOTOR1_TYPE_ADDRESS, &value, 1, 0);
+    SimI2CWriteRegisters(MOTOR_1_SPEED_ADDRESS, &duty, 1, 0);
+    value = 64;
+    SimI2CWriteRegisters(MOTOR_0_SPEED_ADDRESS, &value, 1, 0);
+    //Let the new prescaler and tables get going
+    SimRun(SIM_MS(60));
+    from = SimTime;
+    SimLongestISR[SIM_HIGH] = 0;
+    SimRun(SIM_MS(20 * PULSES));
+
+    count = SimPulses(servo, from, start, width, PULSES);
+    SIM_CHECK(count >= PULSES - 2, "prescaler %u: %lu servo pulses", prescale, count);
+    for (n = 0; n < count; n++) {
+        SIM_CHECK(width[n] + tick + LATENESS > SIM_US(pulse) && width[n] < SIM_US(pulse) + tick + LATENESS,
+                "prescaler %u: servo pulse %lu is %lu cycles, not %lu", prescale, n, width[n], SIM_US(pulse));
+        if (n) {
+            SIM_CHECK(start[n] - start[n - 1] + LATENESS >= SIM_US(SERVO_FRAME_US) &&
+                    start[n] - start[n - 1] <= SIM_US(SERVO_FRAME_US) + LATENESS,
+                    "prescaler %u: servo frame %lu is %lu cycles", prescale, n, start[n] - start[n - 1]);
+        }
+    }
+    SIM_CHECK(count < 2 || start[count - 1] - start[0] + LATENESS >= (count - 1) * SIM_US(SERVO_FRAME_US),
+            "prescaler %u: the servo frames drift", prescale);
+    SIM_CHECK(count < 2 || start[count - 1] - start[0] <= (count - 1) * SIM_US(SERVO_FRAME_US) + LATENESS,
+            "prescaler %u: the servo frames drift", prescale);
+
+    //The dc pulses are all the same however close a servo edge comes
+    count = SimPulses(dc, from, start, width, PULSES);
+    SIM_CHECK(count == PULSES, "prescaler %u: %lu dc pulses", prescale, count);
+    for (n = 0; n < count; n++) {
+        if (width[n] > longest) {
+            longest = width[n];
+        }
+        if (width[n] < shortest) {
+            shortest = width[n];
+        }
+    }
+    SIM_CHECK(longest - shortest <= 2 * LATENESS, "prescaler %u: the dc pulses change by %lu cycles", prescale, longest - shortest);
+    //Nothing waits in the interrupt, the longest it takes is a few edges
+    SIM_CHECK(SimLongestISR[SIM_HIGH] < SIM_US(20), "prescaler %u: the interrupt took %lu cycles", prescale, SimLongestISR[SIM_HIGH]);
+}
+
+/*
+ * This changes the prescaler back and forth while a servo runs, with a 1ms pwm
+ * period so that the change comes in the middle of the pulses, and checks
+ * that every pulse keeps its width.
+ */
+static void CheckPrescaleChange(void) {
+    unsigned long start[2 * PULSES], width[2 * PULSES];
+    unsigned long count, n, from;
+    //The same 1ms period with the 1:1 and the 1:8 prescaler
+    unsigned char slow[3] = {500 & 0xFF, 500 >> 8, 3}, fast[3] = {4000 & 0xFF, 4000 >> 8, 0};
+    unsigned char servo = SimFirmwarePin(5), duty = 128;
+
+    SimI2CWriteRegisters(PWM_PERIOD_ADDRESS, slow, 3, 0);
+    SimI2CWriteRegisters(MOTOR_1_SPEED_ADDRESS, &duty, 1, 0);
+    SimRun(SIM_MS(60));
+    from = SimTime;
+    for (n = 0; n < PULSES; n++) {
+        //The change is saved in the EEPROM, which takes a few ms, and then
+        //starts with the next period. Each one comes at a different point
+        //in the frame.
+        SimRun(SIM_MS(20) + SIM_US(300));
+        SimI2CWriteRegisters(PWM_PERIOD_ADDRESS, n & 1 ? slow : fast, 3, 0);
+    }
+    SimRun(SIM_MS(40));
+    count = SimPulses(servo, from, start, width, 2 * PULSES);
+    SIM_CHECK(count >= PULSES, "prescaler changes: %lu servo pulses", count);
+    for (n = 0; n < count; n++) {
+        //Within a tick of the 1:8 prescaler and the time it can wait
+        SIM_CHECK(width[n] + 8 + LATENESS > SIM_US(1500) && width[n] < SIM_US(1500) + 8 + LATENESS,
+                "prescaler changes: servo pulse %lu is %lu cycles, not %lu", n, width[n], SIM_US(1500));
+    }
+}
+
+int main(void) {
+    SimStart();
+    SimRun(SIM_MS(5));
+    //A duty of 1 is a 1003us pulse, an odd number of microseconds, and a
+    //duty of 128 is 1500us
+    CheckServo(3, PWM_PERIOD_TICKS, 1, 1003);
+    CheckServo(3, PWM_PERIOD_TICKS, 128, 1500);
+    CheckServo(2, 10000, 255, 1996);
+    //With the 1:1 prescaler a frame is more than the whole Timer1 range
+    CheckServo(0, 16000, 1, 1003);
+    CheckServo(1, 16000, 200, 1781);
+    CheckPrescaleChange();
+    return SimExit();
+}
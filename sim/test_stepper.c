@@ -0,0 +1,109 @@
+/*
+ * file: sim/test_stepper.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This runs two steppers at full and part speed next to a DC motor and checks
+ * the step timing, the step counts read over i2c and that the interrupt
+ * doesn't wait for the steps.
+ */
+
+#include "sim.h"
+
+#define PULSES 400
+//How late a step can be when it waits for another edge in the interrupt
+#define LATENESS SIM_US(10)
+
+static unsigned long Start[PULSES], Width[PULSES];
+
+/*
+ * This checks the steps on a pin since from, the time between them should be
+ * interval cycles. It gives the number of steps.
+ */
+static unsigned long CheckSteps(unsigned char pin, unsigned long from, unsigned long interval) {
+    unsigned long count = SimPulses(pin, from, Start, Width, PULSES);
+    unsigned long n, bad = 0;
+    SIM_CHECK(count > 10, "only %lu steps on pin %u", count, pin);
+    for (n = 0; n < count; n++) {
+        if (Width[n] == 0 || Width[n] > SIM_US(20)) {
+            bad++;
+        }
+        if (n && (Start[n] - Start[n - 1] + LATENESS < interval || Start[n] - Start[n - 1] > interval + LATENESS)) {
+            bad++;
+        }
+    }
+    SIM_CHECK(bad == 0, "%lu steps on pin %u are the wrong width or at the wrong time", bad, pin);
+    //Late steps don't slow the rest down
+    SIM_CHECK(count < 2 || (Start[count - 1] - Start[0] + LATENESS >= (count - 1) * interval &&
+            Start[count - 1] - Start[0] <= (count - 1) * interval + LATENESS), "the steps on pin %u drift", pin);
+    return count;
+}
+
+static long StepCount(unsigned char index) {
+    unsigned char bytes[STEP_LENGTH];
+    SimI2CReadRegisters(STEP_ADDRESS, bytes, STEP_LENGTH, 0);
+    return (long)(int)((unsigned long)bytes[4 * index] | (unsigned long)bytes[4 * index + 1] << 8 |
+            (unsigned long)bytes[4 * index + 2] << 16 | (unsigned long)bytes[4 * index + 3] << 24);
+}
+
+int main(void) {
+    unsigned char value, stepper2 = SimFirmwarePin(6), stepper3 = SimFirmwarePin(11);
+    unsigned long from, steps;
+    long before, after;
+
+    SimStart();
+    SimRun(SIM_MS(5));
+    value = MOTOR_TYPE_STEPPER;
+    SimI2CWriteRegisters(MOTOR2_TYPE_ADDRESS, &value, 1, 0);
+    SimI2CWriteRegisters(MOTOR3_TYPE_ADDRESS, &value, 1, 0);
+    value = 64;
+    SimI2CWriteRegisters(MOTOR_0_SPEED_ADDRESS, &value, 1, 0);
+    //255 is 65280 in 1/256 duty, 128000000 / 65280 cycles is 245 ticks of 2us
+    //between steps. 100 is 5000 cycles.
+    value = 255;
+    SimI2CWriteRegisters(MOTOR_2_SPEED_ADDRESS, &value, 1, 0);
+    value = 100;
+    SimI2CWriteRegisters(MOTOR_3_SPEED_ADDRESS, &value, 1, 0);
+    SimRun(SIM_MS(20));
+
+    before = StepCount(2);
+    from = SimTime;
+    SimLongestISR[SIM_HIGH] = 0;
+    SimRun(SIM_MS(150));
+    steps = CheckSteps(stepper2, from, 245 * 8);
+    CheckSteps(stepper3, from, 5000);
+    after = StepCount(2);
+    //The reads take about 2ms at 100kHz so a few steps happen during them
+    SIM_CHECK(after - before >= (long)steps && after - before <= (long)steps + 6,
+            "%lu steps but the count went from %ld to %ld", steps, before, after);
+    SIM_CHECK(SimLongestISR[SIM_HIGH] < SIM_US(20), "the interrupt took %lu cycles", SimLongestISR[SIM_HIGH]);
+
+    //Backwards the count goes down
+    value = 0;
+    SimI2CWriteRegisters(MOTOR2_DIRECTION_ADDRESS, &value, 1, 0);
+    SimRun(SIM_MS(100));
+    before = StepCount(2);
+    SimRun(SIM_MS(50));
+    SIM_CHECK(StepCount(2) < before - 90, "the count didn't go down going backwards");
+
+    //Stopped there are no more steps
+    value = 0;
+    SimI2CWriteRegisters(MOTOR_2_SPEED_ADDRESS, &value, 1, 0);
+    SimRun(SIM_MS(10));
+    from = SimTime;
+    SimRun(SIM_MS(50));
+    SIM_CHECK(SimPulses(stepper2, from, Start, Width, PULSES) == 0, "a stopped stepper stepped");
+    return SimExit();
+}
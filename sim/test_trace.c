@@ -0,0 +1,70 @@
+/*
+ * file: sim/test_trace.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This traces a whole linear ramp from 0 to 255 with TRACE_DIVISOR at 16 and
+ * checks that all of it is in the 16 entries.
+ */
+
+#include "sim.h"
+
+int main(void) {
+    unsigned char bytes[TRACE_SIZE * 5];
+    unsigned char value, count = 0, n;
+    unsigned int tick, lastTick = 0;
+
+    SimStart();
+    SimRun(SIM_MS(5));
+    value = ACCEL_LINEAR;
+    SimI2CWriteRegisters(MOTOR0_ACCEL_TYPE_ADDRESS, &value, 1, 0);
+    value = 1;
+    SimI2CWriteRegisters(MOTOR0_ACCEL_RATE_ADDRESS, &value, 1, 0);
+    value = 1;
+    SimI2CWriteRegisters(TRACE_MOTORS_ADDRESS, &value, 1, 0);
+    value = 16;
+    SimI2CWriteRegisters(TRACE_DIVISOR_ADDRESS, &value, 1, 0);
+    value = TRACE_ARMED;
+    SimI2CWriteRegisters(TRACE_ADDRESS, &value, 1, 0);
+    SimRun(SIM_MS(5));
+
+    //One step of duty each control tick, the ramp takes 255ms
+    value = 255;
+    SimI2CWriteRegisters(MOTOR_0_SPEED_ADDRESS, &value, 1, 0);
+    SimRun(SIM_MS(300));
+    value = TRACE_FROZEN;
+    SimI2CWriteRegisters(TRACE_ADDRESS, &value, 1, 0);
+    SimRun(SIM_MS(2));
+
+    SimI2CReadRegisters(TRACE_COUNT_ADDRESS, &count, 1, 0);
+    SIM_CHECK(count == TRACE_SIZE, "%u entries", count);
+    SimI2CReadRegisters(TRACE_DATA_ADDRESS, bytes, count * 5, 0);
+    for (n = 0; n < count; n++) {
+        tick = bytes[5 * n] | (bytes[5 * n + 1] << 8);
+        SIM_CHECK((bytes[5 * n + 2] & 0x7F) == 0, "entry %u is for motor %u", n, bytes[5 * n + 2] & 0x7F);
+        SIM_CHECK(bytes[5 * n + 4] == 255, "entry %u has a target of %u", n, bytes[5 * n + 4]);
+        if (n + 1 < count) {
+            SIM_CHECK(bytes[5 * n + 3] == 16 * (n + 1), "entry %u has a duty of %u", n, bytes[5 * n + 3]);
+        }
+        //The points are evenly spaced in time too
+        if (n && n + 1 < count) {
+            SIM_CHECK(tick - lastTick == 16, "entry %u is %u ticks after the one before", n, tick - lastTick);
+        }
+        lastTick = tick;
+    }
+    //The last entry is the end of the ramp
+    SIM_CHECK(bytes[5 * (count - 1) + 3] == 255, "the last entry has a duty of %u", bytes[5 * (count - 1) + 3]);
+    return SimExit();
+}
@@ -0,0 +1,180 @@
+/*
+ * file: sim/xc.h
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This takes the place of the XC8 <xc.h> when the firmware is built on the
+ * host, see sim.h. It only has the registers and bits of the PIC18F14K50 that
+ * the firmware uses, with the same names and the same bit order.
+ *
+ * Most registers are plain variables in sim.c. The timers, the latches, the
+ * EEPROM and SSPADD go through a function that brings them up to date with the
+ * simulated clock first, so the firmware reads and writes them the same way
+ * as on the chip. The firmware is built with int as a 16 bit type so nothing
+ * in here uses int.
+ */
+
+#ifndef SIM_XC_H
+#define SIM_XC_H
+
+//XC8 keywords and built in functions
+#define interrupt
+#define high_priority
+#define low_priority
+#define di() (INTCONbits.GIE = 0)
+#define ei() SimEnableInterrupts()
+#define NOP()
+#define CLRWDT()
+
+void SimEnableInterrupts(void);
+
+typedef struct {
+    unsigned RA0:1, RA1:1, RA2:1, RA3:1, RA4:1, RA5:1, RA6:1, RA7:1;
+} PORTAbits_t;
+typedef struct {
+    unsigned RB0:1, RB1:1, RB2:1, RB3:1, RB4:1, RB5:1, RB6:1, RB7:1;
+} PORTBbits_t;
+typedef struct {
+    unsigned SCS:2, IOFS:1, OSTS:1, IRCF:3, IDLEN:1;
+} OSCCONbits_t;
+typedef struct {
+    unsigned T0PS:3, PSA:1, T0SE:1, T0CS:1, T08BIT:1, TMR0ON:1;
+} T0CONbits_t;
+typedef struct {
+    unsigned TMR1ON:1, TMR1CS:1, NOT_T1SYNC:1, T1OSCEN:1, T1CKPS:2, T1RUN:1, RD16:1;
+} T1CONbits_t;
+typedef struct {
+    unsigned T2CKPS:2, TMR2ON:1, T2OUTPS:4, :1;
+} T2CONbits_t;
+typedef struct {
+    unsigned TMR3ON:1, TMR3CS:1, NOT_T3SYNC:1, T3CCP1:1, T3CKPS:2, :1, RD16:1;
+} T3CONbits_t;
+typedef struct {
+    unsigned CCP1M:4, DC1B:2, P1M:2;
+} CCP1CONbits_t;
+//GIEH and GIEL are the names of GIE and PEIE while IPEN is set
+typedef struct {
+    unsigned RABIF:1, INT0IF:1, TMR0IF:1, RABIE:1, INT0IE:1, TMR0IE:1;
+    union {
+        struct {
+            unsigned PEIE:1, GIE:1;
+        };
+        struct {
+            unsigned GIEL:1, GIEH:1;
+        };
+    };
+} INTCONbits_t;
+typedef struct {
+    unsigned RABIP:1, :1, TMR0IP:1, :1, INTEDG2:1, INTEDG1:1, INTEDG0:1, NOT_RABPU:1;
+} INTCON2bits_t;
+typedef struct {
+    unsigned TMR1IF:1, TMR2IF:1, CCP1IF:1, SSPIF:1, TXIF:1, RCIF:1, ADIF:1, :1;
+} PIR1bits_t;
+typedef struct {
+    unsigned TMR1IE:1, TMR2IE:1, CCP1IE:1, SSPIE:1, TXIE:1, RCIE:1, ADIE:1, :1;
+} PIE1bits_t;
+typedef struct {
+    unsigned TMR1IP:1, TMR2IP:1, CCP1IP:1, SSPIP:1, TXIP:1, RCIP:1, ADIP:1, :1;
+} IPR1bits_t;
+typedef struct {
+    unsigned :1, TMR3IF:1, USBIF:1, :1, BCLIF:1, EEIF:1, C2IF:1, OSCFIF:1;
+} PIR2bits_t;
+typedef struct {
+    unsigned :1, TMR3IE:1, USBIE:1, :1, BCLIE:1, EEIE:1, C2IE:1, OSCFIE:1;
+} PIE2bits_t;
+typedef struct {
+    unsigned :1, TMR3IP:1, USBIP:1, :1, BCLIP:1, EEIP:1, C2IP:1, OSCFIP:1;
+} IPR2bits_t;
+typedef struct {
+    unsigned NOT_BOR:1, NOT_POR:1, NOT_PD:1, NOT_TO:1, NOT_RI:1, :1, SBOREN:1, IPEN:1;
+} RCONbits_t;
+typedef struct {
+    unsigned :4, WPUB4:1, WPUB5:1, WPUB6:1, WPUB7:1;
+} WPUBbits_t;
+typedef struct {
+    unsigned BF:1, UA:1, R_nW:1, S:1, P:1, D_nA:1, CKE:1, SMP:1;
+} SSPSTATbits_t;
+typedef struct {
+    unsigned SSPM:4, CKP:1, SSPEN:1, SSPOV:1, WCOL:1;
+} SSPCON1bits_t;
+typedef struct {
+    unsigned SEN:1, RSEN:1, PEN:1, RCEN:1, ACKEN:1, ACKDT:1, ACKSTAT:1, GCEN:1;
+} SSPCON2bits_t;
+typedef struct {
+    unsigned RD:1, WR:1, WREN:1, WRERR:1, FREE:1, :1, CFGS:1, EEPGD:1;
+} EECON1bits_t;
+typedef struct {
+    unsigned ANS8:1, ANS9:1, ANS10:1, ANS11:1, :4;
+} ANSELHbits_t;
+
+extern volatile unsigned char TRISA, TRISB, TRISC;
+extern volatile unsigned char PORTA, PORTB, PORTC;
+extern volatile PORTAbits_t PORTAbits;
+extern volatile PORTBbits_t PORTBbits;
+extern volatile OSCCONbits_t OSCCONbits;
+extern volatile T0CONbits_t T0CONbits;
+extern volatile T1CONbits_t T1CONbits;
+extern volatile T2CONbits_t T2CONbits;
+extern volatile T3CONbits_t T3CONbits;
+extern volatile CCP1CONbits_t CCP1CONbits;
+extern volatile unsigned char PR2, TMR2;
+extern volatile unsigned short CCPR1;
+extern volatile INTCONbits_t INTCONbits;
+extern volatile INTCON2bits_t INTCON2bits;
+extern volatile PIR1bits_t PIR1bits;
+extern volatile PIE1bits_t PIE1bits;
+extern volatile IPR1bits_t IPR1bits;
+extern volatile PIR2bits_t PIR2bits;
+extern volatile PIE2bits_t PIE2bits;
+extern volatile IPR2bits_t IPR2bits;
+extern volatile RCONbits_t RCONbits;
+extern volatile WPUBbits_t WPUBbits;
+extern volatile SSPSTATbits_t SSPSTATbits;
+extern volatile SSPCON1bits_t SSPCON1bits;
+extern volatile SSPCON2bits_t SSPCON2bits;
+extern volatile unsigned char SSPBUF;
+extern volatile unsigned char IOCA, IOCB;
+extern volatile ANSELHbits_t ANSELHbits;
+extern volatile unsigned char EEADR, EECON2;
+
+//The timers count with the simulated clock, reading one moves the clock on
+//by the time the read takes
+volatile unsigned short *SimTimer0(void);
+volatile unsigned short *SimTimer1(void);
+volatile unsigned short *SimTimer3(void);
+#define TMR0 (*SimTimer0())
+#define TMR1 (*SimTimer1())
+#define TMR3 (*SimTimer3())
+
+//The output latches, each use takes SimLatchCycles so a pulse that is turned
+//on and off in the same interrupt is recorded with its width
+volatile unsigned char *SimLAT(unsigned char port);
+#define LATA (*SimLAT(0))
+#define LATB (*SimLAT(1))
+#define LATC (*SimLAT(2))
+
+//SSPMSK is at the same address as SSPADD and is used in its place while SSPM
+//is 1001
+volatile unsigned char *SimSSPADD(void);
+#define SSPADD (*SimSSPADD())
+#define SSPMSK (*SimSSPADD())
+
+//The EEPROM reads and writes take effect when the registers are next used
+volatile EECON1bits_t *SimEECON1(void);
+volatile unsigned char *SimEEDATA(void);
+#define EECON1bits (*SimEECON1())
+#define EEDATA (*SimEEDATA())
+
+#endif
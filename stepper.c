@@ -0,0 +1,162 @@
+/*
+ * file: stepper.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This file has the stepper outputs. A stepper uses the pwm pin as the STEP
+ * input of a stepper driver and the dir pin as its DIR input. The duty is the
+ * step rate, so the rate is ramped by the acceleration profiles the same as
+ * the speed of a DC motor.
+ *
+ * The steps are timed by CCP1 and Timer1 along with the pwm and servo edges,
+ * see PWMEdgeInterrupt. StepDue has the Timer1 count when the next step of
+ * each stepper is due and StepNextTime the earliest of them, CCPR1 is set to
+ * it when it comes before the next pwm or servo edge. Each step is timed from
+ * when the last one was due, not from when the interrupt got to it, so a late
+ * interrupt doesn't slow the steps down, and Timer1 is never written so no
+ * counts are lost.
+ *
+ * The step rate is limited so the interrupt can keep up. Counting the
+ * instructions in StepperInterrupt, a step takes about 40 instruction cycles
+ * for each stepper that is running plus about 60 to get in and out of the
+ * interrupt and pick the next edge, so a step of all four steppers at once is
+ * about 55us and a step of one about 25us. At STEPPER_STEPS_PER_DUTY a duty
+ * of 255 is 2040 steps a second (490us between steps), so four steppers
+ * stepping at different times at full speed keep the interrupt busy about a
+ * fifth of the time and a pwm edge waits at most about 55us behind a step.
+ * These are estimates, PERF_ADDRESS + 4 gives the longest interrupt on a
+ * running controller.
+ */
+
+#include "parameters.h"
+
+//The time between steps of each stepper in Timer1 ticks, 0 if it isn't
+//stepping. The main loop sets these with interrupts off.
+unsigned int StepIntervals[4];
+//The duty that each interval was worked out from, and the Timer1 prescaler
+unsigned int StepDuties[4];
+unsigned char StepPrescale = 0;
+//When the next step of each stepper is due
+unsigned int StepDue[4];
+//The steppers that are stepping
+volatile unsigned char SteppersRunning = 0;
+//When the next step of any stepper is due
+volatile unsigned int StepNextTime = 0;
+
+/*
+ * Nothing steps until UpdateSteppers starts a stepper.
+ */
+void InitStepper(void) {
+    unsigned char n;
+    for (n = 0; n < 4; n++) {
+        StepIntervals[n] = 0;
+        StepDuties[n] = 0;
+    }
+    SteppersRunning = 0;
+    StepPrescale = T1CONbits.T1CKPS;
+}
+
+/*
+ * This is called at the end of every control tick. It works out the time
+ * between steps for each stepper from its duty, the division is only done
+ * when the duty or the Timer1 prescaler has changed. A stepper that starts
+ * takes its first step one interval from now.
+ */
+void UpdateSteppers(void) {
+    unsigned int position, interval;
+    unsigned long cycles;
+    unsigned char n, bit, prescale = T1CONbits.T1CKPS;
+    for (n = 0, bit = 1; n < 4; n++, bit <<= 1) {
+        position = 0;
+        //OutputPosition is 0 during the dead time before a change of direction
+        if (PWMEnable && Motors[n].enabled && Motors[n].motorType == MOTOR_TYPE_STEPPER) {
+            position = OutputPosition(n);
+        }
+        if (position == StepDuties[n] && prescale == StepPrescale) {
+            continue;
+        }
+        StepDuties[n] = position;
+        interval = 0;
+        if (position != 0) {
+            cycles = (STEPPER_INTERVAL_SCALE / position) >> prescale;
+            if (cycles <= STEPPER_MAXIMUM_INTERVAL) {
+                interval = (unsigned int)cycles;
+            }
+        }
+        di();
+        StepIntervals[n] = interval;
+        if (interval && !(SteppersRunning & bit)) {
+            StepDue[n] = TMR1 + interval;
+            if (!SteppersRunning || (int)(StepDue[n] - StepNextTime) < 0) {
+                StepNextTime = StepDue[n];
+            }
+            SteppersRunning |= bit;
+            //Bring the compare forward if the step comes before the next edge
+            if ((int)(StepNextTime - CCPR1) < 0) {
+                CCPR1 = StepNextTime;
+            }
+        }
+        ei();
+    }
+    StepPrescale = prescale;
+}
+
+/*
+ * This is called from the CCP1 interrupt when the next step is due. It makes a
+ * step for every stepper that is due and sets StepNextTime to when the next
+ * one is. A stepper whose interval has been set to 0 stops here.
+ */
+void StepperInterrupt(void) {
+    const unsigned char *step;
+    unsigned int now = StepNextTime;
+    unsigned int next = now + STEPPER_MAXIMUM_INTERVAL;
+    unsigned char n, bit, stepped = 0;
+    for (n = 0, bit = 1; n < 4; n++, bit <<= 1) {
+        if (!(SteppersRunning & bit)) {
+            continue;
+        }
+        if (StepIntervals[n] == 0) {
+            SteppersRunning &= (unsigned char)~bit;
+            continue;
+        }
+        if ((int)(StepDue[n] - now) <= 0) {
+            stepped |= bit;
+            StepDue[n] += StepIntervals[n];
+            //Don't try to catch up if the interrupt was held off for more
+            //than a whole step
+            if ((int)(StepDue[n] - now) <= 0) {
+                StepDue[n] = now + StepIntervals[n];
+            }
+        }
+        if ((int)(StepDue[n] - next) < 0) {
+            next = StepDue[n];
+        }
+    }
+    StepNextTime = next;
+    step = PWMPins[stepped];
+    LATA |= step[PORT_A];
+    LATB |= step[PORT_B];
+    LATC |= step[PORT_C];
+    //The step pulse is high while the step counts are changed, which is
+    //longer than the drivers need
+    for (n = 0, bit = 1; n < 4; n++, bit <<= 1) {
+        if (stepped & bit) {
+            MotorPositions[n] += Motors[n].direction ? 1 : -1;
+        }
+    }
+    LATA &= ~step[PORT_A];
+    LATB &= ~step[PORT_B];
+    LATC &= ~step[PORT_C];
+}
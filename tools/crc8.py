@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+#
+# file: crc8.py
+#
+# Copyright 2017 OokTech
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+# This generates crc8.c, the table for the SMBus packet error code. Run it
+# from the top of the repository:
+#
+#   python3 tools/crc8.py > crc8.c
+#
+# The PEC is a CRC-8 with the polynomial x^8 + x^2 + x + 1 (0x07), starting
+# from 0 with no reflection or final xor. With the table each byte only takes
+# one lookup, crc = CRC8Table[crc ^ byte].
+
+POLYNOMIAL = 0x07
+
+HEADER = """/*
+ * file: crc8.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This file is generated by tools/crc8.py, don't edit it by hand.
+ *
+ * CRC8Table[n] is the CRC-8 (polynomial 0x%02X) of the byte n, the CRC of the
+ * next byte is CRC8Table[crc ^ byte]. It is used for the SMBus packet error
+ * code, see PEC_ADDRESS.
+ */
+
+#include "parameters.h"
+
+const unsigned char CRC8Table[256] = {"""
+
+
+def crc(value):
+    for _ in range(8):
+        if value & 0x80:
+            value = ((value << 1) ^ POLYNOMIAL) & 0xFF
+        else:
+            value = (value << 1) & 0xFF
+    return value
+
+
+def main():
+    print(HEADER % POLYNOMIAL)
+    table = [crc(n) for n in range(256)]
+    for row in range(0, 256, 16):
+        line = ", ".join("0x%02X" % v for v in table[row:row + 16])
+        end = "," if row + 16 < 256 else ""
+        print("    " + line + end)
+    print("};")
+
+
+if __name__ == "__main__":
+    main()
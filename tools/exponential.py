@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+#
+# file: exponential.py
+#
+# Copyright 2017 OokTech
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+# This generates exponential.c, the step size tables for the exponential
+# acceleration profile. Run it from the top of the repository:
+#
+#   python3 tools/exponential.py > exponential.c
+#
+# With an exponential profile the distance to the target shrinks by the same
+# fraction every acceleration step, so the step for a distance d is
+# d * (1 - e^(-1/tau)) where tau is the time constant in steps. The steps are
+# rounded to the nearest whole duty, at least 1 so that the ramp always
+# finishes and never more than d so that it never overshoots.
+
+import math
+
+# The time constant of each curve in acceleration steps, the curve is picked
+# for each motor with the accel curve registers.
+TIME_CONSTANTS = [4, 8, 16, 32]
+
+HEADER = """/*
+ * file: exponential.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This file is generated by tools/exponential.py, don't edit it by hand.
+ *
+ * ExponentialSteps[curve][distance] is the change in duty for one step of the
+ * exponential acceleration profile when the duty is distance away from the
+ * target. The time constants of the curves are %s steps.
+ */
+
+#include "parameters.h"
+
+const unsigned char ExponentialSteps[EXPONENTIAL_CURVES][256] = {"""
+
+
+def step(distance, tau):
+    if distance == 0:
+        return 0
+    change = int(round(distance * (1 - math.exp(-1.0 / tau))))
+    return min(max(change, 1), distance)
+
+
+def main():
+    print(HEADER % ", ".join(str(t) for t in TIME_CONSTANTS))
+    for c, tau in enumerate(TIME_CONSTANTS):
+        print("    //tau = %d" % tau)
+        print("    {")
+        steps = [step(d, tau) for d in range(256)]
+        for row in range(0, 256, 16):
+            line = ", ".join("%3d" % v for v in steps[row:row + 16])
+            end = "," if row + 16 < 256 else ""
+            print("        " + line + end)
+        print("    }" + ("," if c + 1 < len(TIME_CONSTANTS) else ""))
+    print("};")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,266 @@
+#!/usr/bin/env python3
+#
+# file: ramsize.py
+#
+# Copyright 2017 OokTech
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+# This checks that the firmware fits in the 768 bytes of RAM of the
+# PIC18F14K50. It fails (exit status 1) if it doesn't. There are two ways to
+# run it:
+#
+#   python3 tools/ramsize.py --summary dist/default/production/*.map
+#
+# reads the "Data space used" line of the XC8 memory summary, from the files
+# given or from stdin. This is the real number and is what the build checks.
+#
+#   python3 tools/ramsize.py sim/build/firmware/*.o
+#
+# works it out from the debug information of the host build in sim/, so it
+# can be checked without the compiler. Every variable that isn't const is
+# counted with the sizes XC8 uses (int 2 bytes, long 4, pointers 2, no
+# padding). XC8 doesn't use a stack for the locals and arguments, it gives
+# each function its own place in RAM and functions that are never running at
+# the same time share it (the compiled stack). That is worked out the same
+# way from the call graph in the debug information: the deepest chain of
+# calls from main, from the high priority interrupt and from the low priority
+# interrupt, as they can all be running at once, with HELPER_RESERVE bytes
+# on each for the compiler's maths routines and the interrupt context. The
+# biggest variables are listed so it is easy to see where the RAM went.
+
+import re
+import subprocess
+import sys
+
+RAM_SIZE = 768
+HELPER_RESERVE = 16
+ROOTS = ("FirmwareMain", "HighISR", "LowISR")
+
+# The XC8 size of each base type, by the name the host compiler gives it
+BASE_SIZES = {
+    "char": 1, "signed char": 1, "unsigned char": 1, "_Bool": 1,
+    "short int": 2, "short unsigned int": 2, "int": 2, "unsigned int": 2,
+    "long int": 4, "long unsigned int": 4,
+    "long long int": 8, "long long unsigned int": 8,
+    "float": 4, "double": 4,
+}
+POINTER_SIZE = 2
+
+DIE = re.compile(r"^\s*<(\d+)><([0-9a-f]+)>: Abbrev Number: \d+ \((\w+)\)")
+ATTRIBUTE = re.compile(r"^\s*<[0-9a-f]+>\s+(DW_AT_\w+)\s*:\s*(.*)$")
+REFERENCE = re.compile(r"<0x([0-9a-f]+)>")
+SUMMARY = re.compile(r"Data space\s+used\s+[0-9A-Fa-f]+h\s*\(\s*(\d+)\)")
+
+
+def read_dies(path):
+    """Gives the DIEs of an object as a dict from offset to (tag, depth,
+    attributes, children)."""
+    text = subprocess.run(["objdump", "--dwarf=info", path], check=True,
+                          capture_output=True, text=True).stdout
+    dies = {}
+    parents = []
+    die = None
+    for line in text.splitlines():
+        match = DIE.match(line)
+        if match:
+            depth, offset, tag = int(match.group(1)), int(match.group(2), 16), match.group(3)
+            die = {"tag": tag, "depth": depth, "attributes": {}, "children": []}
+            dies[offset] = die
+            del parents[depth:]
+            if parents:
+                parents[-1]["children"].append(die)
+            parents.append(die)
+            continue
+        match = ATTRIBUTE.match(line)
+        if match and die is not None:
+            die["attributes"][match.group(1)] = match.group(2).strip()
+    return dies
+
+
+def name_of(die):
+    value = die["attributes"].get("DW_AT_name", "")
+    return value.split(": ")[-1].strip()
+
+
+def number(value):
+    return int(value.split()[0], 0)
+
+
+def referenced(dies, die, attribute):
+    match = REFERENCE.search(die["attributes"].get(attribute, ""))
+    return dies[int(match.group(1), 16)] if match else None
+
+
+def type_size(dies, die):
+    """Gives the XC8 size of a type."""
+    if die is None:
+        return 0
+    tag = die["tag"]
+    if tag == "DW_TAG_base_type":
+        return BASE_SIZES[name_of(die)]
+    if tag == "DW_TAG_pointer_type":
+        return POINTER_SIZE
+    if tag == "DW_TAG_enumeration_type":
+        return 2
+    if tag in ("DW_TAG_typedef", "DW_TAG_volatile_type", "DW_TAG_const_type"):
+        return type_size(dies, referenced(dies, die, "DW_AT_type"))
+    if tag == "DW_TAG_array_type":
+        count = 1
+        for child in die["children"]:
+            if child["tag"] != "DW_TAG_subrange_type":
+                continue
+            if "DW_AT_count" in child["attributes"]:
+                count *= number(child["attributes"]["DW_AT_count"])
+            elif "DW_AT_upper_bound" in child["attributes"]:
+                count *= number(child["attributes"]["DW_AT_upper_bound"]) + 1
+            else:
+                count = 0
+        return count * type_size(dies, referenced(dies, die, "DW_AT_type"))
+    if tag == "DW_TAG_union_type":
+        return max([type_size(dies, referenced(dies, m, "DW_AT_type")) for m in die["children"]] + [0])
+    if tag == "DW_TAG_structure_type":
+        # Bit fields are packed into bytes the way XC8 packs them, a run of
+        # them takes as many bytes as it has bits
+        size, bits = 0, 0
+        for member in die["children"]:
+            if member["tag"] != "DW_TAG_member":
+                continue
+            if "DW_AT_bit_size" in member["attributes"]:
+                bits += number(member["attributes"]["DW_AT_bit_size"])
+                continue
+            size += (bits + 7) // 8
+            bits = 0
+            size += type_size(dies, referenced(dies, member, "DW_AT_type"))
+        return size + (bits + 7) // 8
+    raise ValueError("don't know the size of a %s" % tag)
+
+
+def is_const(dies, die):
+    """Gives True if a variable of this type is put in program memory."""
+    while die is not None:
+        if die["tag"] == "DW_TAG_const_type":
+            return True
+        if die["tag"] not in ("DW_TAG_typedef", "DW_TAG_volatile_type", "DW_TAG_array_type"):
+            return False
+        die = referenced(dies, die, "DW_AT_type")
+    return False
+
+
+def variables(path):
+    """Gives (name, size) for each variable in RAM that an object defines."""
+    dies = read_dies(path)
+    found = []
+    for die in dies.values():
+        if die["tag"] != "DW_TAG_variable" or "DW_OP_addr" not in die["attributes"].get("DW_AT_location", ""):
+            continue
+        declaration = referenced(dies, die, "DW_AT_specification") or die
+        kind = referenced(dies, declaration, "DW_AT_type")
+        if is_const(dies, kind):
+            continue
+        found.append((name_of(declaration), type_size(dies, kind)))
+    return found
+
+
+def local_size(dies, die):
+    """Gives the size of the locals and arguments of a function, without the
+    ones of the functions inlined into it."""
+    size = 0
+    for child in die["children"]:
+        if child["tag"] in ("DW_TAG_formal_parameter", "DW_TAG_variable"):
+            if "DW_OP_addr" in child["attributes"].get("DW_AT_location", ""):
+                continue
+            origin = referenced(dies, child, "DW_AT_abstract_origin") or child
+            size += type_size(dies, referenced(dies, origin, "DW_AT_type"))
+        elif child["tag"] == "DW_TAG_lexical_block":
+            size += local_size(dies, child)
+    return size
+
+
+def callees(dies, die, found):
+    """Adds the names of the functions that a function calls to found."""
+    for child in die["children"]:
+        if child["tag"] in ("DW_TAG_call_site", "DW_TAG_GNU_call_site"):
+            origin = referenced(dies, child, "DW_AT_call_origin") or referenced(dies, child, "DW_AT_abstract_origin")
+            if origin is not None:
+                found.add(name_of(origin))
+        elif child["tag"] == "DW_TAG_inlined_subroutine":
+            found.add(name_of(referenced(dies, child, "DW_AT_abstract_origin")))
+        elif child["tag"] == "DW_TAG_lexical_block":
+            callees(dies, child, found)
+
+
+def functions(path, graph):
+    """Adds each function that an object defines to graph as name: [size of
+    its locals, the names of the functions it calls]."""
+    dies = read_dies(path)
+    for die in dies.values():
+        if die["tag"] != "DW_TAG_subprogram" or "DW_AT_declaration" in die["attributes"]:
+            continue
+        origin = referenced(dies, die, "DW_AT_abstract_origin") or die
+        name = name_of(origin)
+        entry = graph.setdefault(name, [0, set()])
+        entry[0] = max(entry[0], local_size(dies, die))
+        callees(dies, die, entry[1])
+
+
+def stack_depth(graph, name, calling=()):
+    """Gives the most compiled stack used by a call of name."""
+    if name not in graph or name in calling:
+        return 0
+    size, called = graph[name]
+    return size + max([stack_depth(graph, c, calling + (name,)) for c in called] + [0])
+
+
+def check(used, what):
+    print("%s: %d of %d bytes of RAM" % (what, used, RAM_SIZE))
+    if used > RAM_SIZE:
+        print("the firmware doesn't fit in RAM")
+        return 1
+    return 0
+
+
+def main(arguments):
+    if arguments and arguments[0] == "--summary":
+        text = ""
+        if len(arguments) > 1:
+            for path in arguments[1:]:
+                with open(path) as f:
+                    text += f.read()
+        else:
+            text = sys.stdin.read()
+        match = SUMMARY.search(text)
+        if not match:
+            print("there isn't an XC8 memory summary in the input")
+            return 1
+        return check(int(match.group(1)), "XC8 data space used")
+    found = []
+    graph = {}
+    for path in arguments:
+        found += variables(path)
+        functions(path, graph)
+    found.sort(key=lambda v: -v[1])
+    for name, size in found[:10]:
+        print("%5d %s" % (size, name))
+    total = sum(size for _, size in found)
+    print("%5d in %d variables" % (total, len(found)))
+    stack = 0
+    for root in ROOTS:
+        depth = stack_depth(graph, root) + HELPER_RESERVE
+        print("%5d compiled stack for %s" % (depth, root))
+        stack += depth
+    return check(total + stack, "estimate")
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,185 @@
+/*
+ * file: trace.c
+ *
+ * Copyright 2017 OokTech
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * This file has the ramp trace. Every control tick that changes the duty or
+ * the direction of a traced motor adds an entry to a ring, so a ramp can be
+ * captured at the control tick rate and read afterwards, instead of the host
+ * polling the duty as fast as the bus allows.
+ *
+ * The ring only has TRACE_SIZE entries, so with TraceDivisor set a change of
+ * duty only gets an entry once the duty is that far from the last entry for
+ * the motor. The end of a ramp (the duty getting to the target) and a change
+ * of direction always get one, so the shape of a whole ramp is kept with its
+ * start, its end and evenly spaced points between.
+ *
+ * While the trace is armed the ring keeps the latest entries. Triggering it
+ * keeps recording until half of the ring is after the trigger and then
+ * freezes it. Once it is frozen the host reads the entries, oldest first,
+ * from TRACE_DATA_ADDRESS.
+ *
+ * The entries are kept in 4 bytes, the low 13 bits of the control tick count
+ * share a byte with the motor number and the direction. ReadTrace gives them
+ * to the host as 5 bytes.
+ *
+ * The states are changed from the main loop. The interrupt only reads the
+ * ring while it is frozen, when nothing is added to it.
+ */
+
+#include "parameters.h"
+
+//The number of bytes in each entry and the number the host reads for it
+#define TRACE_ENTRY_BYTES 4
+#define TRACE_READ_BYTES 5
+
+unsigned char TraceBuffer[TRACE_SIZE][TRACE_ENTRY_BYTES];
+//The state of the trace and the state the host asked for, 0 when there isn't
+//a new one
+unsigned char TraceState = TRACE_IDLE;
+unsigned char TraceCommand = 0;
+//The motors that are traced
+unsigned char TraceMotors = 0x0F;
+//The smallest change of duty that gets an entry and the duty of each motor in
+//its last entry
+unsigned char TraceDivisor = 0;
+unsigned char TraceLast[4];
+//The next entry to write and the number of entries in the ring
+unsigned char TraceHead = 0;
+unsigned char TraceCount = 0;
+//The number of entries left to record after the trigger
+unsigned char TraceAfter = 0;
+//The entry and the byte in it that the host reads next, and the number of
+//bytes left to read
+unsigned char TraceRead = 0;
+unsigned char TraceReadByte = 0;
+unsigned char TraceReadLeft = 0;
+
+/*
+ * This starts reading from the oldest entry.
+ */
+void RewindTrace(void) {
+    //The interrupt reads these
+    di();
+    TraceRead = (TraceHead - TraceCount) & (TRACE_SIZE - 1);
+    TraceReadByte = 0;
+    TraceReadLeft = TraceCount * TRACE_READ_BYTES;
+    ei();
+}
+
+/*
+ * This is called at the start of every control tick to act on a state written
+ * by the host.
+ */
+void RunTrace(void) {
+    unsigned char command = TraceCommand;
+    unsigned char n;
+    TraceCommand = 0;
+    if (command == TRACE_ARMED) {
+        //Start again with an empty ring, the changes are measured from where
+        //the motors are now
+        TraceHead = 0;
+        TraceCount = 0;
+        for (n = 0; n < 4; n++) {
+            TraceLast[n] = Motors[n].duty;
+        }
+        RewindTrace();
+        TraceState = TRACE_ARMED;
+    } else if (command == TRACE_TRIGGERED && TraceState == TRACE_ARMED) {
+        TraceAfter = TRACE_SIZE / 2;
+        TraceState = TRACE_TRIGGERED;
+    } else if (command == TRACE_FROZEN && TraceState != TRACE_IDLE) {
+        //Freezing a frozen trace reads it again from the start
+        TraceState = TRACE_FROZEN;
+        RewindTrace();
+    }
+}
+
+/*
+ * This is called for each motor after its control tick with the duty and the
+ * direction from before the tick. An entry is only added if they changed, and
+ * a change of duty only if it is the end of the ramp or it is at least
+ * TraceDivisor from the last entry.
+ */
+void TraceMotor(unsigned int index, unsigned char duty, unsigned char direction) {
+    unsigned char *entry;
+    unsigned char change;
+    if (TraceState != TRACE_ARMED && TraceState != TRACE_TRIGGERED) {
+        return;
+    }
+    if (!(TraceMotors & (1 << index))) {
+        return;
+    }
+    if (duty == Motors[index].duty && direction == Motors[index].direction) {
+        return;
+    }
+    if (direction == Motors[index].direction && Motors[index].duty != Motors[index].target) {
+        change = Motors[index].duty > TraceLast[index] ? Motors[index].duty - TraceLast[index] :
+                TraceLast[index] - Motors[index].duty;
+        if (change < TraceDivisor) {
+            return;
+        }
+    }
+    TraceLast[index] = Motors[index].duty;
+    entry = TraceBuffer[TraceHead];
+    entry[0] = (unsigned char)ControlTickCount;
+    entry[1] = (unsigned char)(((ControlTickCount >> 8) & 0x1F) | (index << 5) | (Motors[index].direction << 7));
+    entry[2] = Motors[index].duty;
+    entry[3] = Motors[index].target;
+    TraceHead = (TraceHead + 1) & (TRACE_SIZE - 1);
+    if (TraceCount < TRACE_SIZE) {
+        TraceCount++;
+    }
+    if (TraceState == TRACE_TRIGGERED && --TraceAfter == 0) {
+        TraceState = TRACE_FROZEN;
+        RewindTrace();
+    }
+}
+
+/*
+ * This is called from the interrupt for each byte read from
+ * TRACE_DATA_ADDRESS. It gives 0xFF when the trace isn't frozen or every entry
+ * has been read.
+ */
+unsigned char ReadTrace(void) {
+    unsigned char *entry;
+    unsigned char value;
+    if (TraceState != TRACE_FROZEN || TraceReadLeft == 0) {
+        return 0xFF;
+    }
+    entry = TraceBuffer[TraceRead];
+    switch (TraceReadByte) {
+        case 0:
+            value = entry[0];
+            break;
+        case 1:
+            value = entry[1] & 0x1F;
+            break;
+        case 2:
+            //The motor number with the direction in the top bit
+            value = (unsigned char)((entry[1] & 0x80) | ((entry[1] >> 5) & 0x03));
+            break;
+        default:
+            value = entry[TraceReadByte - 1];
+            break;
+    }
+    TraceReadLeft--;
+    TraceReadByte++;
+    if (TraceReadByte == TRACE_READ_BYTES) {
+        TraceReadByte = 0;
+        TraceRead = (TraceRead + 1) & (TRACE_SIZE - 1);
+    }
+    return value;
+}